@@ -0,0 +1,641 @@
+#include "types.h"
+#include "arch.h"
+#include "printf.h"
+#include "config.h"
+#include "libs.h"
+#include "bench.h"
+
+/*
+ * Lock-heavy microbenchmark for the paravirtual spinlock support of the
+ * hypervisor. Every vcpu takes a ticket lock BENCH_LOCK_ITERS times and holds
+ * it for a short critical section, once per waiting strategy:
+ *
+ *   spin   - plain busy loop, a preempted holder costs the waiter its whole slice
+ *   wfe    - wait with WFE, trapped by the hypervisor as a spin hint
+ *   pvyield - after BENCH_SPIN_THRESHOLD spins, yield directly to the holder
+ *
+ * It only shows a difference when the vcpus are overcommitted, e.g. with both
+ * vcpus pinned to one pcpu through vm_config.vcpu_affinity. The "vs spin"
+ * lines are the before/after figures: wfe and pvyield against plain spinning,
+ * on the same run.
+ */
+
+#define BENCH_LOCK_ITERS        20000
+#define BENCH_HOLD_LOOPS        200
+#define BENCH_SPIN_THRESHOLD    1000
+
+#define XHYPER_HC_YIELD_TO      0xc6000001
+#define XHYPER_HC_EXIT_STAT     0xc6000002
+
+/* hypervisor exit reasons, see hypervisor/include/exitstat.h */
+#define EXIT_WFE                1
+#define EXIT_HVC                2
+#define EXIT_STAT_COUNT         0
+
+enum bench_mode {
+    BENCH_SPIN,
+    BENCH_WFE,
+    BENCH_PVYIELD,
+    BENCH_NR_MODES,
+};
+
+static const char *bench_mode_name[BENCH_NR_MODES] = {
+    "spin", "wfe", "pvyield",
+};
+
+struct ticket_lock {
+    volatile u32 next;
+    volatile u32 owner;
+    volatile int holder;    /* vcpu id of the holder, read by the pv waiters */
+};
+
+static struct ticket_lock bench_lock;
+static volatile u64 bench_counter;
+static volatile u32 bench_arrived;
+
+extern u64 hvc_call(u64 funid, u64 arg0, u64 arg1);
+
+static inline u32 atomic_fetch_inc(volatile u32 *p)
+{
+    u32 old, tmp, fail;
+    asm volatile(
+        "1: ldaxr %w0, [%3]\n"
+        "   add   %w1, %w0, #1\n"
+        "   stxr  %w2, %w1, [%3]\n"
+        "   cbnz  %w2, 1b\n"
+        : "=&r"(old), "=&r"(tmp), "=&r"(fail)
+        : "r"(p)
+        : "memory");
+    return old;
+}
+
+static inline u64 bench_now(void)
+{
+    u64 cnt;
+    isb();
+    read_sysreg(cnt, cntvct_el0);
+    return cnt;
+}
+
+static void bench_lock_acquire(struct ticket_lock *lock, enum bench_mode mode)
+{
+    u32 ticket = atomic_fetch_inc(&lock->next);
+    u32 spins  = 0;
+
+    while(lock->owner != ticket) {
+        switch(mode) {
+            case BENCH_WFE:
+                asm volatile("wfe" ::: "memory");
+                break;
+            case BENCH_PVYIELD:
+                if(++spins >= BENCH_SPIN_THRESHOLD) {
+                    hvc_call(XHYPER_HC_YIELD_TO, lock->holder, 0);
+                    spins = 0;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    asm volatile("dmb ish" ::: "memory");
+    lock->holder = coreid();
+}
+
+static void bench_lock_release(struct ticket_lock *lock)
+{
+    asm volatile("dmb ish" ::: "memory");
+    lock->owner = lock->owner + 1;
+    /* wake the WFE waiters */
+    asm volatile("dsb ish\n sev" ::: "memory");
+}
+
+/* All vcpus leave together */
+static void bench_barrier(u32 *generation)
+{
+    *generation += NCPU;
+    atomic_fetch_inc(&bench_arrived);
+    while(bench_arrived < *generation)
+        ;
+}
+
+void bench_lock_run(void)
+{
+    u32 generation = 0;
+    u64 freq;
+    u64 mode_us[BENCH_NR_MODES];
+
+    read_sysreg(freq, cntfrq_el0);
+
+    for(int mode = 0; mode < BENCH_NR_MODES; mode++) {
+        bench_barrier(&generation);
+        u64 start = bench_now();
+
+        for(int i = 0; i < BENCH_LOCK_ITERS; i++) {
+            bench_lock_acquire(&bench_lock, mode);
+            for(volatile int j = 0; j < BENCH_HOLD_LOOPS; j++)
+                ;
+            bench_counter++;
+            bench_lock_release(&bench_lock);
+        }
+
+        u64 us = (bench_now() - start) * 1000000 / freq;
+        mode_us[mode] = us;
+        printf("bench lock %s: vcpu %d, %d iterations in %d us, exits so far wfe %d hvc %d\n",
+               bench_mode_name[mode], coreid(), BENCH_LOCK_ITERS, (u32)us,
+               (u32)hvc_call(XHYPER_HC_EXIT_STAT, EXIT_WFE, EXIT_STAT_COUNT),
+               (u32)hvc_call(XHYPER_HC_EXIT_STAT, EXIT_HVC, EXIT_STAT_COUNT));
+    }
+
+    /* plain spinning is the baseline the other strategies are measured against */
+    for(int mode = BENCH_SPIN + 1; mode < BENCH_NR_MODES; mode++) {
+        u64 base = mode_us[BENCH_SPIN] > 0 ? mode_us[BENCH_SPIN] : 1;
+        printf("bench lock %s vs spin: vcpu %d, %d us vs %d us, %d%% of the baseline time\n",
+               bench_mode_name[mode], coreid(), (u32)mode_us[mode], (u32)mode_us[BENCH_SPIN],
+               (u32)(mode_us[mode] * 100 / base));
+    }
+
+    bench_barrier(&generation);
+    if(coreid() == 0) {
+        printf("bench lock done, counter %d (expected %d)\n",
+               (u32)bench_counter, BENCH_LOCK_ITERS * NCPU * BENCH_NR_MODES);
+    }
+}
+
+/*
+ * Exit cost microbenchmark. Every vcpu issues BENCH_EXIT_ITERS cheap
+ * hypercalls back to back and prints the ns per exit, to compare hypervisor
+ * builds. The same loop on SMCCC_VERSION gives the round trip of the
+ * vector.S fast path next to the full save/C handler/restore one.
+ */
+
+#define BENCH_EXIT_ITERS        100000
+
+/* SMCCC_VERSION never leaves the vector.S fast path, unless built with FASTPATH=0 */
+#define SMCCC_VERSION           0x80000000
+
+static u64 bench_exit_loop(u64 funid, u64 freq)
+{
+    u64 start = bench_now();
+
+    for(int i = 0; i < BENCH_EXIT_ITERS; i++) {
+        hvc_call(funid, EXIT_HVC, EXIT_STAT_COUNT);
+    }
+
+    return (bench_now() - start) * 1000000000 / freq / BENCH_EXIT_ITERS;
+}
+
+void bench_exit_run(void)
+{
+    u32 generation = 0;
+    u64 freq;
+
+    read_sysreg(freq, cntfrq_el0);
+
+    bench_barrier(&generation);
+    u64 slow = bench_exit_loop(XHYPER_HC_EXIT_STAT, freq);
+    bench_barrier(&generation);
+    u64 fast = bench_exit_loop(SMCCC_VERSION, freq);
+
+    printf("bench exit: vcpu %d, %d hypercalls each, %d ns/exit full path, %d ns/exit fast path\n",
+           coreid(), BENCH_EXIT_ITERS, (u32)slow, (u32)fast);
+
+    bench_barrier(&generation);
+}
+
+/*
+ * iperf-style throughput between two guests over the virtio-net switch of
+ * the hypervisor. Needs two vms of this image with .virtio_net = true in
+ * the hypervisor's main.c and BENCH_NET here. The vm on port 1 (the first
+ * created) sends BENCH_NET_FRAMES frames of every size in bench_net_sizes
+ * to the one that announces itself, which counts what arrives; both print
+ * their side. Frames without a receive buffer are dropped by the switch,
+ * as on a wire, and show as loss.
+ *
+ * A minimal polled driver: vcpu 0 only, no interrupts, one single buffer
+ * descriptor per frame.
+ */
+
+#define BENCH_NET_FRAMES        20000
+#define BENCH_NET_KICK          32          /* frames queued per transmit notification */
+#define BENCH_NET_QSIZE         64
+#define BENCH_NET_BUF_SIZE      (SZ_4K * 3) /* a jumbo frame and its header */
+#define BENCH_NET_RETRY_US      10000
+
+/* virtio-mmio of the QEMU virt layout, see hypervisor/include/virtio.h */
+#define VIRTIO_MMIO_BASE        0x0a000000
+#define VIRTIO_MMIO_SLOT_SIZE   0x200
+#define VIRTIO_MMIO_SLOTS       32
+#define VIRTIO_MMIO_MAGIC       0x74726976
+#define VIRTIO_ID_NET           1
+#define VIRTIO_NET_F_MAC        5
+#define VIRTIO_NET_HDR_SIZE     12
+
+#define REG_MAGIC               0x000
+#define REG_VERSION             0x004
+#define REG_DEVICE_ID           0x008
+#define REG_DEVICE_FEATURES     0x010
+#define REG_DEVICE_FEATURES_SEL 0x014
+#define REG_DRIVER_FEATURES     0x020
+#define REG_DRIVER_FEATURES_SEL 0x024
+#define REG_QUEUE_SEL           0x030
+#define REG_QUEUE_NUM_MAX       0x034
+#define REG_QUEUE_NUM           0x038
+#define REG_QUEUE_READY         0x044
+#define REG_QUEUE_NOTIFY        0x050
+#define REG_STATUS              0x070
+#define REG_QUEUE_DESC          0x080
+#define REG_QUEUE_AVAIL         0x090
+#define REG_QUEUE_USED          0x0a0
+#define REG_CONFIG              0x100
+
+#define STATUS_ACKNOWLEDGE      1
+#define STATUS_DRIVER           2
+#define STATUS_DRIVER_OK        4
+#define STATUS_FEATURES_OK      8
+
+#define VRING_DESC_F_WRITE      2
+#define VRING_AVAIL_F_NO_INTERRUPT 1
+#define VRING_USED_F_NO_NOTIFY  1
+
+/* a local experimental ethertype, then op, phase and a count */
+#define BENCH_NET_ETHERTYPE     0x88b5
+#define BENCH_NET_READY         1
+#define BENCH_NET_DATA          2
+#define BENCH_NET_END           3
+#define BENCH_NET_DONE          4
+
+#define BENCH_NET_RXQ           0
+#define BENCH_NET_TXQ           1
+
+struct bench_desc {
+    u64 addr;
+    u32 len;
+    u16 flags;
+    u16 next;
+};
+
+struct bench_avail {
+    u16 flags;
+    u16 idx;
+    u16 ring[BENCH_NET_QSIZE];
+};
+
+struct bench_used {
+    u16 flags;
+    u16 idx;
+    struct {
+        u32 id;
+        u32 len;
+    } ring[BENCH_NET_QSIZE];
+};
+
+/* one page per ring, the hypervisor wants a ring contiguous in its memory */
+struct bench_vq {
+    struct bench_desc  desc[SZ_4K / sizeof(struct bench_desc)];
+    struct bench_avail avail;
+    u8 pad0[SZ_4K - sizeof(struct bench_avail)];
+    struct bench_used  used;
+    u8 pad1[SZ_4K - sizeof(struct bench_used)];
+};
+
+static struct bench_vq bench_vqs[2] __attribute__((aligned(SZ_4K)));
+static u16 bench_avail_idx[2];
+static u16 bench_used_seen[2];
+
+static u8 bench_rx_bufs[BENCH_NET_QSIZE][BENCH_NET_BUF_SIZE] __attribute__((aligned(SZ_4K)));
+static u8 bench_tx_data[BENCH_NET_BUF_SIZE] __attribute__((aligned(SZ_4K)));
+static u8 bench_tx_ctl[SZ_4K] __attribute__((aligned(SZ_4K)));
+
+static const u32 bench_net_sizes[] = { 64, 1514, 9014 };
+#define BENCH_NET_PHASES        (sizeof(bench_net_sizes) / sizeof(bench_net_sizes[0]))
+
+static u64 bench_net_base;
+static u8  bench_mac[6];
+static u8  bench_peer[6];
+
+static inline u32 net_read(u32 reg)
+{
+    return *(volatile u32 *)(bench_net_base + reg);
+}
+
+static inline void net_write(u32 reg, u32 val)
+{
+    *(volatile u32 *)(bench_net_base + reg) = val;
+}
+
+static inline void net_write64(u32 reg, u64 val)
+{
+    net_write(reg, val & 0xffffffff);
+    net_write(reg + 4, val >> 32);
+}
+
+/* the frames are not aligned, bytes only */
+static inline void put16(u8 *p, u32 v)
+{
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static inline void put32(u8 *p, u32 v)
+{
+    for(int i = 0; i < 4; i++) {
+        p[i] = v >> (24 - i * 8);
+    }
+}
+
+static inline u32 get32(const u8 *p)
+{
+    return (u32)p[0] << 24 | (u32)p[1] << 16 | (u32)p[2] << 8 | p[3];
+}
+
+static void bench_net_kick(int q)
+{
+    asm volatile("dmb ish" ::: "memory");
+    /* the switch never needs to hear of new receive buffers and says so */
+    if(!(*(volatile u16 *)&bench_vqs[q].used.flags & VRING_USED_F_NO_NOTIFY)) {
+        net_write(REG_QUEUE_NOTIFY, q);
+    }
+}
+
+static void bench_net_post(int q, u16 id, u64 addr, u32 len, u16 flags)
+{
+    struct bench_vq *vq = &bench_vqs[q];
+
+    vq->desc[id].addr  = addr;
+    vq->desc[id].len   = len;
+    vq->desc[id].flags = flags;
+    vq->avail.ring[bench_avail_idx[q] % BENCH_NET_QSIZE] = id;
+    asm volatile("dmb ish" ::: "memory");
+    *(volatile u16 *)&vq->avail.idx = ++bench_avail_idx[q];
+}
+
+static int bench_net_init(void)
+{
+    for(int slot = 0; slot < VIRTIO_MMIO_SLOTS; slot++) {
+        bench_net_base = VIRTIO_MMIO_BASE + slot * VIRTIO_MMIO_SLOT_SIZE;
+        if(net_read(REG_MAGIC) == VIRTIO_MMIO_MAGIC && net_read(REG_VERSION) == 2 &&
+           net_read(REG_DEVICE_ID) == VIRTIO_ID_NET) {
+            break;
+        }
+        bench_net_base = 0;
+    }
+    if(bench_net_base == 0) {
+        return -1;
+    }
+
+    net_write(REG_STATUS, 0);
+    net_write(REG_STATUS, STATUS_ACKNOWLEDGE | STATUS_DRIVER);
+    net_write(REG_DEVICE_FEATURES_SEL, 1);
+    if(!(net_read(REG_DEVICE_FEATURES) & 0x1)) {            /* VIRTIO_F_VERSION_1 */
+        return -1;
+    }
+    net_write(REG_DRIVER_FEATURES_SEL, 0);
+    net_write(REG_DRIVER_FEATURES, 1U << VIRTIO_NET_F_MAC);
+    net_write(REG_DRIVER_FEATURES_SEL, 1);
+    net_write(REG_DRIVER_FEATURES, 0x1);
+    net_write(REG_STATUS, STATUS_ACKNOWLEDGE | STATUS_DRIVER | STATUS_FEATURES_OK);
+    if(!(net_read(REG_STATUS) & STATUS_FEATURES_OK)) {
+        return -1;
+    }
+
+    for(int q = 0; q < 2; q++) {
+        struct bench_vq *vq = &bench_vqs[q];
+
+        net_write(REG_QUEUE_SEL, q);
+        if(net_read(REG_QUEUE_NUM_MAX) < BENCH_NET_QSIZE) {
+            return -1;
+        }
+        /* polled, no interrupts */
+        vq->avail.flags = VRING_AVAIL_F_NO_INTERRUPT;
+        net_write(REG_QUEUE_NUM, BENCH_NET_QSIZE);
+        net_write64(REG_QUEUE_DESC, (u64)vq->desc);
+        net_write64(REG_QUEUE_AVAIL, (u64)&vq->avail);
+        net_write64(REG_QUEUE_USED, (u64)&vq->used);
+        net_write(REG_QUEUE_READY, 1);
+    }
+    net_write(REG_STATUS, STATUS_ACKNOWLEDGE | STATUS_DRIVER | STATUS_FEATURES_OK | STATUS_DRIVER_OK);
+
+    for(int i = 0; i < 6; i++) {
+        bench_mac[i] = *(volatile u8 *)(bench_net_base + REG_CONFIG + i);
+    }
+
+    for(u16 i = 0; i < BENCH_NET_QSIZE; i++) {
+        bench_net_post(BENCH_NET_RXQ, i, (u64)bench_rx_bufs[i], BENCH_NET_BUF_SIZE, VRING_DESC_F_WRITE);
+    }
+    bench_net_kick(BENCH_NET_RXQ);
+    return 0;
+}
+
+/* A received frame, past the virtio header, or NULL. Handed back with bench_net_rx_done(). */
+static u8 *bench_net_rx(u32 *len, u16 *id)
+{
+    struct bench_vq *vq = &bench_vqs[BENCH_NET_RXQ];
+    u16 seen = bench_used_seen[BENCH_NET_RXQ];
+
+    if(*(volatile u16 *)&vq->used.idx == seen) {
+        return NULL;
+    }
+    asm volatile("dmb ish" ::: "memory");
+    *id  = vq->used.ring[seen % BENCH_NET_QSIZE].id;
+    *len = vq->used.ring[seen % BENCH_NET_QSIZE].len - VIRTIO_NET_HDR_SIZE;
+    bench_used_seen[BENCH_NET_RXQ] = seen + 1;
+    return bench_rx_bufs[*id] + VIRTIO_NET_HDR_SIZE;
+}
+
+static void bench_net_rx_done(u16 id)
+{
+    bench_net_post(BENCH_NET_RXQ, id, (u64)bench_rx_bufs[id], BENCH_NET_BUF_SIZE, VRING_DESC_F_WRITE);
+    bench_net_kick(BENCH_NET_RXQ);
+}
+
+static inline u16 bench_tx_inflight(void)
+{
+    return bench_avail_idx[BENCH_NET_TXQ] - *(volatile u16 *)&bench_vqs[BENCH_NET_TXQ].used.idx;
+}
+
+/* Queues a frame of len bytes at buf, which holds the virtio header then the frame */
+static void bench_net_tx(u8 *buf, u32 len, bool kick)
+{
+    if(bench_tx_inflight() >= BENCH_NET_QSIZE) {
+        bench_net_kick(BENCH_NET_TXQ);
+        while(bench_tx_inflight() >= BENCH_NET_QSIZE)
+            ;
+    }
+    /* descriptor ids follow the ring, the oldest one is free */
+    bench_net_post(BENCH_NET_TXQ, bench_avail_idx[BENCH_NET_TXQ] % BENCH_NET_QSIZE,
+                   (u64)buf, VIRTIO_NET_HDR_SIZE + len, 0);
+    if(kick) {
+        bench_net_kick(BENCH_NET_TXQ);
+    }
+}
+
+/* Until the switch is done with every queued frame, their buffers can then change */
+static void bench_net_tx_wait(void)
+{
+    bench_net_kick(BENCH_NET_TXQ);
+    while(bench_tx_inflight() != 0)
+        ;
+}
+
+static void bench_net_frame(u8 *buf, const u8 *dst, u8 op, u8 phase, u32 count)
+{
+    u8 *eth = buf + VIRTIO_NET_HDR_SIZE;
+
+    memset(buf, 0, VIRTIO_NET_HDR_SIZE + 64);
+    for(int i = 0; i < 6; i++) {
+        eth[i]     = dst[i];
+        eth[6 + i] = bench_mac[i];
+    }
+    put16(eth + 12, BENCH_NET_ETHERTYPE);
+    eth[14] = op;
+    eth[15] = phase;
+    put32(eth + 16, count);
+}
+
+static void bench_net_ctl(const u8 *dst, u8 op, u8 phase, u32 count)
+{
+    bench_net_frame(bench_tx_ctl, dst, op, phase, count);
+    bench_net_tx(bench_tx_ctl, 64, true);
+    bench_net_tx_wait();
+}
+
+static bool bench_net_ours(const u8 *eth, u32 len)
+{
+    return len >= 20 && eth[12] == (BENCH_NET_ETHERTYPE >> 8) && eth[13] == (BENCH_NET_ETHERTYPE & 0xff);
+}
+
+static void bench_net_send(u64 freq)
+{
+    u32 len;
+    u16 id;
+    u8 *eth;
+
+    /* the receiver announces itself, the switch has learned it by then */
+    for(bool ready = false; !ready; ) {
+        if((eth = bench_net_rx(&len, &id)) == NULL) {
+            continue;
+        }
+        if(bench_net_ours(eth, len) && eth[14] == BENCH_NET_READY) {
+            for(int i = 0; i < 6; i++) {
+                bench_peer[i] = eth[6 + i];
+            }
+            ready = true;
+        }
+        bench_net_rx_done(id);
+    }
+
+    for(u32 p = 0; p < BENCH_NET_PHASES; p++) {
+        u32 size = bench_net_sizes[p];
+        u32 received = 0;
+
+        bench_net_frame(bench_tx_data, bench_peer, BENCH_NET_DATA, p, 0);
+        u64 start = bench_now();
+        for(int i = 0; i < BENCH_NET_FRAMES; i++) {
+            bench_net_tx(bench_tx_data, size, (i + 1) % BENCH_NET_KICK == 0);
+        }
+        bench_net_tx_wait();
+        u64 us = (bench_now() - start) * 1000000 / freq;
+
+        /* until the receiver has its count, the end marker may be dropped too */
+        for(bool done = false; !done; ) {
+            bench_net_ctl(bench_peer, BENCH_NET_END, p, BENCH_NET_FRAMES);
+            u64 retry = bench_now() + freq * BENCH_NET_RETRY_US / 1000000;
+            while(!done && bench_now() < retry) {
+                if((eth = bench_net_rx(&len, &id)) == NULL) {
+                    continue;
+                }
+                if(bench_net_ours(eth, len) && eth[14] == BENCH_NET_DONE && eth[15] == p) {
+                    received = get32(eth + 16);
+                    done = true;
+                }
+                bench_net_rx_done(id);
+            }
+        }
+
+        printf("bench net tx %d bytes: %d frames in %d us, %d Mbit/s, %d received\n",
+               size, BENCH_NET_FRAMES, (u32)us, us ? (u32)((u64)size * BENCH_NET_FRAMES * 8 / us) : 0, received);
+    }
+}
+
+static void bench_net_receive(u64 freq)
+{
+    static const u8 broadcast[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+    u32 count[BENCH_NET_PHASES] = { 0 };
+    u32 reported = 0;
+    u32 cur = BENCH_NET_PHASES;
+    u64 bytes = 0, first = 0, last = 0;
+    u64 announce = 0;
+    bool started = false;
+    u32 len;
+    u16 id;
+    u8 *eth;
+
+    while(reported != (1U << BENCH_NET_PHASES) - 1) {
+        if((eth = bench_net_rx(&len, &id)) == NULL) {
+            if(!started && bench_now() >= announce) {
+                bench_net_ctl(broadcast, BENCH_NET_READY, 0, 0);
+                announce = bench_now() + freq * BENCH_NET_RETRY_US / 1000000;
+            }
+            continue;
+        }
+        if(!bench_net_ours(eth, len) || eth[15] >= BENCH_NET_PHASES) {
+            bench_net_rx_done(id);
+            continue;
+        }
+
+        u32 p = eth[15];
+        switch(eth[14]) {
+            case BENCH_NET_DATA:
+                if(p != cur) {
+                    cur   = p;
+                    bytes = 0;
+                    first = bench_now();
+                    started = true;
+                }
+                count[p]++;
+                bytes += len;
+                last = bench_now();
+                break;
+            case BENCH_NET_END:
+                if(!(reported & (1U << p))) {
+                    u64 us = p == cur ? (last - first) * 1000000 / freq : 0;
+                    printf("bench net rx %d bytes: %d of %d frames in %d us, %d Mbit/s\n",
+                           bench_net_sizes[p], count[p], get32(eth + 16), (u32)us,
+                           us ? (u32)(bytes * 8 / us) : 0);
+                    reported |= 1U << p;
+                }
+                /* the sender repeats the marker until this arrives */
+                for(int i = 0; i < 6; i++) {
+                    bench_peer[i] = eth[6 + i];
+                }
+                bench_net_rx_done(id);
+                bench_net_ctl(bench_peer, BENCH_NET_DONE, p, count[p]);
+                continue;
+            default:
+                break;
+        }
+        bench_net_rx_done(id);
+    }
+}
+
+void bench_net_run(void)
+{
+    u64 freq;
+
+    read_sysreg(freq, cntfrq_el0);
+
+    if(bench_net_init() < 0) {
+        printf("bench net: no usable virtio-net device\n");
+        return;
+    }
+    printf("bench net: mac %x:%x:%x:%x:%x:%x\n", bench_mac[0], bench_mac[1], bench_mac[2],
+           bench_mac[3], bench_mac[4], bench_mac[5]);
+
+    /* port 1 sends */
+    if(bench_mac[5] == 1) {
+        bench_net_send(freq);
+    } else {
+        bench_net_receive(freq);
+    }
+    printf("bench net done\n");
+}
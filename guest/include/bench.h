@@ -0,0 +1,8 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+void bench_lock_run(void);
+void bench_exit_run(void);
+void bench_net_run(void);
+
+#endif
@@ -4,4 +4,11 @@
 #define NCPU        2
 #define SZ_4K       0x00001000
 
+/* run the spinlock microbenchmark (bench.c) on all cores before the main loop */
+#define BENCH_LOCK  0
+/* run the exit cost microbenchmark (bench.c) on all cores before the main loop */
+#define BENCH_EXIT  0
+/* run the inter-vm network throughput benchmark (bench.c) on core 0, needs two vms on the switch */
+#define BENCH_NET   0
+
 #endif
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include "config.h"
 #include "gicv3.h"
 #include "arch.h"
+#include "bench.h"
 
 __attribute__((aligned(SZ_4K))) char sp_stack[SZ_4K * NCPU] = {0};
 
@@ -46,6 +47,13 @@ int vm_secondary_init()
     gic_percpu_init();
     irq_enable;
 
+    if(BENCH_LOCK) {
+        bench_lock_run();
+    }
+    if(BENCH_EXIT) {
+        bench_exit_run();
+    }
+
     while(1) {
         printf("I am vm 1 on core %d\n", coreid());
         for(int i=0; i < 100000000; i++);
@@ -66,6 +74,16 @@ int vm_primary_init()
     guest_spi_config(UART_IRQ_LINE, GIC_EDGE_TRIGGER);
     irq_enable;
 
+    if(BENCH_LOCK) {
+        bench_lock_run();
+    }
+    if(BENCH_EXIT) {
+        bench_exit_run();
+    }
+    if(BENCH_NET) {
+        bench_net_run();
+    }
+
     while(1) {
         printf("I am vm 1 on core %d\n", coreid());
         for(int i=0; i < 100000000; i++);
@@ -1,6 +1,9 @@
 #ifndef __ARCH_H__
 #define __ARCH_H__
 
+#include "types.h"
+#include "layout.h"
+
 
 /* 将reg的值读取到val中 */
 #define __read_sysreg(val, reg) \
@@ -18,6 +21,7 @@
 #define isb()   asm volatile("isb")
 // 数据同步屏障
 #define dsb(sy) asm volatile("dsb " #sy);
+#define dmb(opt) asm volatile("dmb " #opt ::: "memory")
 
 /*
   - daifclr 是 "清除 DAIF 寄存器位" 的指令，
@@ -28,16 +32,45 @@
 // 关闭IRQ中断
 #define irq_disable asm volatile("msr daifset, #2" ::: "memory")
 
+/* 关闭IRQ并返回之前的DAIF，用于可能在中断上下文和普通上下文中都会调用的代码 */
+static inline u64 irq_save(void)
+{
+    u64 daif;
+    read_sysreg(daif, daif);
+    irq_disable;
+    return daif;
+}
+
+static inline void irq_restore(u64 daif)
+{
+    write_sysreg(daif, daif);
+}
+
 /* SPSR_EL2 */
 #define SPSR_M(n)    (n & 0xf)
 #define SPSR_DAIF    (0xf << 6)
 
-// 读取当前核心id
-static inline int coreid()
+/* MPIDR_EL1 affinity fields, Aff3 sits apart from Aff2..Aff0 */
+#define MPIDR_AFF_MASK      0xff00ffffffUL
+#define MPIDR_AFF0(mpidr)   ((mpidr) & 0xff)
+#define MPIDR_AFF1(mpidr)   (((mpidr) >> 8) & 0xff)
+#define MPIDR_AFF2(mpidr)   (((mpidr) >> 16) & 0xff)
+#define MPIDR_AFF3(mpidr)   (((mpidr) >> 32) & 0xff)
+
+// 当前核心的Aff3..Aff0, 逻辑cpu号见gic_rdists[]
+static inline u64 mpidr_affinity()
 {
-    int val;
+    u64 val;
     read_sysreg(val, mpidr_el1);
-    return val & 0xf;
+    return val & MPIDR_AFF_MASK;
+}
+
+// 读取当前核心id: tpidr_el2指向本核的pcpu_t, 一次mrs加一次load
+static inline int coreid()
+{
+    u64 pcpu;
+    read_sysreg(pcpu, tpidr_el2);
+    return *(const int *)(pcpu + PCPU_CPUID_OFFSET);
 }
 
 static inline void flush_tlb()
@@ -0,0 +1,14 @@
+#ifndef __CONSOLE_H__
+#define __CONSOLE_H__
+
+/*
+ * Hypervisor console on the pl011. The uart is passed through to the guests,
+ * so input only reaches it while no vcpu has run on the pcpu taking the uart
+ * interrupt (see el2_irq_proc()). Once a vm has a virtio console the uart
+ * is the hypervisor's: its input goes to the console with the focus, Ctrl-]
+ * cycles it through the guests and the shell.
+ */
+void console_input(char c);
+void console_exec(char *line);
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef __CPUFEATURE_H__
+#define __CPUFEATURE_H__
+
+#include <types.h>
+
+/* Optional architecture features the hypervisor can take advantage of */
+enum cpu_feature {
+    CPU_FEAT_LSE,           /* FEAT_LSE: single instruction atomics (swp, cas, ...) */
+    CPU_FEAT_TLBIRANGE,     /* FEAT_TLBIRANGE: TLB invalidation by address range */
+    CPU_FEAT_S2FWB,         /* FEAT_S2FWB: stage 2 forced write-back */
+    CPU_FEAT_VMID16,        /* 16 bit VMIDs */
+    CPU_FEAT_ECV,           /* FEAT_ECV: enhanced counter virtualization */
+    CPU_FEAT_DCZVA,         /* DC ZVA permitted */
+    CPU_NR_FEATURES,
+};
+
+/*
+ * Probed once on the boot pcpu by cpufeature_init() before anything else
+ * runs, read-only afterwards. The secondaries only check they match.
+ */
+struct cpu_features {
+    u64 caps;               /* bit per enum cpu_feature */
+    int pa_range;           /* ID_AA64MMFR0_EL1.PARange */
+    int dczva_bytes;        /* DC ZVA block size, 0 if prohibited */
+    int nr_lrs;             /* GIC list registers, ICH_VTR_EL2.ListRegs + 1 */
+
+    u64 id_aa64pfr0;
+    u64 id_aa64isar0;
+    u64 id_aa64mmfr0;
+    u64 id_aa64mmfr1;
+    u64 id_aa64mmfr2;
+};
+
+extern struct cpu_features cpu_features;
+
+/* The static key of a feature: a load and a branch, the same way on every pcpu */
+static inline bool cpu_has(enum cpu_feature feature)
+{
+    return (cpu_features.caps >> feature) & 0x1;
+}
+
+void cpufeature_init(void);
+void cpufeature_percpu_check(void);
+void cpufeature_dump(void);
+
+#endif
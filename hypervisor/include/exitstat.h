@@ -0,0 +1,48 @@
+#ifndef __EXITSTAT_H__
+#define __EXITSTAT_H__
+
+#include <types.h>
+
+struct vcpu;
+
+/* Why a vcpu trapped into EL2 */
+enum exit_reason {
+    EXIT_WFI,
+    EXIT_WFE,
+    EXIT_HVC,
+    EXIT_SMC,
+    EXIT_SYSREG,
+    EXIT_DABT,      /* stage-2 fault on an emulated device, per device in vmmio_dump() */
+    EXIT_IRQ,
+    EXIT_OTHER,
+    EXIT_NR,
+};
+
+/*
+ * Cost of an exit in physical counter ticks (CNTPCT_EL0, 16ns on QEMU virt),
+ * from the vector entry until the handler is done, a vcpu switch is not included.
+ * hist[n] counts exits with 2^(n-1) <= ticks < 2^n, the last bucket takes the rest.
+ */
+#define EXIT_HIST_BUCKETS   24
+
+struct exit_stat {
+    u64 count;
+    u64 ticks;
+    u64 max;
+    u64 hist[EXIT_HIST_BUCKETS];
+};
+
+/* Guest query fields of XHYPER_HC_EXIT_STAT */
+#define EXIT_STAT_COUNT     0
+#define EXIT_STAT_TICKS     1
+#define EXIT_STAT_MAX       2
+#define EXIT_STAT_HIST(n)   (3 + (n))
+
+extern const char *exit_reason_name[EXIT_NR];
+
+void exit_stat_reset(struct vcpu *vcpu);
+void exit_stat_account(struct vcpu *vcpu, enum exit_reason reason);
+u64  exit_stat_query(struct vcpu *vcpu, u64 reason, u64 field);
+void exit_stat_dump(struct vcpu *vcpu);
+
+#endif
@@ -26,17 +26,21 @@ struct gicv3_context {
     u64 gic_lr[16];
     u64 vmcr;
     u64 sre_el1;
+    u64 ap1r0;
 };
 
 #define GIC_NSGI              (16)
 #define GIC_NPPI              (16)
 
 #define GIC_MIN_SPI0          (32)   // SPI中断号开始位置
+#define GIC_MAX_IRQ           (1020) // 1020~1023 为特殊中断号
 #define GIC_MIN_LPI           (8192) // LPI中断号开始位置
 
 #define GIC_LEVEL_TRIGGER     (0) // 
 #define GIC_EDGE_TRIGGER      (2) // 边沿触发
 
+#define GIC_MAINT_IRQ         (25)   // 虚拟cpu interface的maintenance中断(PPI)
+
 /* GIC Distributor block */
 #define GICD_CTLR               (0x0)
 #define GICD_TYPER              (0x4)
@@ -62,13 +66,16 @@ struct gicv3_context {
 
 #define GICD_TYPER_CPUNumber_SHIFT 5 // 目标 CPU 数量偏移
 
-/* Redistributor GICR_* are percpu registers, the stride is GICR_STRIDE */
-#define GICR_BASE_n(n)      (GICR_BASE + (n)*GICR_STRIDE)
+/* Redistributor GICR_* are percpu registers, frame of logical cpu n found by gic_rdist_probe() */
+#define GICR_BASE_n(n)      (gic_rdists[n].base)
 
 //RD_base
 #define GICR_CTLR           (0x0)
 #define GICR_IIDR           (0x4)
 #define GICR_TYPER          (0x8)
+#define GICR_TYPER_VLPIS    (1 << 1)
+#define GICR_TYPER_LAST     (1 << 4)
+#define GICR_TYPER_AFF(typer)   ((typer) >> 32)  /* Aff3.Aff2.Aff1.Aff0 */
 #define GICR_WAKER          (0x14)
 #define GICR_PIDR2          (0xffe8)
 
@@ -89,6 +96,7 @@ struct gicv3_context {
 #define ICH_HCR_EL2         S3_4_C12_C11_0
 #define ICH_VTR_EL2         S3_4_C12_C11_1
 #define ICH_VMCR_EL2        S3_4_C12_C11_7
+#define ICH_AP1R0_EL2       S3_4_C12_C9_0
 #define ICH_LR0_EL2         S3_4_C12_C12_0
 #define ICH_LR1_EL2         S3_4_C12_C12_1
 #define ICH_LR2_EL2         S3_4_C12_C12_2
@@ -140,6 +148,12 @@ struct gicv3_context {
 
 #define LR_PENDING          (1L)
 #define LR_IS_INACTIVE(lr)  (((lr >> 62) & 0x3) == 0L)
+#define LR_IS_PENDING(lr)   (((lr >> 62) & 0x1) == 1L)
+#define LR_GET_VINTID(lr)   ((u32)((lr) & 0xffffffffL))
+
+/* ICH_HCR_EL2 */
+#define ICH_HCR_EN          (1 << 0)
+#define ICH_HCR_UIE         (1 << 1)  // 没有或只剩一个有效LR时产生maintenance中断
 
 /* GICD_* are all 32 bits register */
 static inline u32 GICD_READ32(u32 offset)
@@ -152,6 +166,18 @@ static inline void GICD_WRITE32(u32 offset, u32 val)
     *(volatile u32 *)(u64)(GICD_BASE + offset) = val;
 }
 
+/*
+ * Logical cpu to hardware mapping. The boot core is logical cpu 0, the other
+ * redistributors follow in frame order.
+ */
+struct gic_rdist {
+    u64 base;       /* RD_base of the frame */
+    u64 mpidr;      /* affinity in MPIDR_EL1 layout */
+};
+
+extern struct gic_rdist gic_rdists[NCPU];
+extern int nr_pcpus;
+
 static inline u32 GICR_READ32(int coreid, u32 offset)
 {
     return *(volatile u32 *)(u64)(GICR_BASE_n(coreid) + offset);
@@ -181,9 +207,13 @@ void gic_v3_init(void);
 void gic_percpu_init(void);
 void hyper_spi_config(u32 irq, u32 type);
 void gic_context_init(struct gicv3_context *gic_context);
+void save_gic_context(struct gicv3_context *gic_context);
 void restore_gic_context(struct gicv3_context *gic_context);
 u64  gic_read_list_reg(int n);
 void gic_write_list_reg(int n, u64 val);
 u64  gic_create_lr(u32 pirq, u32 virq);
+u64  gic_create_sw_lr(u32 virq);
+void gic_send_sgi(int cpu, u32 sgi);
+void gic_rdist_probe(void);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,68 @@
+#ifndef __HRTIMER_H__
+#define __HRTIMER_H__
+
+#include <types.h>
+#include <arch.h>
+#include <list.h>
+
+/* EL2 physical timer (CNTHP) PPI */
+#define HYP_TIMER_IRQ       26
+
+/* CNTHP_CTL_EL2 */
+#define CNTHP_CTL_ENABLE    (1 << 0)
+#define CNTHP_CTL_IMASK     (1 << 1)
+#define CNTHP_CTL_ISTATUS   (1 << 2)
+
+/*
+ * Hashed timer wheel: a timer lives in slot (expires >> HRTIMER_TICK_SHIFT) % HRTIMER_WHEEL_SIZE.
+ * With the 62.5MHz counter of QEMU virt one tick is ~16us and one round of the wheel ~4ms,
+ * timers further out just stay in their slot for more rounds.
+ */
+#define HRTIMER_TICK_SHIFT  10
+#define HRTIMER_WHEEL_BITS  8
+#define HRTIMER_WHEEL_SIZE  (1 << HRTIMER_WHEEL_BITS)
+#define HRTIMER_WHEEL_MASK  (HRTIMER_WHEEL_SIZE - 1)
+
+struct hrtimer {
+    struct list_head entry;
+    u64   expires;                          /* absolute physical count */
+    void  (*function)(struct hrtimer *);    /* called with the irq masked */
+    void *data;
+    int   cpu;                              /* queued on this pcpu, -1 if idle */
+    int   slot;                             /* wheel slot while queued */
+};
+
+/* counter frequency, read from CNTFRQ_EL0 once at boot */
+extern u64 hrtimer_freq;
+
+static inline u64 hrtimer_now(void)
+{
+    u64 cnt;
+    isb();
+    read_sysreg(cnt, cntpct_el0);
+    return cnt;
+}
+
+static inline u64 hrtimer_us_to_cnt(u64 us)
+{
+    return us * hrtimer_freq / 1000000;
+}
+
+static inline u64 hrtimer_cnt_to_ns(u64 cnt)
+{
+    /* split to keep cnt * 10^9 from overflowing */
+    return (cnt / hrtimer_freq) * 1000000000 + (cnt % hrtimer_freq) * 1000000000 / hrtimer_freq;
+}
+
+static inline bool hrtimer_queued(struct hrtimer *timer)
+{
+    return timer->cpu >= 0;
+}
+
+void hrtimer_init(struct hrtimer *timer, void (*function)(struct hrtimer *), void *data);
+void hrtimer_start(struct hrtimer *timer, u64 expires);
+void hrtimer_cancel(struct hrtimer *timer);
+void hrtimer_percpu_init(void);
+void hrtimer_irq_handler(void);
+
+#endif
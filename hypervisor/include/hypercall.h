@@ -0,0 +1,19 @@
+#ifndef __HYPERCALL_H__
+#define __HYPERCALL_H__
+
+#include <types.h>
+
+struct vcpu;
+
+/*
+ * X-Hyper specific calls, SMCCC vendor specific hypervisor service
+ * (owner 6, fast call, SMC64): hvc #0 with the function id in x0.
+ */
+#define XHYPER_HC_YIELD_TO      0xc6000001  /* x1 - vcpu id to run instead, XHYPER_YIELD_ANY for none */
+#define XHYPER_HC_EXIT_STAT     0xc6000002  /* x1 - exit reason, x2 - EXIT_STAT_* field, of the caller */
+
+#define XHYPER_YIELD_ANY        (~0UL)
+
+u64 hypercall_handler(struct vcpu *vcpu, u64 funid, u64 arg0, u64 arg1);
+
+#endif
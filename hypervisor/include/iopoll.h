@@ -0,0 +1,18 @@
+#ifndef __IOPOLL_H__
+#define __IOPOLL_H__
+
+#include <types.h>
+
+/*
+ * A pcpu reserved to busy poll the virtqueues of all vms. It runs no vcpu,
+ * the guests are asked not to notify (VIRTIO_F_EVENT_IDX, or
+ * VRING_USED_F_NO_NOTIFY without it) and completions are injected from
+ * there into the vcpus wherever they run.
+ */
+
+int  iopoll_set_cpu(int cpu);
+bool iopoll_active(void);
+void iopoll_run(void) __attribute__((noreturn));
+void iopoll_dump(void);
+
+#endif
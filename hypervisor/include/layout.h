@@ -1,12 +1,27 @@
 #ifndef __LAYOUT_H__
 #define __LAYOUT_H__
 
-#define NCPU            4
+#include "xhyper_config.h"
+
+#define NCPU            XHYPER_NCPU
+/* vcpus of all vms, multiplexed on the NCPU pcpus */
+#define NVCPU           XHYPER_NVCPU
 
 /* 4K size */
 #define SZ_4K           0x00001000
 #define PAGESIZE        SZ_4K
 
+/*
+ * tpidr_el2 holds the pcpu_t of the running core, these fields are read at
+ * fixed offsets by vector.S and coreid(), checked in vcpu.c.
+ */
+#define PCPU_VCPU_OFFSET    0   /* vcpu_t *vcpu, running vcpu */
+#define PCPU_CPUID_OFFSET   8   /* int cpuid */
+
+/* vcpu_t fields used by the exit fast path in vector.S */
+#define VCPU_FAST_EXITS_OFFSET  (8 * 34)    /* u64 fast_exits */
+#define VCPU_CPUID_OFFSET       (8 * 35)    /* int cpuid */
+
 /* 虚拟管理器的物理内存加载地址 */
 #define HIMAGE_VADDR    0x40200000
 
@@ -20,7 +35,15 @@
 #define GICD_BASE   0x08000000
 #define GICD_SIZE   0x10000
 #define GICR_BASE   0x080a0000 // GIC Redistributor 映射地址
-#define GICR_SIZE   0x80000 
-#define GICR_STRIDE 0x20000
+#define GICR_SIZE   0xf60000   // QEMU virt的redistributor区域, 最多123个, 启动时遍历
+#define GICR_STRIDE 0x20000    // RD_base + SGI_base, 支持VLPI时还有两个frame
+/* redistributor frames shown to a guest, one per vcpu */
+#define VGICR_SIZE  (NCPU * GICR_STRIDE)
+
+/* virtio-mmio transports of the QEMU virt layout, SPI 16 onwards */
+#define VIRTIO_MMIO_BASE        0x0a000000
+#define VIRTIO_MMIO_SLOT_SIZE   0x200
+#define VIRTIO_MMIO_SLOTS       32
+#define VIRTIO_MMIO_IRQ(slot)   (32 + 16 + (slot))
 
 #endif
\ No newline at end of file
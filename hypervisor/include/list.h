@@ -0,0 +1,66 @@
+#ifndef __LIST_H__
+#define __LIST_H__
+
+#include <types.h>
+#include <stddef.h>
+
+/* Intrusive circular doubly linked list */
+struct list_head {
+    struct list_head *next;
+    struct list_head *prev;
+};
+
+#define container_of(ptr, type, member) \
+    ((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define list_entry(ptr, type, member)   container_of(ptr, type, member)
+#define list_first_entry(head, type, member) \
+    list_entry((head)->next, type, member)
+
+#define list_for_each(pos, head) \
+    for(pos = (head)->next; pos != (head); pos = pos->next)
+
+/* Safe against removal of pos */
+#define list_for_each_safe(pos, n, head) \
+    for(pos = (head)->next, n = pos->next; pos != (head); pos = n, n = pos->next)
+
+static inline void list_init(struct list_head *head)
+{
+    head->next = head;
+    head->prev = head;
+}
+
+static inline bool list_empty(struct list_head *head)
+{
+    return head->next == head;
+}
+
+static inline void __list_add(struct list_head *new, struct list_head *prev, struct list_head *next)
+{
+    next->prev = new;
+    new->next  = next;
+    new->prev  = prev;
+    prev->next = new;
+}
+
+/* Insert after head (stack order) */
+static inline void list_add(struct list_head *new, struct list_head *head)
+{
+    __list_add(new, head, head->next);
+}
+
+/* Insert before head (queue order) */
+static inline void list_add_tail(struct list_head *new, struct list_head *head)
+{
+    __list_add(new, head->prev, head);
+}
+
+/* Unlink and reinitialize, so list_empty() on the entry tells whether it is queued */
+static inline void list_del(struct list_head *entry)
+{
+    entry->next->prev = entry->prev;
+    entry->prev->next = entry->next;
+    list_init(entry);
+}
+
+#endif
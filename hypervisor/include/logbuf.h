@@ -0,0 +1,23 @@
+#ifndef __LOGBUF_H__
+#define __LOGBUF_H__
+
+#include <types.h>
+
+/*
+ * Buffered hypervisor output. printf() formats into a per-pcpu line and
+ * commits whole lines to a per-pcpu ring; idle pcpus and the balance timer
+ * drain the rings to the uart without ever waiting on it. The uart interrupt
+ * belongs to the guests, so it can't be used for that. Until a pcpu enters
+ * the scheduler, and after a panic, lines go straight out to the uart.
+ * The guests' virtio consoles are multiplexed on the uart here as well.
+ */
+#define LOGBUF_LINE_MAX     256
+#define LOGBUF_SIZE         4096    /* per pcpu, power of 2 */
+
+void logbuf_putc(char c);
+bool logbuf_set_async(bool async);
+bool logbuf_drain(void);
+void logbuf_flush(void);
+void logbuf_panic(void);
+
+#endif
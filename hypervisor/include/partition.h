@@ -0,0 +1,65 @@
+#ifndef __PARTITION_H__
+#define __PARTITION_H__
+
+#include <types.h>
+#include <hrtimer.h>
+
+struct vm;
+
+#define PARTITION_MAX_WINDOWS   16
+/* jitter statistics are printed once every this many major frames */
+#define PARTITION_REPORT_FRAMES 1000
+
+/* One time window of the major frame */
+struct partition_window {
+    struct vm *vm;          /* NULL: spare time, the pcpu idles */
+    u64 duration_us;
+};
+
+/*
+ * ARINC-653 style cyclic schedule of one pcpu: the windows run back to back
+ * and the major frame repeats forever. Window boundaries are absolute
+ * deadlines on the physical counter, so a late switch does not shift the
+ * following ones.
+ */
+struct partition_sched {
+    struct partition_window windows[PARTITION_MAX_WINDOWS];
+    int  nr_windows;
+    int  cur;               /* index of the running window */
+    int  cpu;
+    u64  next_switch;       /* physical count the next window starts at */
+    struct hrtimer timer;
+
+    /* switch jitter, in physical counts */
+    u64  frames;
+    u64  nr_switches;
+    u64  overruns;          /* switches that missed a whole window */
+    u64  jitter_min;
+    u64  jitter_max;
+    u64  jitter_sum;
+};
+
+/*
+ * Boot configuration of one partitioned pcpu, the major frame is the windows
+ * in order. vm is an index into the vms main.c creates, -1 for spare time.
+ */
+struct partition_config {
+    int cpu;
+    int nr_windows;
+    struct {
+        int vm;
+        u64 duration_us;
+    } windows[PARTITION_MAX_WINDOWS];
+};
+
+int  partition_set_schedule(int cpu, const struct partition_window *windows, int nr);
+int  partition_configure(const struct partition_config *cfg, int nr, struct vm **vms, int nvms);
+void partition_start(struct partition_sched *ps);
+void partition_report(struct partition_sched *ps);
+
+static inline struct vm *partition_current_vm(struct partition_sched *ps)
+{
+    return ps->windows[ps->cur].vm;
+}
+
+#endif
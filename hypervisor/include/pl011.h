@@ -1,7 +1,10 @@
 #ifndef __PL011_H__
 #define __PL011_H__
 
+#include <types.h>
+
 void pl011_putc(char c);
+bool pl011_try_putc(char c);
 void pl011_puts(char *s);
 int  pl011_getc(void);
 void pl011_init(void);
@@ -3,7 +3,7 @@
 #define __PRINTF_H__
 
 int  printf(const char *fmt, ...);
-void abort(const char *fmt, ...);
+void abort(const char *fmt, ...) __attribute__((noreturn));
 
 #endif
 
@@ -0,0 +1,37 @@
+#ifndef __PVTIME_H__
+#define __PVTIME_H__
+
+#ifndef __ASSEMBLY__
+#include <types.h>
+
+struct vm;
+struct vcpu;
+#endif
+
+/* Arm DEN0057 paravirtualized time, SMCCC standard hypervisor service calls */
+#define PV_TIME_FEATURES        0xc5000020
+#define PV_TIME_ST              0xc5000021
+
+/*
+ * IPA of the stolen time structures of a vm, one page right above guest RAM
+ * and outside of it, so the guest maps it with memremap() rather than using it.
+ */
+#define PVTIME_IPA              0x90000000
+
+/* Shared with the guest, 64 bytes per vcpu, little endian */
+#define PVTIME_STOLEN_SHIFT     6
+
+#ifndef __ASSEMBLY__
+struct pvtime_stolen {
+    u32 revision;       /* 0 */
+    u32 attributes;     /* 0 */
+    u64 stolen_time;    /* ns the vcpu was runnable but not running */
+    u8  padding[48];
+};
+
+void pvtime_init(struct vm *vm);
+u64  pvtime_handler(struct vcpu *vcpu, u64 funid, u64 arg);
+void pvtime_update(struct vcpu *vcpu);
+#endif
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef __SCHED_H__
+#define __SCHED_H__
+
+#include <types.h>
+#include <list.h>
+#include <spinlock.h>
+
+struct vcpu;
+
+/* Time slice of a vcpu when others are waiting on the same pcpu */
+#define SCHED_SLICE_US      10000
+/* Period of the run queue balancing on every pcpu */
+#define SCHED_BALANCE_US    50000
+
+/* Hypervisor owned SGI, asks the target pcpu to reschedule */
+#define IPI_RESCHED         1
+
+/* Scheduling policy of a pcpu */
+enum sched_policy {
+    SCHED_POLICY_FAIR,          /* round robin with work stealing */
+    SCHED_POLICY_PARTITION,     /* static cyclic time windows, see partition.h */
+    SCHED_POLICY_IOPOLL,        /* no vcpus, polls the virtqueues, see iopoll.h */
+};
+
+/* Per-pcpu run queue of READY vcpus, FIFO */
+struct runqueue {
+    spinlock_t       lock;
+    struct list_head queue;
+    int              nr_queued;
+};
+
+void sched_percpu_init(void);
+void sched_start(void);
+void sched_wakeup(struct vcpu *vcpu);
+void sched_kick(struct vcpu *vcpu);
+void sched_rehome(struct vcpu *vcpu);
+void sched_power_off(struct vcpu *vcpu);
+void sched_yield(struct vcpu *vcpu, struct vcpu *to);
+void sched_on_spin(struct vcpu *vcpu);
+void sched_block(struct vcpu *vcpu);
+void sched_exit_check(void);
+void schedule(void);
+void sched_ipi_handler(void);
+void sched_trap_init(void);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef __SMCCC_H__
+#define __SMCCC_H__
+
+/*
+ * SMC Calling Convention function ids and return values, plain defines so
+ * vector.S can use them as well.
+ */
+/* bits [29:24] of a function id are the owning entity */
+#define SMCCC_OWNER(funid)          (((funid) >> 24) & 0x3F)
+#define SMCCC_OWNER_STANDARD_HYP    5
+#define SMCCC_OWNER_VENDOR_HYP      6
+
+/* SMCCC arm architecture calls */
+#define SMCCC_VERSION               0x80000000
+#define SMCCC_ARCH_FEATURES         0x80000001
+#define SMCCC_VERSION_1_1           0x10001
+
+#define SMCCC_RET_SUCCESS           0
+#define SMCCC_RET_NOT_SUPPORTED     (-1)
+
+#endif
@@ -30,5 +30,6 @@ static inline void __arch_spinlock_init(spinlock_t *spinlock, char *name)
 
 void arch_spin_lock(spinlock_t *spinlock);
 void arch_spin_unlock(spinlock_t *spinlock);
+bool arch_spin_trylock(spinlock_t *spinlock);
 
 #endif
\ No newline at end of file
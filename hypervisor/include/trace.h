@@ -0,0 +1,70 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <types.h>
+#include <xhyper_config.h>
+
+struct vcpu;
+
+/*
+ * Binary event tracing into per-pcpu rings, built in with XHYPER_TRACE
+ * (the trace profile, or make TRACE=1). Otherwise every trace point compiles
+ * to nothing.
+ *
+ * Each pcpu is the only writer of its ring and writes with the IRQ masked,
+ * so a record is claimed without atomics; the oldest records get overwritten.
+ * The rings are read from a memory dump (console "trace" tells where) with
+ * tools/trace_decode.py.
+ */
+
+enum trace_event {
+#define TRACE_EVENT(name, fmt)  TRACE_##name,
+#include <trace_events.h>
+#undef TRACE_EVENT
+    TRACE_NR_EVENTS,
+};
+
+#define TRACE_MAGIC         0x43525458  /* "XTRC" */
+#define TRACE_RING_ORDER    11
+#define TRACE_RING_RECORDS  (1 << TRACE_RING_ORDER)
+#define TRACE_NO_VCPU       0xffff
+
+struct trace_record {
+    u64 ts;         /* CNTPCT_EL0 */
+    u16 event;
+    u16 vcpu;       /* index in vcpus[], TRACE_NO_VCPU if none */
+    u32 reserved;
+    u64 arg0;
+    u64 arg1;
+};
+
+/* Layout shared with tools/trace_decode.py */
+struct trace_ring {
+    u32 magic;
+    u16 cpu;
+    u16 record_size;
+    u32 nr_records;
+    u32 reserved;
+    volatile u64 head;  /* records ever written, the next one goes to head % nr_records */
+    u64 freq;           /* CNTFRQ_EL0 */
+    u64 pad[4];
+    struct trace_record records[TRACE_RING_RECORDS];
+} __attribute__((aligned(64)));
+
+#if XHYPER_TRACE
+
+void __trace(enum trace_event event, struct vcpu *vcpu, u64 arg0, u64 arg1);
+
+#define trace(name, vcpu, arg0, arg1) \
+    __trace(TRACE_##name, vcpu, (u64)(arg0), (u64)(arg1))
+
+#else
+
+#define trace(name, vcpu, arg0, arg1)   do { } while(0)
+
+#endif
+
+void trace_percpu_init(void);
+void trace_info(void);
+
+#endif
@@ -0,0 +1,18 @@
+/*
+ * Trace events, one TRACE_EVENT(name, format) per line. The ids are the line
+ * order, tools/trace_decode.py parses this file to name and format records,
+ * so only append new events and keep the format to %d/%x on arg0 and arg1.
+ * No include guard, included once per expansion of TRACE_EVENT.
+ */
+TRACE_EVENT(VM_EXIT,      "esr=%x elr=%x")
+TRACE_EVENT(IRQ,          "irq=%d")
+TRACE_EVENT(HVC,          "funid=%x x1=%x")
+TRACE_EVENT(SYSREG,       "iss=%x")
+TRACE_EVENT(MMIO,         "ipa=%x wnr=%d")
+TRACE_EVENT(VIRQ_INJECT,  "virq=%d hw=%d")
+TRACE_EVENT(SCHED_SWITCH, "prev=%d next=%d")
+TRACE_EVENT(VCPU_BLOCK,   "")
+TRACE_EVENT(VCPU_WAKEUP,  "pcpu=%d")
+TRACE_EVENT(IPI,          "queued=%d")
+TRACE_EVENT(IDLE,         "")
+TRACE_EVENT(VIRTIO_NOTIFY, "slot=%d queue=%d")
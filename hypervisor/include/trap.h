@@ -0,0 +1,60 @@
+#ifndef __TRAP_H__
+#define __TRAP_H__
+
+#include <types.h>
+
+struct vcpu;
+
+/* ESR_EL2 */
+#define ESR_EC(esr)             (((esr) >> 26) & 0x3F)
+#define ESR_ISS(esr)            ((esr) & 0x1FFFFFF)
+#define ESR_IL                  (1UL << 25)
+#define ESR_EC_NR               64
+
+/* Exception classes of lower EL traps */
+#define ESR_EC_UNKNOWN          0x00
+#define ESR_EC_WFX              0x01
+#define ESR_EC_FP_ASIMD         0x07
+#define ESR_EC_HVC64            0x16
+#define ESR_EC_SMC64            0x17
+#define ESR_EC_SYS64            0x18
+#define ESR_EC_IABT_LOW         0x20
+#define ESR_EC_DABT_LOW         0x24
+#define ESR_EC_DABT_CUR         0x25
+
+/* Data abort ISS: synchronous external abort, not on a translation table walk */
+#define ESR_DFSC_EXT_ABORT      0x10
+
+/* Trapped MSR/MRS, the ISS with Rt and the direction masked out */
+#define SYSREG_OPCODE(op0, op1, crn, crm, op2) \
+     ((op0 << 20) | (op2 << 17) | (op1 << 14) | (crn << 10) | (crm << 1))
+#define SYSREG_ISS_MASK         (~((0x1FU << 5) | 0x1U) & 0x3FFFFF)
+
+/* Slots of the trapped system register hash table, a power of 2 */
+#define TRAP_SYSREG_SLOTS       64
+
+/*
+ * Handles one exception class. Returns the exit reason for the statistics,
+ * < 0 if the trap could not be handled and the guest gets an UNDEF, or a
+ * data abort for a data abort.
+ * The handler steps elr over the instruction if needed.
+ */
+typedef int (*trap_ec_handler_t)(struct vcpu *vcpu, u64 esr);
+
+/*
+ * Handles one trapped system register: val is what the guest writes, or
+ * where to put what it reads. Returns < 0 for an UNDEF.
+ */
+typedef int (*trap_sysreg_handler_t)(struct vcpu *vcpu, u32 sysreg, u64 *val, bool write);
+
+void trap_ec_register(u32 ec, trap_ec_handler_t handler);
+void trap_sysreg_register(u32 sysreg, trap_sysreg_handler_t handler);
+int  trap_handle(struct vcpu *vcpu, u64 esr);
+int  trap_sysreg(struct vcpu *vcpu, u64 esr);
+void trap_inject_undef(struct vcpu *vcpu);
+void trap_inject_dabt(struct vcpu *vcpu, u64 far);
+
+/* hvc/smc, data aborts and the sysreg dispatch, in el1_sync.c */
+void el1_sync_init(void);
+
+#endif
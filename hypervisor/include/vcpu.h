@@ -5,21 +5,64 @@
 #include "layout.h"
 #include "vm.h"
 #include "gicv3.h"
+#include "vtimer.h"
+#include "hrtimer.h"
+#include "sched.h"
+#include "list.h"
+#include "spinlock.h"
+#include "partition.h"
+#include "exitstat.h"
+#include "vmmio_emul.h"
+#include "arch.h"
+
+struct trace_ring;
 
 enum vcpu_state {
     VCPU_UNUSED,
-    VCPU_ALLOCED,
-    VCPU_READY,
+    VCPU_ALLOCED,   /* created, not powered on yet */
+    VCPU_READY,     /* on a run queue */
     VCPU_RUNNING,
+    VCPU_BLOCKED,   /* waiting in WFI for an interrupt */
 };
 
+/* Q0-Q31, saved by fpsimd_save()/fpsimd_restore(). stp/ldp q on Device memory (MMU off) fault unless 16 aligned */
+struct fpsimd_state {
+    u64 vregs[64];
+    u64 fpsr;
+    u64 fpcr;
+} __attribute__((aligned(16)));
+
+/*
+ * Grouped by who touches what: the registers vector.S saves on every exit
+ * first, then the scheduler state other pcpus write too, then what only a
+ * context switch touches. Offsets used by vector.S are checked in vcpu.c.
+ */
 typedef struct vcpu {
+    /* hot: saved/restored by vector.S on every exit */
     struct {
         u64 x[31];
         u64 spsr;
         u64 elr;
     } regs;
 
+    u64 exit_entry;     /* CNTPCT at the last trap, stored by save_vm_regs at #8 * 33 */
+    u64 fast_exits;     /* exits handled by the vector.S fast path, VCPU_FAST_EXITS_OFFSET */
+    int        cpuid;   /* VCPU_CPUID_OFFSET */
+    struct vm  *vm;
+    struct vgicv3_cpu *vgic_cpu;
+
+    /* scheduler, shared with other pcpus */
+    spinlock_t       lock;          // 保护state
+    enum vcpu_state  state;
+    volatile bool    on_cpu;        // 上下文还在某个pcpu上, 保存完之前不能被其他pcpu加载
+    int              pcpu;          // 所在运行队列/正在运行的pcpu, -1表示从未运行
+    struct list_head rq_entry;      // 在pcpu运行队列中的节点
+    u64              affinity;      // 允许运行的pcpu bitmap, 0表示任意pcpu
+    u64              last_ran;      // 上一次被切出的物理计数, 用于挑选最冷的vcpu迁移
+    u64              ready_at;      // 进入READY状态时的物理计数
+    u64              steal;         // 处于READY却没有运行的累计物理计数, 通过pv time告诉guest
+
+    /* context switch only */
     struct {
         u64 spsr_el1;
         u64 elr_el1;
@@ -32,28 +75,81 @@ typedef struct vcpu {
         u64 tcr_el1;
         u64 vbar_el1;
         u64 sctlr_el1;
-        u64 cntv_ctl_el0;
-        u64 cntv_tval_el0;
         u64 cntfrq_el0;
+        u64 mair_el1;
+        u64 amair_el1;
+        u64 cpacr_el1;
+        u64 contextidr_el1;
+        u64 tpidr_el0;
+        u64 tpidr_el1;
+        u64 tpidrro_el0;
+        u64 par_el1;
+        u64 esr_el1;
+        u64 far_el1;
+        u64 afsr0_el1;
+        u64 afsr1_el1;
+        u64 cntkctl_el1;
+        u64 csselr_el1;
     } sys_regs;
-    
-    const char *core_name;
-    struct vm  *vm;
-    int        cpuid;
-    enum vcpu_state state;
-    struct vgicv3_cpu *vgic_cpu;
+
+    struct fpsimd_state fpsimd;
+    struct vtimer vtimer;
     struct gicv3_context gic_context;
+
+    /* MMIO exits without a valid syndrome, see vmmio_emul.c */
+    struct mmio_insn_cache mmio_cache[MMIO_INSN_CACHE_SIZE];
+
+    /* one entry written on every exit, by exit_stat_account() */
+    struct exit_stat exits[EXIT_NR];    // 按陷入原因统计的次数和耗时
+
+    /* cold */
+    const char *core_name;
 } vcpu_t;
 
-// 物理cpu
+/* 物理cpu, the fields only the owner touches first, then the ones other pcpus write */
 typedef struct pcpu {
-    int     cpuid;
-    vcpu_t *vcpu;
+    /* owner only, reached through tpidr_el2 */
+    vcpu_t *vcpu;                   // 当前运行的vcpu, NULL表示空闲, vector.S在PCPU_VCPU_OFFSET读取
+    int     cpuid;                  // coreid()在PCPU_CPUID_OFFSET读取
+    vcpu_t *last_vcpu;              // 最近一次在该pcpu上运行的vcpu
+    struct trace_ring *trace;       // 本核的trace ring
+    vcpu_t *yield_to;               // 当前vcpu让出pcpu时优先运行的vcpu
+    enum sched_policy policy;
+    struct hrtimer  slice_timer;
+    struct hrtimer  balance_timer;
+    struct partition_sched part;    // policy为SCHED_POLICY_PARTITION时的周期调度表
+
+    /* written by other pcpus */
+    volatile bool online;
+    volatile bool idle;
+    volatile bool need_resched;
+    struct vm * volatile gang_vm;   // 请求该pcpu切换到这个gang vm的vcpu
+    struct runqueue rq;
 } pcpu_t;
 
-pcpu_t *cur_pcpu(void);
+extern pcpu_t pcpus[NCPU];
+extern vcpu_t vcpus[NVCPU];
+
+/* This pcpu's block, one mrs */
+static inline pcpu_t *this_cpu(void)
+{
+    pcpu_t *pcpu;
+    read_sysreg(pcpu, tpidr_el2);
+    return pcpu;
+}
+
+/* The vcpu running on this pcpu, NULL when idle */
+static inline vcpu_t *this_vcpu(void)
+{
+    return this_cpu()->vcpu;
+}
+
 void    pcpu_init(void);
+void    pcpu_percpu_init(int id);
 void    vcpu_init(void);
 vcpu_t *create_vcpu(struct vm *vm, int vcpuid, u64 entry);
-void    start_vcpu(void);
+void    vcpu_save_state(vcpu_t *vcpu);
+void    vcpu_restore_state(vcpu_t *vcpu);
+bool    vcpu_load(vcpu_t *vcpu);
+void    vcpu_put(vcpu_t *vcpu);
 #endif
\ No newline at end of file
@@ -26,9 +26,14 @@ struct vgicv3_dist {
     spinlock_t lock;
 };
 
+#define VGIC_PENDING_WORDS  (GIC_MAX_IRQ / 64 + 1)
+
 /* virtual gic Redistributor*/
 struct vgicv3_cpu {
     u16 used_lr; //16个LR寄存器的bitmap
+    spinlock_t lock;                          // 保护pending
+    u64 pending[VGIC_PENDING_WORDS];          // 等待空闲LR的虚拟中断
+    u64 pending_hw[VGIC_PENDING_WORDS];       // 其中由物理中断转发过来的(HW)
     struct vgicv3_irq_config sgis[GIC_NSGI];   // 虚拟SGI中断配置
     struct vgicv3_irq_config ppis[GIC_NPPI];   // 虚拟PPI中断配置
 };
@@ -37,6 +42,11 @@ struct vgicv3_cpu *create_vgic_cpu(int vcpuid);
 struct vgicv3_dist *create_vgic_dist(struct vm *vm);
 void virq_enter(struct vcpu *vcpu);
 int  virq_inject(struct vcpu *vcpu, u32 pirq, u32 virq);
-int  vgicv3_generate_sgi(struct vcpu *vcpu, int rt, int wr);
+int  vgic_inject(struct vcpu *vcpu, u32 virq, bool hw);
+bool vgic_forward_irq(struct vcpu *local, u32 irq);
+void vgic_flush_pending(struct vcpu *vcpu);
+bool vgic_has_pending(struct vcpu *vcpu);
+void vgic_maintenance_handler(void);
+void vgic_trap_init(void);
 
 #endif
\ No newline at end of file
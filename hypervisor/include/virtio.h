@@ -0,0 +1,203 @@
+#ifndef __VIRTIO_H__
+#define __VIRTIO_H__
+
+#include <types.h>
+#include <spinlock.h>
+
+struct vm;
+struct vcpu;
+
+/* virtio-mmio v2 register file, one per transport slot */
+#define VIRTIO_MMIO_MAGIC_VALUE         0x000
+#define VIRTIO_MMIO_VERSION             0x004
+#define VIRTIO_MMIO_DEVICE_ID           0x008
+#define VIRTIO_MMIO_VENDOR_ID           0x00c
+#define VIRTIO_MMIO_DEVICE_FEATURES     0x010
+#define VIRTIO_MMIO_DEVICE_FEATURES_SEL 0x014
+#define VIRTIO_MMIO_DRIVER_FEATURES     0x020
+#define VIRTIO_MMIO_DRIVER_FEATURES_SEL 0x024
+#define VIRTIO_MMIO_QUEUE_SEL           0x030
+#define VIRTIO_MMIO_QUEUE_NUM_MAX       0x034
+#define VIRTIO_MMIO_QUEUE_NUM           0x038
+#define VIRTIO_MMIO_QUEUE_READY         0x044
+#define VIRTIO_MMIO_QUEUE_NOTIFY        0x050
+#define VIRTIO_MMIO_INTERRUPT_STATUS    0x060
+#define VIRTIO_MMIO_INTERRUPT_ACK       0x064
+#define VIRTIO_MMIO_STATUS              0x070
+#define VIRTIO_MMIO_QUEUE_DESC_LOW      0x080
+#define VIRTIO_MMIO_QUEUE_DESC_HIGH     0x084
+#define VIRTIO_MMIO_QUEUE_AVAIL_LOW     0x090
+#define VIRTIO_MMIO_QUEUE_AVAIL_HIGH    0x094
+#define VIRTIO_MMIO_QUEUE_USED_LOW      0x0a0
+#define VIRTIO_MMIO_QUEUE_USED_HIGH     0x0a4
+#define VIRTIO_MMIO_SHM_SEL             0x0ac
+#define VIRTIO_MMIO_SHM_LEN_LOW         0x0b0
+#define VIRTIO_MMIO_SHM_LEN_HIGH        0x0b4
+#define VIRTIO_MMIO_SHM_BASE_LOW        0x0b8
+#define VIRTIO_MMIO_SHM_BASE_HIGH       0x0bc
+#define VIRTIO_MMIO_CONFIG_GENERATION   0x0fc
+#define VIRTIO_MMIO_CONFIG              0x100
+
+#define VIRTIO_MMIO_MAGIC               0x74726976  /* "virt" */
+#define VIRTIO_MMIO_VENDOR              0x52504858  /* "XHPR" */
+
+/* InterruptStatus */
+#define VIRTIO_MMIO_INT_VRING           (1U << 0)
+#define VIRTIO_MMIO_INT_CONFIG          (1U << 1)
+
+/* Device status */
+#define VIRTIO_STATUS_ACKNOWLEDGE       1
+#define VIRTIO_STATUS_DRIVER            2
+#define VIRTIO_STATUS_DRIVER_OK         4
+#define VIRTIO_STATUS_FEATURES_OK       8
+#define VIRTIO_STATUS_NEEDS_RESET       64
+#define VIRTIO_STATUS_FAILED            128
+
+/* Device independent feature bits */
+#define VIRTIO_F_EVENT_IDX              29
+#define VIRTIO_F_VERSION_1              32
+
+/* Device types */
+#define VIRTIO_ID_NET                   1
+#define VIRTIO_ID_BLOCK                 2
+#define VIRTIO_ID_CONSOLE               3
+
+/* Split virtqueue layout, shared with the guest */
+#define VRING_DESC_F_NEXT               1
+#define VRING_DESC_F_WRITE              2
+#define VRING_AVAIL_F_NO_INTERRUPT      1
+#define VRING_USED_F_NO_NOTIFY          1
+
+struct vring_desc {
+    u64 addr;
+    u32 len;
+    u16 flags;
+    u16 next;
+};
+
+struct vring_avail {
+    u16 flags;
+    u16 idx;
+    u16 ring[];     /* then u16 used_event with VIRTIO_F_EVENT_IDX */
+};
+
+struct vring_used_elem {
+    u32 id;
+    u32 len;
+};
+
+struct vring_used {
+    u16 flags;
+    u16 idx;
+    struct vring_used_elem ring[];  /* then u16 avail_event with VIRTIO_F_EVENT_IDX */
+};
+
+/* Largest queue offered, its descriptor table is one page */
+#define VIRTQ_MAX_SIZE                  256
+#define VIRTIO_MAX_QUEUES               4
+/* Buffers of one descriptor chain handed to a device at most */
+#define VIRTQ_MAX_SEGS                  32
+
+/* One guest buffer of a chain, in guest physical (ipa) space */
+struct virtq_seg {
+    u64  ipa;
+    u32  len;
+    bool write;     /* device writes into it */
+};
+
+/* A descriptor chain taken from the avail ring */
+struct virtq_req {
+    u16 head;
+    int nsegs;
+    struct virtq_seg segs[VIRTQ_MAX_SEGS];
+};
+
+struct virtq {
+    spinlock_t lock;            /* consumers of the avail ring and producers of the used ring */
+    u16  num;
+    bool ready;
+    u64  desc_ipa;
+    u64  avail_ipa;
+    u64  used_ipa;
+    /* where the rings are, translated once when the queue becomes ready */
+    volatile struct vring_desc  *desc;
+    volatile struct vring_avail *avail;
+    volatile struct vring_used  *used;
+    u16  last_avail;            /* next avail entry to take */
+    u16  used_idx;              /* next used entry to fill */
+    u16  signalled_used;        /* used_idx at the last interrupt, VIRTIO_F_EVENT_IDX */
+    u16  polled_avail;          /* avail idx the polling pcpu last handed to the device */
+};
+
+/* Whether the other side asked to hear of idx moving past event, old being where it was last told */
+static inline bool vring_need_event(u16 event, u16 idx, u16 old)
+{
+    return (u16)(idx - event - 1) < (u16)(idx - old);
+}
+
+/* used->avail_event and avail->used_event, after the rings of a queue of num entries */
+#define vring_avail_event(vq)   (*(volatile u16 *)((volatile char *)(vq)->used->ring + \
+                                   sizeof(struct vring_used_elem) * (vq)->num))
+#define vring_used_event(vq)    ((vq)->avail->ring[(vq)->num])
+
+struct virtio_dev;
+
+/* What a device model plugs into the transport */
+struct virtio_ops {
+    u32 device_id;
+    u64 features;               /* VIRTIO_F_VERSION_1 and VIRTIO_F_EVENT_IDX are always offered */
+    int nqueues;
+    u32 no_notify;              /* bitmap of the queues the device never needs a notification for */
+    u32 config_size;
+    /* status written to 0, queues are already reset */
+    void (*reset)(struct virtio_dev *dev);
+    /* the driver made buffers available in vq */
+    void (*notify)(struct virtio_dev *dev, int vq);
+    /* device specific configuration, byte offsets from VIRTIO_MMIO_CONFIG */
+    u32  (*config_read)(struct virtio_dev *dev, u64 offset, int size);
+    void (*config_write)(struct virtio_dev *dev, u64 offset, u32 val, int size);
+};
+
+struct virtio_dev {
+    struct virtio_dev *next;    /* all devices, for the console */
+    struct vm *vm;
+    const struct virtio_ops *ops;
+    void *priv;
+    int  slot;
+    u32  irq;
+
+    spinlock_t lock;            /* the register file */
+    u32  status;
+    u32  device_features_sel;
+    u32  driver_features_sel;
+    u64  driver_features;
+    u32  queue_sel;
+    u32  isr;                   /* InterruptStatus */
+    u32  config_generation;
+
+    struct virtq vqs[VIRTIO_MAX_QUEUES];
+
+    u64  notifies;              /* QueueNotify writes */
+    u64  polled;                /* queues found with work by the polling pcpu */
+    u64  interrupts;            /* used buffer interrupts injected */
+};
+
+/* transport, virtio_mmio.c */
+void virtio_mmio_init(struct vm *vm);
+struct virtio_dev *virtio_dev_create(struct vm *vm, const struct virtio_ops *ops, void *priv);
+bool virtio_has_feature(struct virtio_dev *dev, int bit);
+void virtio_config_changed(struct virtio_dev *dev);
+void virtio_dump(void);
+int  virtio_poll(void);
+
+/* split virtqueues */
+int  virtq_pop(struct virtio_dev *dev, struct virtq *vq, struct virtq_req *req);
+void virtq_push(struct virtio_dev *dev, struct virtq *vq, u16 head, u32 len);
+void virtq_notify(struct virtio_dev *dev, struct virtq *vq);
+
+/* guest memory, through the vm's stage 2 */
+u64  virtio_copy_from_guest(struct vm *vm, void *dst, u64 ipa, u64 len);
+u64  virtio_copy_to_guest(struct vm *vm, u64 ipa, const void *src, u64 len);
+u64  virtio_copy_between(struct vm *dst_vm, u64 dst_ipa, struct vm *src_vm, u64 src_ipa, u64 len);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef __VIRTIO_BLK_H__
+#define __VIRTIO_BLK_H__
+
+#include <types.h>
+#include <guest.h>
+
+struct vm;
+struct vblk;
+
+/* virtio-blk feature bits */
+#define VIRTIO_BLK_F_SIZE_MAX           1
+#define VIRTIO_BLK_F_SEG_MAX            2
+#define VIRTIO_BLK_F_RO                 5
+#define VIRTIO_BLK_F_BLK_SIZE           6
+#define VIRTIO_BLK_F_FLUSH              9
+
+/* request types */
+#define VIRTIO_BLK_T_IN                 0
+#define VIRTIO_BLK_T_OUT                1
+#define VIRTIO_BLK_T_FLUSH              4
+#define VIRTIO_BLK_T_GET_ID             8
+
+/* request status, the last byte of a request */
+#define VIRTIO_BLK_S_OK                 0
+#define VIRTIO_BLK_S_IOERR              1
+#define VIRTIO_BLK_S_UNSUPP             2
+
+#define VIRTIO_BLK_SECTOR_SIZE          512
+#define VIRTIO_BLK_ID_BYTES             20
+
+/* the only queue */
+#define VBLK_REQQ                       0
+
+/*
+ * The overlay is a two level table of page pointers, 512 * 512 pages,
+ * which bounds a disk to 1G.
+ */
+#define VBLK_PTRS_PER_PAGE              (PAGESIZE / sizeof(void *))
+#define VBLK_MAX_SIZE                   ((u64)VBLK_PTRS_PER_PAGE * VBLK_PTRS_PER_PAGE * PAGESIZE)
+
+struct vblk *vblk_create(struct vm *vm, guest_t *image, u64 size);
+void vblk_dump(void);
+
+#endif
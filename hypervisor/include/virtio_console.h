@@ -0,0 +1,35 @@
+#ifndef __VIRTIO_CONSOLE_H__
+#define __VIRTIO_CONSOLE_H__
+
+#include <types.h>
+
+struct vm;
+struct vconsole;
+
+/* virtio-console feature bits */
+#define VIRTIO_CONSOLE_F_SIZE           0
+#define VIRTIO_CONSOLE_F_MULTIPORT      1
+#define VIRTIO_CONSOLE_F_EMERG_WRITE    2
+
+/* port 0 queues */
+#define VCONSOLE_RXQ                    0
+#define VCONSOLE_TXQ                    1
+
+/* Guest output waiting for the uart, one page per vm */
+#define VCONSOLE_OUT_SIZE               PAGESIZE
+/* Uart input not yet taken by the guest, a power of 2 */
+#define VCONSOLE_IN_SIZE                256
+
+struct vconsole *vconsole_create(struct vm *vm);
+struct vconsole *vconsole_next(struct vconsole *vc);
+const char *vconsole_name(struct vconsole *vc);
+void vconsole_input(struct vconsole *vc, char c);
+bool vconsole_owns_uart(void);
+void vconsole_dump(void);
+
+/* the uart multiplexer side, uart_lock held, see logbuf.c */
+bool vconsole_drain_locked(bool wait);
+bool vconsole_pending(void);
+void vconsole_break_line(void);
+
+#endif
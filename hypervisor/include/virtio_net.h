@@ -0,0 +1,36 @@
+#ifndef __VIRTIO_NET_H__
+#define __VIRTIO_NET_H__
+
+#include <types.h>
+
+struct vm;
+struct vnet;
+
+/* virtio-net feature bits */
+#define VIRTIO_NET_F_CSUM               0
+#define VIRTIO_NET_F_MTU                3
+#define VIRTIO_NET_F_MAC                5
+#define VIRTIO_NET_F_MRG_RXBUF          15
+#define VIRTIO_NET_F_STATUS             16
+
+#define VIRTIO_NET_S_LINK_UP            1
+
+/* queue pair 0 */
+#define VNET_RXQ                        0
+#define VNET_TXQ                        1
+
+/* struct virtio_net_hdr, with num_buffers as VIRTIO_F_VERSION_1 always has it */
+#define VNET_HDR_SIZE                   12
+#define VNET_ETH_HLEN                   14
+/* jumbo frames, the switch copies a frame once whatever its size */
+#define VNET_MTU                        9000
+
+/* learned addresses of the switch, a power of 2 */
+#define VNET_FDB_SIZE                   64
+/* frames delivered to a port before it is interrupted in the middle of a batch */
+#define VNET_RX_COALESCE                32
+
+struct vnet *vnet_create(struct vm *vm);
+void vnet_dump(void);
+
+#endif
@@ -7,8 +7,10 @@
 #include <vcpu.h>
 #include <vmmio.h>
 #include <vgicv3.h>
+#include <pvtime.h>
 
 struct vmmio_access;
+struct virtio_dev;
 
 typedef struct vm_config {
     guest_t *guest_image;
@@ -19,6 +21,13 @@ typedef struct vm_config {
     int      ncpu;
     u64      dtb_addr;
     u64      rootfs_addr;
+    bool     vtimer_exclude_desched;  /* guest virtual time stops while the vcpu is preempted, ncpu 1 only */
+    u64      vcpu_affinity[NCPU];     /* pcpu bitmap per vcpu, 0 means any pcpu */
+    bool     gang_sched;              /* dispatch and preempt all vcpus together */
+    bool     virtio_console;          /* virtio console (hvc0) instead of the pl011 passthrough */
+    guest_t *virtio_blk;              /* base image of a virtio-blk disk, shared copy-on-write */
+    u64      virtio_blk_size;         /* disk size in bytes, 0 for the size of the image */
+    bool     virtio_net;              /* virtio-net port on the switch between the vms */
 } vm_config_t;
 
 typedef struct vm {
@@ -29,11 +38,26 @@ typedef struct vm {
     struct vcpu *vcpus[NCPU];
     struct vgicv3_dist *vgic_dist;
     struct vmmio_info *vmmios;
+    u64        mmio_unhandled;    // 没有任何trap认领的mmio访问
     u64        dtb;
+    u64        cntvoff;
+    bool       vtimer_exclude_desched;
+
+    /* gang scheduling */
+    bool       gang_sched;
+    spinlock_t gang_lock;
+    int        gang_nr_running;   // 正在运行的vcpu数
+    bool       gang_closing;      // 已有vcpu被抢占，其余vcpu正在被踢下pcpu
+
+    u64        partition_cpus;    // 有该vm时间窗口的pcpu bitmap, 0表示在公平调度的pcpu上运行
+
+    struct pvtime_stolen *pvtime; // 每个vcpu的stolen time结构, 映射在PVTIME_IPA
+
+    struct virtio_dev *virtio[VIRTIO_MMIO_SLOTS]; // virtio-mmio槽位上的设备
 } vm_t;
 
-void create_guest_vm(vm_config_t *vm_config);
-void create_mmio_trap(struct vm *vm, u64 ipa, u64 size,
+vm_t *create_guest_vm(vm_config_t *vm_config);
+void create_mmio_trap(struct vm *vm, const char *name, u64 ipa, u64 size,
                       int (*vmmio_read)(struct vcpu *, u64, u64 *, struct vmmio_access *),
                       int (*vmmio_write)(struct vcpu *, u64, u64, struct vmmio_access *));
 
@@ -43,6 +43,7 @@
 #define VTCR_SH0(n)   (((n) & 0x3) << 12) /* Shareability attribute */
 #define VTCR_TG0(n)   (((n) & 0x3) << 14) /* Granule size */
 #define VTCR_PS(n)    (((n) & 0x7) << 16) /* Physical address Size for the second stage of translation */
+#define VTCR_VS       (1 << 19)  /* 16 bit VMID */
 #define VTCR_NSW      (1 << 29)  /* Non-Secure */
 #define VTCR_NSA      (1 << 30)  /* Non-Secure Access */
 
@@ -71,6 +72,8 @@
 #define HCR_SWIO            (1 << 1)   /* HCR_EL2.SWIO（bit[1]），控制 EL1 执行的缓存失效指令是否需要陷阱到 EL2 */
 #define HCR_FMO             (1 << 3)   /* HCR_EL2.FMO（bit[3]），控制物理 FIQ（Fast Interrupt Request）路由 */
 #define HCR_IMO             (1 << 4)   /* HCR_EL2.IMO（bit[4]），控制物理 IRQ（Interrupt Request）路由 */
+#define HCR_TWI             (1 << 13)  /* HCR_EL2.TWI（bit[13]），EL1/EL0 执行 WFI 时陷阱到 EL2 */
+#define HCR_TWE             (1 << 14)  /* HCR_EL2.TWE（bit[14]），EL1/EL0 执行 WFE 时陷阱到 EL2 */
 #define HCR_RW              (1 << 31)  /* HCR_EL2.RW（bit[31]），指定 EL1 的执行状态 */
 #define HCR_TSC             (1 << 19)  /* HCR_EL2.TSC（bit[19]），控制 EL1 的 SMC（Secure Monitor Call）指令是否陷阱到 EL2 */
 
@@ -78,6 +81,8 @@ void stage2_mmu_init(void);
 void hyper_setup();
 void create_guest_mapping(u64 *pgt, u64 va, u64 pa, u64 size, u64 mattr);
 void page_unmap(u64 *pgt, u64 va, u64 size);
+void stage2_tlb_flush_range(u64 ipa, u64 size);
 u64 *page_walk(u64 *pgt, u64 va, bool alloc);
+u64  ipa_to_pa(u64 *pgt, u64 ipa);
 void copy_to_ipa(u64 *pgt, u64 to_ipa, char *from, u64 len);
 #endif
\ No newline at end of file
@@ -26,13 +26,17 @@ struct vmmio_info {
     struct vmmio_info *next;
     u64 base;
     u64 size;
+    const char *name;
+    int unit;           /* printed after the name, -1 for none */
+    u64 accesses;       /* emulated loads/stores, from all vcpus of the vm */
 
     int (*vmmio_read)(struct vcpu *, u64, u64 *, struct vmmio_access *);
     int (*vmmio_write)(struct vcpu *, u64, u64, struct vmmio_access *);
 };
 
-int vmmio_handler(struct vcpu *vcpu, int reg_num, struct vmmio_access *vmmio);
-int vmmio_handler_register(struct vm *vm, u64 ipa, u64 size,
+int vmmio_handler(struct vcpu *vcpu, u64 *val, struct vmmio_access *vmmio);
+void vmmio_dump(struct vm *vm);
+int vmmio_handler_register(struct vm *vm, const char *name, int unit, u64 ipa, u64 size,
                            int (*vmmio_read)(struct vcpu *, u64, u64 *, struct vmmio_access *),
                            int (*vmmio_write)(struct vcpu *, u64, u64, struct vmmio_access *));
 
@@ -0,0 +1,48 @@
+#ifndef __VMMIO_EMUL_H__
+#define __VMMIO_EMUL_H__
+
+#include <types.h>
+
+struct vcpu;
+
+/* ISS of a data abort from a lower EL */
+#define DABT_ISV                (1U << 24)  /* SAS/SSE/SRT/SF/AR below are valid */
+#define DABT_SAS(iss)           (((iss) >> 22) & 0x3)
+#define DABT_SSE                (1U << 21)
+#define DABT_SRT(iss)           (((iss) >> 16) & 0x1F)
+#define DABT_SF                 (1U << 15)
+#define DABT_FNV                (1U << 10)
+#define DABT_WNR                (1U << 6)
+
+/* PAR_EL1 after an AT instruction */
+#define PAR_F                   (1UL << 0)
+#define PAR_PA_MASK             0x0000FFFFFFFFF000UL
+
+/* Entries of the per-vcpu decode cache, a power of 2 */
+#define MMIO_INSN_CACHE_SIZE    8
+
+/* A decoded AArch64 load/store of general-purpose registers, one or two elements */
+struct mmio_insn {
+    u8  size;       /* bytes per element, 0 marks a free cache entry */
+    u8  nregs;      /* 2 for ldp/stp */
+    u8  load;
+    u8  sign;       /* sign extend what is loaded */
+    u8  sf;         /* to a 64-bit register, else the upper half is cleared */
+    u8  wb;         /* the base register is written back */
+    u8  post;       /* post-indexed, the access is at the old base */
+    u8  rt;
+    u8  rt2;
+    u8  rn;
+    s16 imm;        /* offset added to the base, only kept for pairs and writeback */
+};
+
+/* Keyed by the guest pc and the translation table base of its half of the VA space */
+struct mmio_insn_cache {
+    u64 pc;
+    u64 ttbr;
+    struct mmio_insn insn;
+};
+
+int vmmio_emulate(struct vcpu *vcpu, u64 esr_iss, u64 far, u64 ipa);
+
+#endif
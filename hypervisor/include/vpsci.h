@@ -3,17 +3,40 @@
 
 #include <types.h>
 #include <vcpu.h>
+#include <smccc.h>
 
 /* https://developer.aliyun.com/article/1205031 */
 #define PSCI_VERSION            0x84000000 //返回 PSCI 的主版本号和次版本号（32 位值）：
+#define PSCI_CPU_SUSPEND        0x84000001 //进入低功耗状态，standby类似WFI，powerdown唤醒后从入口地址开始执行
+#define PSCI_CPU_SUSPEND_64     0xc4000001
+#define PSCI_CPU_OFF            0x84000002 //关闭调用者自身，直到其他cpu调用CPU_ON
+#define PSCI_SYSTEM_CPUON_32    0x84000003
+#define PSCI_AFFINITY_INFO      0x84000004 //查询某个cpu的开关状态
+#define PSCI_AFFINITY_INFO_64   0xc4000004
 #define PSCI_MIGRATE_INFO_TYPE  0x84000006 //返回系统是否支持 CPU 迁移（migration），以及迁移的类型
 #define PSCI_SYSTEM_OFF         0x84000008 //通知系统进入完全关闭状态（电源关闭）
 #define PSCI_SYSTEM_RESET       0x84000009 //通知系统执行重启（软复位或硬复位）
 #define PSCI_SYSTEM_CPUON       0xc4000003 //唤醒一个关闭或低功耗的 CPU，设置其执行入口地址和上下文
 #define PSCI_FEATURE		    0x8400000a //检查特定 PSCI 功能是否可用。输入功能 ID，返回支持状态。
 
-u64 vpsci_trap_smc(vcpu_t *vcpu, u64 funid, u64 target_cpu, u64 entry_addr);
-u64 smc_call(u64 funid, u64 target_cpu, u64 entry_addr);
+/* PSCI return codes */
+#define PSCI_RET_SUCCESS            0
+#define PSCI_RET_NOT_SUPPORTED      (-1)
+#define PSCI_RET_INVALID_PARAMS     (-2)
+#define PSCI_RET_ALREADY_ON         (-4)
+
+/* AFFINITY_INFO */
+#define PSCI_AFFINITY_ON            0
+#define PSCI_AFFINITY_OFF           1
+
+/* CPU_SUSPEND power_state, original format */
+#define PSCI_POWER_STATE_TYPE_POWERDOWN (1 << 16)
+
+/* SCTLR_EL1 RES1 bits, MMU and caches off */
+#define SCTLR_EL1_RESET             0x30d00800
+
+u64 vpsci_trap_smc(vcpu_t *vcpu, u64 funid, u64 target_cpu, u64 entry_addr, u64 context_id);
+u64 smc_call(u64 funid, u64 target_cpu, u64 entry_addr, u64 context_id);
 
 
 #endif
\ No newline at end of file
@@ -0,0 +1,38 @@
+#ifndef __VTIMER_H__
+#define __VTIMER_H__
+
+#include <types.h>
+#include <hrtimer.h>
+
+struct vcpu;
+
+/* EL1 virtual timer PPI */
+#define VTIMER_IRQ          27
+
+/* CNTV_CTL_EL0 */
+#define CNTV_CTL_ENABLE     (1 << 0)
+#define CNTV_CTL_IMASK      (1 << 1)
+#define CNTV_CTL_ISTATUS    (1 << 2)
+
+/* CNTHCTL_EL2 */
+#define CNTHCTL_EL1PCTEN    (1 << 0)  /* EL1/EL0 access to the physical counter does not trap */
+#define CNTHCTL_EL1PCEN     (1 << 1)  /* EL1/EL0 access to the physical timer does not trap */
+
+struct vtimer {
+    u64  ctl;               /* CNTV_CTL_EL0 while switched out */
+    u64  cval;              /* CNTV_CVAL_EL0 while switched out */
+    u64  cntvoff;           /* CNTVOFF_EL2 for this vcpu */
+    u64  desched_at;        /* physical count at switch out, 0 if never ran */
+    bool exclude_desched;   /* stop guest virtual time while descheduled */
+    bool active;            /* physical PPI 27 was active at switch out */
+    bool pending;           /* expired while switched out */
+    bool preempted;         /* switched out while READY, not blocked */
+    struct hrtimer bg_timer;
+};
+
+void vtimer_init(struct vcpu *vcpu, u64 cntvoff, bool exclude_desched);
+void vtimer_save(struct vcpu *vcpu);
+void vtimer_restore(struct vcpu *vcpu);
+void vtimer_percpu_init(void);
+
+#endif
@@ -1,10 +1,106 @@
 #ifndef __XLOG_H__
 #define __XLOG_H__
 
+#include "types.h"
 #include "printf.h"
+#include "xhyper_config.h"
 
+/*
+ * Leveled logging.
+ *
+ * XHYPER_LOG_LEVEL (xhyper_config.h) is the build time minimum: calls below
+ * it expand to nothing, arguments included. At run time every subsystem can
+ * be muted through xlog_mask (console "log"), errors always get through.
+ *
+ * A file logs as XLOG_SUBSYS, define it before the includes to pick another
+ * subsystem than XLOG_CORE.
+ */
+#define LOG_LEVEL_ERR       0
+#define LOG_LEVEL_WARN      1
+#define LOG_LEVEL_INFO      2
+#define LOG_LEVEL_DEBUG     3
 
-#define LOG_INFO(...) printf("[X-Hyper info] " __VA_ARGS__)
-#define LOG_WARN(...) printf("[X-Hyper warn] " __VA_ARGS__)
+enum xlog_subsys {
+    XLOG_CORE,
+    XLOG_MM,
+    XLOG_VM,
+    XLOG_VCPU,
+    XLOG_SCHED,
+    XLOG_VGIC,
+    XLOG_VPSCI,
+    XLOG_MMIO,
+    XLOG_VIRTIO,
+    XLOG_NR_SUBSYS,
+};
 
-#endif
\ No newline at end of file
+#ifndef XLOG_SUBSYS
+#define XLOG_SUBSYS         XLOG_CORE
+#endif
+
+/* bit n enables subsystem n */
+extern u32 xlog_mask;
+extern const char *xlog_subsys_name[XLOG_NR_SUBSYS];
+
+/* Per call site: at most burst messages every interval_ms */
+struct xlog_ratelimit {
+    u32 interval_ms;
+    u32 burst;
+    u32 printed;
+    u32 missed;
+    u64 begin;
+};
+
+#define XLOG_RATELIMIT_INTERVAL_MS  5000
+#define XLOG_RATELIMIT_BURST        10
+
+bool __xlog_ratelimit(struct xlog_ratelimit *rl);
+
+#define __xlog_enabled(level) \
+    ((level) == LOG_LEVEL_ERR || (xlog_mask & (1U << XLOG_SUBSYS)))
+
+#define __xlog(level, prefix, ...) \
+    do { \
+        if(__xlog_enabled(level)) { \
+            printf(prefix __VA_ARGS__); \
+        } \
+    } while(0)
+
+#define __xlog_ratelimited(level, prefix, ...) \
+    do { \
+        static struct xlog_ratelimit __rl = { \
+            .interval_ms = XLOG_RATELIMIT_INTERVAL_MS, \
+            .burst       = XLOG_RATELIMIT_BURST, \
+        }; \
+        if(__xlog_enabled(level) && __xlog_ratelimit(&__rl)) { \
+            printf(prefix __VA_ARGS__); \
+        } \
+    } while(0)
+
+#define __xlog_none(...)    do { } while(0)
+
+#define LOG_ERR(...)                __xlog(LOG_LEVEL_ERR, "[X-Hyper error] ", __VA_ARGS__)
+#define LOG_ERR_RATELIMITED(...)    __xlog_ratelimited(LOG_LEVEL_ERR, "[X-Hyper error] ", __VA_ARGS__)
+
+#if XHYPER_LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(...)               __xlog(LOG_LEVEL_WARN, "[X-Hyper warn] ", __VA_ARGS__)
+#define LOG_WARN_RATELIMITED(...)   __xlog_ratelimited(LOG_LEVEL_WARN, "[X-Hyper warn] ", __VA_ARGS__)
+#else
+#define LOG_WARN(...)               __xlog_none(__VA_ARGS__)
+#define LOG_WARN_RATELIMITED(...)   __xlog_none(__VA_ARGS__)
+#endif
+
+#if XHYPER_LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...)               __xlog(LOG_LEVEL_INFO, "[X-Hyper info] ", __VA_ARGS__)
+#define LOG_INFO_RATELIMITED(...)   __xlog_ratelimited(LOG_LEVEL_INFO, "[X-Hyper info] ", __VA_ARGS__)
+#else
+#define LOG_INFO(...)               __xlog_none(__VA_ARGS__)
+#define LOG_INFO_RATELIMITED(...)   __xlog_none(__VA_ARGS__)
+#endif
+
+#if XHYPER_LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...)              __xlog(LOG_LEVEL_DEBUG, "[X-Hyper debug] ", __VA_ARGS__)
+#else
+#define LOG_DEBUG(...)              __xlog_none(__VA_ARGS__)
+#endif
+
+#endif
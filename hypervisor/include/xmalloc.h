@@ -7,8 +7,10 @@
 #include "arch.h"
 #include <stdint.h>
 #include <stddef.h>
+#include "xhyper_config.h"
 
-#define CONFIG_BLK_SIZE   8192
+/* the linker script reserves a page for the pool header plus this */
+#define CONFIG_BLK_SIZE   XHYPER_XMALLOC_SIZE
 
 #define BLK_SLICE_BIT     10
 // BLK_SLICE_SIZE = 1 << 10 = 1024（1KB）
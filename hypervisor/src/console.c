@@ -0,0 +1,227 @@
+#include <types.h>
+#include <printf.h>
+#include <logbuf.h>
+#include <pl011.h>
+#include <layout.h>
+#include <vcpu.h>
+#include <exitstat.h>
+#include <trace.h>
+#include <xlog.h>
+#include <cpufeature.h>
+#include <console.h>
+#include <virtio.h>
+#include <virtio_console.h>
+#include <virtio_blk.h>
+#include <virtio_net.h>
+#include <iopoll.h>
+
+#define CONSOLE_LINE_MAX    64
+#define CONSOLE_PROMPT      "xhyper> "
+/* Ctrl-], cycles the uart input through the guests' virtio consoles and this shell */
+#define CONSOLE_SWITCH_KEY  0x1d
+
+static char console_line[CONSOLE_LINE_MAX];
+static int  console_len;
+/* virtio console the uart input goes to, NULL for the hypervisor shell */
+static struct vconsole *console_focus;
+static bool console_focus_set;
+
+struct console_cmd {
+    const char *name;
+    const char *help;
+    void (*func)(char *arg);
+};
+
+static void cmd_help(char *arg);
+
+static bool str_eq(const char *a, const char *b)
+{
+    while(*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+/* stat [n]: exit statistics of every vcpu, or of vcpus[n] */
+static void cmd_stat(char *arg)
+{
+    int n = -1;
+
+    if(*arg >= '0' && *arg <= '9') {
+        n = 0;
+        while(*arg >= '0' && *arg <= '9') {
+            n = n * 10 + *arg++ - '0';
+        }
+    }
+
+    for(int i = 0; i < NVCPU; i++) {
+        if(vcpus[i].state == VCPU_UNUSED || (n >= 0 && n != i)) {
+            continue;
+        }
+        exit_stat_dump(&vcpus[i]);
+    }
+}
+
+static void cmd_reset(char *arg)
+{
+    for(int i = 0; i < NVCPU; i++) {
+        if(vcpus[i].state != VCPU_UNUSED) {
+            exit_stat_reset(&vcpus[i]);
+        }
+    }
+}
+
+static void cmd_trace(char *arg)
+{
+    trace_info();
+}
+
+/* log [subsys on|off]: list or toggle the runtime log mask */
+static void cmd_log(char *arg)
+{
+    char *onoff = arg;
+
+    if(*arg == '\0') {
+        for(int i = 0; i < XLOG_NR_SUBSYS; i++) {
+            printf("  %s\t%s\n", xlog_subsys_name[i], (xlog_mask >> i) & 0x1 ? "on" : "off");
+        }
+        return;
+    }
+
+    while(*onoff && *onoff != ' ') {
+        onoff++;
+    }
+    if(*onoff) {
+        *onoff++ = '\0';
+    }
+
+    for(int i = 0; i < XLOG_NR_SUBSYS; i++) {
+        if(!str_eq(arg, xlog_subsys_name[i])) {
+            continue;
+        }
+        if(str_eq(onoff, "on")) {
+            xlog_mask |= 1U << i;
+        } else if(str_eq(onoff, "off")) {
+            xlog_mask &= ~(1U << i);
+        } else {
+            printf("usage: log <subsys> on|off\n");
+        }
+        return;
+    }
+    printf("unknown subsystem '%s'\n", arg);
+}
+
+static void cmd_cpu(char *arg)
+{
+    cpufeature_dump();
+}
+
+static void cmd_virtio(char *arg)
+{
+    virtio_dump();
+    vconsole_dump();
+    vblk_dump();
+    vnet_dump();
+    iopoll_dump();
+}
+
+static const struct console_cmd console_cmds[] = {
+    {"help",  "list commands",                     cmd_help},
+    {"stat",  "[n] per-vcpu exit counts and cost", cmd_stat},
+    {"reset", "clear the exit statistics",         cmd_reset},
+    {"trace", "where to dump the trace rings from",  cmd_trace},
+    {"log",   "[subsys on|off] runtime log mask",    cmd_log},
+    {"cpu",   "detected cpu features",               cmd_cpu},
+    {"virtio", "virtio devices and their counters",      cmd_virtio},
+};
+
+static void cmd_help(char *arg)
+{
+    for(u64 i = 0; i < sizeof(console_cmds) / sizeof(console_cmds[0]); i++) {
+        printf("  %s\t%s\n", console_cmds[i].name, console_cmds[i].help);
+    }
+}
+
+void console_exec(char *line)
+{
+    char *arg = line;
+
+    /* split the command name from its argument */
+    while(*arg && *arg != ' ') {
+        arg++;
+    }
+    if(*arg) {
+        *arg++ = '\0';
+    }
+    while(*arg == ' ') {
+        arg++;
+    }
+
+    if(*line == '\0') {
+        return;
+    }
+
+    for(u64 i = 0; i < sizeof(console_cmds) / sizeof(console_cmds[0]); i++) {
+        if(str_eq(line, console_cmds[i].name)) {
+            /* dumps are bigger than the log ring, write them out as they are printed */
+            bool async = logbuf_set_async(false);
+            console_cmds[i].func(arg);
+            logbuf_set_async(async);
+            return;
+        }
+    }
+    printf("unknown command '%s', try help\n", line);
+}
+
+static void console_switch(void)
+{
+    console_focus = vconsole_next(console_focus);
+    if(console_focus != NULL) {
+        printf("\n[console: %s, Ctrl-] to switch]\n", vconsole_name(console_focus));
+    } else {
+        printf("\n[console: xhyper]\n");
+        pl011_puts(CONSOLE_PROMPT);
+    }
+}
+
+void console_input(char c)
+{
+    /* the first guest console has the input until the user switches */
+    if(!console_focus_set) {
+        console_focus = vconsole_next(NULL);
+        console_focus_set = true;
+    }
+
+    if(c == CONSOLE_SWITCH_KEY) {
+        console_switch();
+        return;
+    }
+    if(console_focus != NULL) {
+        vconsole_input(console_focus, c);
+        return;
+    }
+
+    if(c == '\r' || c == '\n') {
+        pl011_puts("\n");
+        console_line[console_len] = '\0';
+        console_exec(console_line);
+        console_len = 0;
+        pl011_puts(CONSOLE_PROMPT);
+        return;
+    }
+
+    /* backspace / delete */
+    if(c == 0x08 || c == 0x7f) {
+        if(console_len > 0) {
+            console_len--;
+            pl011_puts("\b \b");
+        }
+        return;
+    }
+
+    if(console_len < CONSOLE_LINE_MAX - 1) {
+        console_line[console_len++] = c;
+        pl011_putc(c);
+    }
+}
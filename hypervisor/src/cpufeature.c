@@ -0,0 +1,107 @@
+#include <types.h>
+#include <arch.h>
+#include <printf.h>
+#include <gicv3.h>
+#include <cpufeature.h>
+
+/* ID register fields used here, bits [hi:lo] */
+#define ID_FIELD(reg, lo)       (((reg) >> (lo)) & 0xF)
+
+#define ISAR0_ATOMIC            20
+#define ISAR0_TLB               56
+#define MMFR0_PARANGE           0
+#define MMFR0_ECV               60
+#define MMFR1_VMIDBITS          4
+#define MMFR2_FWB               40
+
+#define DCZID_DZP               (1 << 4)
+#define DCZID_BS(n)             ((n) & 0xF)
+
+#define ICH_VTR_LISTREGS(n)     ((n) & 0x1F)
+
+struct cpu_features cpu_features;
+
+static const char *cpu_feature_name[CPU_NR_FEATURES] = {
+    [CPU_FEAT_LSE]       = "lse",
+    [CPU_FEAT_TLBIRANGE] = "tlbirange",
+    [CPU_FEAT_S2FWB]     = "s2fwb",
+    [CPU_FEAT_VMID16]    = "vmid16",
+    [CPU_FEAT_ECV]       = "ecv",
+    [CPU_FEAT_DCZVA]     = "dczva",
+};
+
+static void cpufeature_probe(struct cpu_features *f)
+{
+    u64 dczid, vtr;
+
+    read_sysreg(f->id_aa64pfr0, id_aa64pfr0_el1);
+    read_sysreg(f->id_aa64isar0, id_aa64isar0_el1);
+    read_sysreg(f->id_aa64mmfr0, id_aa64mmfr0_el1);
+    read_sysreg(f->id_aa64mmfr1, id_aa64mmfr1_el1);
+    /* ID_AA64MMFR2_EL1, the assembler may not know the name */
+    read_sysreg(f->id_aa64mmfr2, S3_0_C0_C7_2);
+    read_sysreg(dczid, dczid_el0);
+    read_sysreg(vtr, ICH_VTR_EL2);
+
+    f->caps = 0;
+    /* 2: LDADD, CAS, SWP... */
+    if(ID_FIELD(f->id_aa64isar0, ISAR0_ATOMIC) >= 2) {
+        f->caps |= 1UL << CPU_FEAT_LSE;
+    }
+    /* 2: outer shareable and range TLBI */
+    if(ID_FIELD(f->id_aa64isar0, ISAR0_TLB) >= 2) {
+        f->caps |= 1UL << CPU_FEAT_TLBIRANGE;
+    }
+    if(ID_FIELD(f->id_aa64mmfr2, MMFR2_FWB) >= 1) {
+        f->caps |= 1UL << CPU_FEAT_S2FWB;
+    }
+    if(ID_FIELD(f->id_aa64mmfr1, MMFR1_VMIDBITS) == 2) {
+        f->caps |= 1UL << CPU_FEAT_VMID16;
+    }
+    if(ID_FIELD(f->id_aa64mmfr0, MMFR0_ECV) >= 1) {
+        f->caps |= 1UL << CPU_FEAT_ECV;
+    }
+    if(!(dczid & DCZID_DZP)) {
+        f->caps |= 1UL << CPU_FEAT_DCZVA;
+        f->dczva_bytes = 4 << DCZID_BS(dczid);
+    } else {
+        f->dczva_bytes = 0;
+    }
+
+    f->pa_range = ID_FIELD(f->id_aa64mmfr0, MMFR0_PARANGE);
+    f->nr_lrs   = ICH_VTR_LISTREGS(vtr) + 1;
+}
+
+/* Boot pcpu, before any lock is taken by a secondary */
+void cpufeature_init(void)
+{
+    cpufeature_probe(&cpu_features);
+    cpufeature_dump();
+}
+
+/*
+ * The code paths were chosen from the boot pcpu, a secondary lacking one of
+ * its features would fault on it. Big.LITTLE mixes aren't supported.
+ */
+void cpufeature_percpu_check(void)
+{
+    struct cpu_features f;
+
+    cpufeature_probe(&f);
+    if(f.caps != cpu_features.caps || f.nr_lrs != cpu_features.nr_lrs) {
+        abort("pcpu %d features %x differ from the boot pcpu's %x", coreid(), f.caps, cpu_features.caps);
+    }
+}
+
+void cpufeature_dump(void)
+{
+    printf("cpu features:");
+    for(int i = 0; i < CPU_NR_FEATURES; i++) {
+        if(cpu_has(i)) {
+            printf(" %s", cpu_feature_name[i]);
+        }
+    }
+    printf("\n");
+    printf("PARange %d, DC ZVA block %d bytes, %d GIC list registers\n",
+           cpu_features.pa_range, cpu_features.dczva_bytes, cpu_features.nr_lrs);
+}
@@ -5,11 +5,17 @@
 #include <vcpu.h>
 #include <vpsci.h>  
 #include <vgicv3.h>
-
-#define SYSREG_OPCODE(op0, op1, crn, crm, op2) \
-     ((op0 << 20) | (op2 << 17) | (op1 << 14) | (crn << 10) | (crm << 1))
-
-#define VSYSREG_ICC_SGI1R_EL1   SYSREG_OPCODE(3, 0, 12, 11, 5)
+#include <hrtimer.h>
+#include <sched.h>
+#include <pvtime.h>
+#include <hypercall.h>
+#include <exitstat.h>
+#include <trace.h>
+#include <trap.h>
+#include <vmmio_emul.h>
+
+extern bool hyp_irq_handler(u32 irq);
+extern void hyp_irq_unowned(u32 irq);
 
 static void vpsci_handler(vcpu_t *vcpu)
 {
@@ -17,17 +23,32 @@ static void vpsci_handler(vcpu_t *vcpu)
      * x0 - function id
      * x1 - target cpu
      * x2 - entry addr (the entry addr for guest vm, not for vmm)
+     * x3 - context id
      */
 
-    u64 ret = vpsci_trap_smc(vcpu, vcpu->regs.x[0], vcpu->regs.x[1], vcpu->regs.x[2]);
+    u64 ret = vpsci_trap_smc(vcpu, vcpu->regs.x[0], vcpu->regs.x[1], vcpu->regs.x[2], vcpu->regs.x[3]);
     vcpu->regs.x[0] = ret;
 }
 
+/* Standard hypervisor service calls, x0 - function id, x1 - argument */
+static void std_hyp_handler(vcpu_t *vcpu)
+{
+    vcpu->regs.x[0] = pvtime_handler(vcpu, vcpu->regs.x[0], vcpu->regs.x[1]);
+}
+
 static int hvc_smc_handler(vcpu_t *vcpu, int imm)
 {
+    trace(HVC, vcpu, vcpu->regs.x[0], vcpu->regs.x[1]);
+
     switch(imm) {
         case 0:
-            vpsci_handler(vcpu);
+            if(SMCCC_OWNER(vcpu->regs.x[0]) == SMCCC_OWNER_STANDARD_HYP) {
+                std_hyp_handler(vcpu);
+            } else if(SMCCC_OWNER(vcpu->regs.x[0]) == SMCCC_OWNER_VENDOR_HYP) {
+                vcpu->regs.x[0] = hypercall_handler(vcpu, vcpu->regs.x[0], vcpu->regs.x[1], vcpu->regs.x[2]);
+            } else {
+                vpsci_handler(vcpu);
+            }
             return 0;
         default:
             return -1;
@@ -48,122 +69,84 @@ static int data_abort_handler(vcpu_t *vcpu, u64 esr_iss, u64 far)
 {
     u64 ipa = get_fault_ipa(far);
 
-    int wnr = (esr_iss >> 6) & 0x1;   /* write or read */
-    int sas = (esr_iss >> 22) & 0x3;  /* Syndrome Access Size */
-    int srt = (esr_iss >> 16) & 0x1f; /* The register number of the Wt/Xt/Rt */
-    int fnv = (esr_iss >> 10) & 0x1;  /* far is valid or not valid */
-
-    if(fnv != 0) {
+    if(esr_iss & DABT_FNV) {    /* far is valid or not valid */
         abort("FAR is not valid");
-    }  
+    }
 
-    enum access_size accesz;
+    /* from the syndrome, or the instruction itself when ISV is clear (ldp/stp, writeback) */
+    return vmmio_emulate(vcpu, esr_iss, far, ipa);
+}
 
-    switch(sas) {
-        case 0: accesz = VMMIO_BYTE; break;       //字节
-        case 1: accesz = VMMIO_HALFWORD; break;   //半字
-        case 2: accesz = VMMIO_WORD; break;       //字
-        case 3: accesz = VMMIO_DOUBLEWORD; break; //双字
-        default: abort("Unknow SAS from esr_el2");
+/* HVC instruction execution in AArch64 state, when HVC is not disabled. */
+/* 64位环境下执行HVC（Hypervisor Call）指令触发的异常。用于虚拟机监控模式（EL2），虚拟机通过此指令与Hypervisor交互。*/
+static int trap_hvc(vcpu_t *vcpu, u64 esr)
+{
+    LOG_DEBUG("\033[32m [el1_sync_proc] hvc trap from EL1\033[0m\n");
+    /* hvc from EL1 will set the preferred exception return address to pc+4 */
+    if(hvc_smc_handler(vcpu, ESR_ISS(esr) & 0xFFFF) != 0) {
+        /* only #0 is SMCCC */
+        vcpu->regs.x[0] = (u64)SMCCC_RET_NOT_SUPPORTED;
     }
+    return EXIT_HVC;
+}
 
-    struct vmmio_access vmmio_acs;
+/* 64位环境下执行SMC（Secure Monitor Call）指令触发的异常。用于安全监控模式（EL3），实现安全世界与非安全世界的切换*/
+static int trap_smc(vcpu_t *vcpu, u64 esr)
+{
+    LOG_DEBUG("\033[32m[el1_sync_proc] smc trap from EL1\033[0m\n");
+    /* smc trapped from EL1 will set preferred execption return address to pc
+     * so we need to +4 return to the next instruction.
+     * Done first, a psci call may redirect the vcpu to an entry point.
+     */
+    vcpu->regs.elr += 4;
+    /* on smc call, iss is the imm of a smc */
+    if(hvc_smc_handler(vcpu, ESR_ISS(esr) & 0xFFFF) != 0) {
+        vcpu->regs.x[0] = (u64)SMCCC_RET_NOT_SUPPORTED;
+    }
+    return EXIT_SMC;
+}
 
-    vmmio_acs.ipa = ipa;
-    vmmio_acs.accsize = accesz;
-    vmmio_acs.wnr = wnr;
+/* data abort 内存访问异常*/
+static int trap_dabt(vcpu_t *vcpu, u64 esr)
+{
+    u64 far;
+    /* Holds the faulting Virtual Address */
+    read_sysreg(far, far_el2);
 
-    if(vmmio_handler(vcpu, srt, &vmmio_acs) < 0) {
-        LOG_WARN("VMMIO handler failed: ipa %p, va %p\n", ipa, far);
+    LOG_DEBUG("\033[32m[el1_sync_proc] data abort from EL0/1\033[0m\n");
+    if(data_abort_handler(vcpu, ESR_ISS(esr), far) < 0) {
         return -1;
     }
-
-    return 0;
+    vcpu->regs.elr += 4;
+    return EXIT_DABT;
 }
 
-int vsysreg_handler(vcpu_t *vcpu, u64 iss)
+/* The exit classes handled here, the others register from their subsystem */
+void el1_sync_init(void)
 {
-    int write_not_read = !(iss & 1);
-    /* The Rt value from the issued instruction, the general-purpose register used for the transfer. */
-    int rt = (iss >> 5) & 0x1F;
-    iss = iss & ~(0x1F << 5);
-
-    switch(iss) {
-        case VSYSREG_ICC_SGI1R_EL1:
-            vgicv3_generate_sgi(vcpu, rt, write_not_read);
-        return 0;
-    }
-
-    LOG_WARN("Unable to handler a system register\n");
-    return -1;
+    trap_ec_register(ESR_EC_HVC64, trap_hvc);
+    trap_ec_register(ESR_EC_SMC64, trap_smc);
+    trap_ec_register(ESR_EC_SYS64, trap_sysreg);
+    trap_ec_register(ESR_EC_DABT_LOW, trap_dabt);
 }
 
 void el1_sync_proc()
 {
-    vcpu_t *vcpu;
     /* which vcpu has been trapped into EL2 */
-    read_sysreg(vcpu, tpidr_el2);
+    vcpu_t *vcpu = this_vcpu();
 
-    u64 esr, elr, far;
+    u64 esr, elr;
     /* Exception Syndrome Register */
     read_sysreg(esr, esr_el2);
     /* Exception Link Register */
     read_sysreg(elr, elr_el2);
-    /* Holds the faulting Virtual Address */
-    read_sysreg(far, far_el2);
 
-    /* Exception Class  取esr_el2寄存器的 26-31位，即EC字段*/
-    u64 esr_ec  = (esr >> 26) & 0x3F;
-    /* Instruction Specific Syndrome  取esr_el2寄存器0-24位，即ISS字段*/
-    u64 esr_iss = esr & 0x1FFFFFF;
-    /* Instruction Length 取esr_el2寄存器的25位，即IL字段 */
-    u64 esr_il  = (esr >> 25) & 0x1;
-
-    switch(esr_ec) {
-
-        /* HVC instruction execution in AArch64 state, when HVC is not disabled. */
-        /* 64位环境下执行HVC（Hypervisor Call）指令触发的异常。用于虚拟机监控模式（EL2），虚拟机通过此指令与Hypervisor交互。*/
-        case 0x16:
-            LOG_INFO("\033[32m [el1_sync_proc] hvc trap from EL1\033[0m\n");
-            if(hvc_smc_handler(vcpu, esr_iss) != 0) {
-                abort("Unknown HVC call #%d", esr_iss);
-            }
-            /* hvc from EL1 will set the preferred exception return address to pc+4 */
-            vcpu->regs.elr += 0;
-            break;
-
-        /* 64位环境下执行SMC（Secure Monitor Call）指令触发的异常。用于安全监控模式（EL3），实现安全世界与非安全世界的切换*/
-        case 0x17:
-            LOG_INFO("\033[32m[el1_sync_proc] smc trap from EL1\033[0m\n");
-            /* on smc call, iss is the imm of a smc */
-            if(hvc_smc_handler(vcpu, esr_iss) != 0) {
-                abort("Unknown SMC call #%d", esr_iss);
-            }
-            /* smc trapped from EL1 will set preferred execption return address to pc
-             * so we need to +4 return to the next instruction.
-             */
-            vcpu->regs.elr += 4;
-            break;
-
-        /* trapped by read/write system register */
-        case 0x18:
-            if(vsysreg_handler(vcpu, esr_iss) < 0) {
-                abort("Unknow system register trap");
-            }
-            vcpu->regs.elr += 4;
-            break;
-
-        /* data abort 内存访问异常*/
-        case 0x24:
-            //LOG_INFO("\033[32m[el1_sync_proc] data abort from EL0/1\033[0m\n");
-            data_abort_handler(vcpu, esr_iss, far);
-            vcpu->regs.elr += 4;
-            break;
-        default:
-            abort("Unknown el1 sync: esr_ec %p, esr_iss %p, elr %p, far %p", esr_ec, esr_iss, elr, far);
-            break;
-    }
+    trace(VM_EXIT, vcpu, esr, elr);
+
+    int reason = trap_handle(vcpu, esr);
 
+    exit_stat_account(vcpu, reason);
+    sched_exit_check();
     return;
 }
 
@@ -171,28 +154,26 @@ void el1_sync_proc()
 void el1_irq_proc(void)
 {
     u32 iar, irq;
-    struct vcpu *vcpu;
-    read_sysreg(vcpu, tpidr_el2);
-    virq_enter(vcpu);
+    struct vcpu *vcpu = this_vcpu();
 
     gicv3_ops.get_irq(&iar);
     irq = iar & 0x3FF;
 
-    //LOG_INFO("el1 irq proc\n");
-    //完成优先级降权
-    gicv3_ops.guest_eoi(irq);
+    trace(IRQ, vcpu, irq, 0);
 
-    /* set pirq equal to virq */
-    virq_inject(vcpu, irq, irq);
-}
+    /* spurious */
+    if(irq >= GIC_MAX_IRQ) {
+        exit_stat_account(vcpu, EXIT_IRQ);
+        sched_exit_check();
+        return;
+    }
 
-int vgicv3_generate_sgi(struct vcpu *vcpu, int rt, int wr)
-{
-    u64  regs_sgi = vcpu->regs.x[rt];
-    u16  target   = regs_sgi & 0xFFFF;
-    u8   intid    = (regs_sgi >> 24) & 0xF;
-    bool irm      = (regs_sgi >> 40) & 0x1;
-
-    write_sysreg(ICC_SGI1R_EL1, regs_sgi);
-    return 1;
-}
\ No newline at end of file
+    /* EL2 timer, scheduler IPIs and vgic maintenance belong to the hypervisor, don't forward them */
+    /* The virtual timer context on this pcpu is the current vcpu's, so PPI 27 goes to it */
+    if(!hyp_irq_handler(irq) && !vgic_forward_irq(vcpu, irq)) {
+        hyp_irq_unowned(irq);
+    }
+
+    exit_stat_account(vcpu, EXIT_IRQ);
+    sched_exit_check();
+}
@@ -7,23 +7,76 @@
 #include <vmmio.h>
 #include <gicv3.h>
 #include <pl011.h>
+#include <hrtimer.h>
+#include <sched.h>
+#include <vgicv3.h>
+#include <virtio_console.h>
 
-void el2_irq_proc(void)
+/* Interrupts owned by the hypervisor, whichever EL they arrive in. Returns false for guest ones. */
+bool hyp_irq_handler(u32 irq)
 {
-    u32 iar, irq;
-    /* 获取ICC_IAR1_EL1寄存器的值 */
-    gicv3_ops.get_irq(&iar);
-    /* 取出中断ID的值 0x3ff =0b 11 1111 1111 */
-    irq = iar & 0x3FF;
+    switch(irq) {
+        case HYP_TIMER_IRQ:
+            hrtimer_irq_handler();
+            break;
+        case IPI_RESCHED:
+            sched_ipi_handler();
+            break;
+        case GIC_MAINT_IRQ:
+            vgic_maintenance_handler();
+            break;
+        case UART_IRQ_LINE:
+            /* passed through to the guests unless a virtio console took the uart */
+            if(!vconsole_owns_uart()) {
+                return false;
+            }
+            pl011_irq_handler();
+            break;
+        default:
+            return false;
+    }
+
+    gicv3_ops.hyp_eoi(irq);
+    return true;
+}
 
+/* An irq neither the hypervisor nor any vm handles */
+void hyp_irq_unowned(u32 irq)
+{
     switch(irq) {
         case UART_IRQ_LINE:
             pl011_irq_handler();
         break;
         default:
-            LOG_WARN("Unknow IRQ under EL2, irq is %d\n", irq);
+            /* keep it from firing again until a guest enables it */
+            LOG_WARN_RATELIMITED("Unknow IRQ under EL2, irq is %d\n", irq);
+            gicv3_ops.mask(irq);
             break;
     }
 
     gicv3_ops.hyp_eoi(irq);
+}
+
+/* Only taken while the pcpu is idle (or still booting), no vcpu is loaded */
+void el2_irq_proc(void)
+{
+    u32 iar, irq;
+    /* 获取ICC_IAR1_EL1寄存器的值 */
+    gicv3_ops.get_irq(&iar);
+    /* 取出中断ID的值 0x3ff =0b 11 1111 1111 */
+    irq = iar & 0x3FF;
+
+    /* spurious */
+    if(irq >= GIC_MAX_IRQ) {
+        return;
+    }
+
+    if(hyp_irq_handler(irq)) {
+        return;
+    }
+
+    /* The virtual timer context here is the last vcpu's, device SPIs go to the vcpu of the vm owning them */
+    if(!vgic_forward_irq(this_cpu()->last_vcpu, irq)) {
+        hyp_irq_unowned(irq);
+    }
 }
\ No newline at end of file
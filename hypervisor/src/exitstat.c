@@ -0,0 +1,116 @@
+#include <types.h>
+#include <arch.h>
+#include <printf.h>
+#include <vcpu.h>
+#include <hrtimer.h>
+#include <exitstat.h>
+#include <vmmio.h>
+
+const char *exit_reason_name[EXIT_NR] = {
+    [EXIT_WFI]    = "wfi",
+    [EXIT_WFE]    = "wfe",
+    [EXIT_HVC]    = "hvc",
+    [EXIT_SMC]    = "smc",
+    [EXIT_SYSREG] = "sysreg",
+    [EXIT_DABT]   = "dabt",
+    [EXIT_IRQ]    = "irq",
+    [EXIT_OTHER]  = "other",
+};
+
+void exit_stat_reset(struct vcpu *vcpu)
+{
+    for(int r = 0; r < EXIT_NR; r++) {
+        struct exit_stat *st = &vcpu->exits[r];
+        st->count = 0;
+        st->ticks = 0;
+        st->max   = 0;
+        for(int i = 0; i < EXIT_HIST_BUCKETS; i++) {
+            st->hist[i] = 0;
+        }
+    }
+    vcpu->exit_entry = 0;
+    vcpu->fast_exits = 0;
+}
+
+static inline int exit_hist_bucket(u64 ticks)
+{
+    int n = ticks == 0 ? 0 : 64 - __builtin_clzl(ticks);
+    return n < EXIT_HIST_BUCKETS ? n : EXIT_HIST_BUCKETS - 1;
+}
+
+/*
+ * Called by the exit handlers of the trapped vcpu before sched_exit_check(),
+ * while the vcpu is still loaded here: once it is put another pcpu may pick
+ * it up and take its next exit. A switch the exit ends in is not counted.
+ * Only the pcpu running the vcpu writes these, readers may see a torn update.
+ */
+void exit_stat_account(struct vcpu *vcpu, enum exit_reason reason)
+{
+    u64 ticks = hrtimer_now() - vcpu->exit_entry;
+    struct exit_stat *st = &vcpu->exits[reason];
+
+    st->count++;
+    st->ticks += ticks;
+    if(ticks > st->max) {
+        st->max = ticks;
+    }
+    st->hist[exit_hist_bucket(ticks)]++;
+}
+
+u64 exit_stat_query(struct vcpu *vcpu, u64 reason, u64 field)
+{
+    if(reason >= EXIT_NR) {
+        return 0;
+    }
+
+    struct exit_stat *st = &vcpu->exits[reason];
+
+    switch(field) {
+        case EXIT_STAT_COUNT:
+            return st->count;
+        case EXIT_STAT_TICKS:
+            return st->ticks;
+        case EXIT_STAT_MAX:
+            return st->max;
+        default:
+            if(field - EXIT_STAT_HIST(0) < EXIT_HIST_BUCKETS) {
+                return st->hist[field - EXIT_STAT_HIST(0)];
+            }
+            return 0;
+    }
+}
+
+void exit_stat_dump(struct vcpu *vcpu)
+{
+    printf("%s vcpu %d exits:\n", vcpu->vm->name, vcpu->cpuid);
+    printf("  reason        count    avg ns    max ns\n");
+
+    for(int r = 0; r < EXIT_NR; r++) {
+        struct exit_stat *st = &vcpu->exits[r];
+        if(st->count == 0) {
+            continue;
+        }
+
+        printf("  %s\t%10d%10d%10d\n", exit_reason_name[r], (u32)st->count,
+               (u32)hrtimer_cnt_to_ns(st->ticks / st->count), (u32)hrtimer_cnt_to_ns(st->max));
+
+        /* log2 histogram, only the populated range */
+        printf("    ticks<2^n:");
+        for(int i = 0; i < EXIT_HIST_BUCKETS; i++) {
+            if(st->hist[i] != 0) {
+                printf(" [%d]%d", i, (u32)st->hist[i]);
+            }
+        }
+        printf("\n");
+    }
+
+    /* not timed, they never get past the vector */
+    if(vcpu->fast_exits != 0) {
+        printf("  fast\t%10d\n", (u32)vcpu->fast_exits);
+    }
+
+    /* the dabt exits by device, counted per vm */
+    if(vcpu->cpuid == 0) {
+        vmmio_dump(vcpu->vm);
+    }
+}
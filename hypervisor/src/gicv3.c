@@ -1,3 +1,5 @@
+#define XLOG_SUBSYS XLOG_VGIC
+
 #include <vm.h>
 #include <types.h>
 #include <xlog.h>
@@ -16,16 +18,37 @@
 int gic_max_lrs = 0;
 int gic_max_spi = 0;
 
+struct gic_rdist gic_rdists[NCPU];
+int nr_pcpus = 1;
+
 //初始化虚拟GICv3接口
 void gic_context_init(struct gicv3_context *gic_context)
 {
     read_sysreg(gic_context->vmcr, ICH_VMCR_EL2);
 }
 
+/* 保存当前vcpu的虚拟cpu interface状态，并清空LR留给下一个vcpu */
+void save_gic_context(struct gicv3_context *gic_context)
+{
+    for(int i = 0; i < gic_max_lrs; i++) {
+        gic_context->gic_lr[i] = gic_read_list_reg(i);
+        gic_write_list_reg(i, 0);
+    }
+    read_sysreg(gic_context->vmcr, ICH_VMCR_EL2);
+    read_sysreg(gic_context->ap1r0, ICH_AP1R0_EL2);
+    write_sysreg(ICH_AP1R0_EL2, 0);
+    /* no underflow interrupts while the LRs are empty */
+    write_sysreg(ICH_HCR_EL2, ICH_HCR_EN);
+}
+
 void restore_gic_context(struct gicv3_context *gic_context)
 {
     u32 sre;
     write_sysreg(ICH_VMCR_EL2, gic_context->vmcr);
+    write_sysreg(ICH_AP1R0_EL2, gic_context->ap1r0);
+    for(int i = 0; i < gic_max_lrs; i++) {
+        gic_write_list_reg(i, gic_context->gic_lr[i]);
+    }
     read_sysreg(sre, ICC_SRE_EL1);
     write_sysreg(ICC_SRE_EL1, sre | gic_context->sre_el1);
 }
@@ -91,6 +114,24 @@ u64 gic_create_lr(u32 pirq, u32 virq)
     return LR_STATE(LR_PENDING) | LR_HW | LR_GROUP(1) | LR_PINTID(pirq) | LR_VINTID(virq);
 }
 
+/* 纯软件的虚拟中断（虚拟SGI等），没有对应的物理中断需要deactivate */
+u64 gic_create_sw_lr(u32 virq)
+{
+    return LR_STATE(LR_PENDING) | LR_GROUP(1) | LR_VINTID(virq);
+}
+
+/* 向逻辑cpu发送SGI, Aff0按16个一组用RS选择 */
+void gic_send_sgi(int cpu, u32 sgi)
+{
+    u64 mpidr = gic_rdists[cpu].mpidr;
+    u64 val = (MPIDR_AFF3(mpidr) << 48) | (MPIDR_AFF2(mpidr) << 32) |
+              ((MPIDR_AFF0(mpidr) >> 4) << 44) | (MPIDR_AFF1(mpidr) << 16) |
+              ((u64)(sgi & 0xf) << 24) | (1UL << (MPIDR_AFF0(mpidr) & 0xf));
+    dsb(ishst);
+    write_sysreg(ICC_SGI1R_EL1, val);
+    isb();
+}
+
 /* 读取GICD_CTLR寄存器的bit[31]，确认GICD_CTLR寄存器写入是否有效*/
 static inline void gic_dist_wait_for_rwp(void)
 {
@@ -140,6 +181,52 @@ static void gic_dist_init(void)
     gic_dist_wait_for_rwp();
 }
 
+/*
+ * Walk the redistributor frames until GICR_TYPER.Last and give every core a
+ * logical id: the boot core is 0, the others follow in frame order. Cores
+ * beyond NCPU are left offline.
+ */
+void gic_rdist_probe(void)
+{
+    u64 boot = mpidr_affinity();
+    bool found = false;
+    u64 frame = GICR_BASE;
+    int nr_frames = 0;
+
+    nr_pcpus = 1;
+    while(frame < GICR_BASE + GICR_SIZE) {
+        u64 typer = *(volatile u64 *)(frame + GICR_TYPER);
+        u64 aff   = GICR_TYPER_AFF(typer);
+        u64 mpidr = ((aff >> 24) << 32) | (aff & 0xffffff);
+        int cpu   = -1;
+
+        nr_frames++;
+        if(mpidr == boot) {
+            cpu = 0;
+            found = true;
+        } else if(nr_pcpus < NCPU) {
+            cpu = nr_pcpus++;
+        } else {
+            LOG_WARN("Redistributor of mpidr 0x%x beyond NCPU %d, core left offline\n", mpidr, NCPU);
+        }
+        if(cpu >= 0) {
+            gic_rdists[cpu].base  = frame;
+            gic_rdists[cpu].mpidr = mpidr;
+        }
+
+        if(typer & GICR_TYPER_LAST) {
+            break;
+        }
+        /* GICv4 adds the VLPI and reserved frames */
+        frame += (typer & GICR_TYPER_VLPIS) ? 2 * GICR_STRIDE : GICR_STRIDE;
+    }
+
+    if(!found) {
+        abort("No redistributor for the boot core 0x%x", boot);
+    }
+    LOG_INFO("%d redistributors, %d pcpus used\n", nr_frames, nr_pcpus);
+}
+
 /* 初始化Redistributor GICR_* */
 static void gic_redist_init(void)
 {
@@ -219,11 +306,14 @@ static void gic_hyp_init(void)
     /* Virtual Group 1 interrupts are enabled. */
     write_sysreg(ICH_VMCR_EL2, (1<<1));
     /* Virtual CPU interface operation enabled. */
-    write_sysreg(ICH_HCR_EL2, (1<<0));
+    write_sysreg(ICH_HCR_EL2, ICH_HCR_EN);
     /* The number of implemented List registers - 1 */
     read_sysreg(vtr, ICH_VTR_EL2);
     gic_max_lrs = ((vtr & 0x1F) + 1);
 
+    /* LR underflow maintenance interrupt, used when virqs are waiting for a free LR */
+    gicv3_ops.unmask(GIC_MAINT_IRQ);
+
     return;
 }
 
@@ -306,11 +396,9 @@ static void gic_hyp_eoi(u32 irq)
 }
 
 // 设置irq被路由到哪个(Processing Element)。通过target来设置
+/* Route a SPI to logical cpu target, affinity routing is always on for QEMU GICv3 */
 static void gic_set_target(u32 irq, u32 target)
 {
-    u32 reg;
-    int cpu = coreid();
-
     if(irq < GIC_MIN_SPI0) {
         return;
     }
@@ -320,10 +408,12 @@ static void gic_set_target(u32 irq, u32 target)
         return;
     }
 
-    reg = GICD_READ32(GICD_ITARGETSR(irq / 4));
-    reg &= ((u32)0xFF << (irq % 4 * 8));
-    GICD_WRITE32(GICD_ITARGETSR(irq / 4), reg | (target << (irq % 4 * 8)));
+    if(target >= (u32)nr_pcpus) {
+        LOG_WARN("irq %d: no pcpu %d to route to\n", irq, target);
+        return;
+    }
 
+    *(volatile u64 *)(u64)(GICD_BASE + GICD_IROUTER(irq)) = gic_rdists[target].mpidr;
 }
 
 /* 
@@ -373,6 +463,9 @@ struct gic_irq_ops gicv3_ops =  {
 
 void gic_v3_init(void)
 {
+    /* 逻辑cpu号到redistributor和affinity的映射, 之后才能访问GICR */
+    gic_rdist_probe();
+
     /* 使能distributor */ 
     gic_dist_init();
 
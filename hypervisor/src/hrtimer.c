@@ -0,0 +1,245 @@
+#include <types.h>
+#include <arch.h>
+#include <layout.h>
+#include <spinlock.h>
+#include <gicv3.h>
+#include <list.h>
+#include <hrtimer.h>
+#include <xlog.h>
+
+#define HRTIMER_NEVER   (~0UL)
+
+/* Per-pcpu timer wheel */
+struct hrtimer_base {
+    spinlock_t       lock;
+    u64              clk;           /* first tick not completely processed */
+    u64              next_expiry;   /* what CNTHP is programmed for */
+    u64              pending[HRTIMER_WHEEL_SIZE / 64];   /* non-empty slots */
+    struct list_head wheel[HRTIMER_WHEEL_SIZE];
+};
+
+static struct hrtimer_base hrtimer_bases[NCPU];
+
+u64 hrtimer_freq;
+
+static inline u64 hrtimer_tick(u64 cnt)
+{
+    return cnt >> HRTIMER_TICK_SHIFT;
+}
+
+static void hrtimer_program(struct hrtimer_base *base, u64 expires)
+{
+    base->next_expiry = expires;
+    if(expires == HRTIMER_NEVER) {
+        write_sysreg(cnthp_ctl_el2, 0);
+    } else {
+        write_sysreg(cnthp_cval_el2, expires);
+        write_sysreg(cnthp_ctl_el2, CNTHP_CTL_ENABLE);
+    }
+    isb();
+}
+
+static void __hrtimer_enqueue(struct hrtimer_base *base, struct hrtimer *timer)
+{
+    u64 tick = hrtimer_tick(timer->expires);
+
+    /* already overdue, make sure the next scan sees it */
+    if(tick < base->clk) {
+        tick = base->clk;
+    }
+
+    int idx = tick & HRTIMER_WHEEL_MASK;
+    timer->slot = idx;
+    list_add_tail(&timer->entry, &base->wheel[idx]);
+    base->pending[idx / 64] |= 1UL << (idx % 64);
+}
+
+static void __hrtimer_dequeue(struct hrtimer_base *base, struct hrtimer *timer)
+{
+    int idx = timer->slot;
+
+    list_del(&timer->entry);
+    timer->cpu = -1;
+
+    if(list_empty(&base->wheel[idx])) {
+        base->pending[idx / 64] &= ~(1UL << (idx % 64));
+    }
+}
+
+static inline bool hrtimer_slot_pending(struct hrtimer_base *base, int idx)
+{
+    return (base->pending[idx / 64] >> (idx % 64)) & 0x1;
+}
+
+/*
+ * Earliest expiry on the wheel. Walking forward from clk, the first slot that
+ * holds a timer due in the current round has the minimum; timers parked for
+ * later rounds are only considered if the whole round is empty.
+ */
+static u64 hrtimer_next_expiry(struct hrtimer_base *base)
+{
+    u64 min = HRTIMER_NEVER;
+    int start = base->clk & HRTIMER_WHEEL_MASK;
+    struct list_head *pos;
+
+    for(int dist = 0; dist < HRTIMER_WHEEL_SIZE; dist++) {
+        int idx = (start + dist) & HRTIMER_WHEEL_MASK;
+
+        /* skip empty bitmap words in one go */
+        if(idx % 64 == 0 && base->pending[idx / 64] == 0) {
+            dist += 63;
+            continue;
+        }
+        if(!hrtimer_slot_pending(base, idx)) {
+            continue;
+        }
+
+        list_for_each(pos, &base->wheel[idx]) {
+            struct hrtimer *t = list_entry(pos, struct hrtimer, entry);
+            if(hrtimer_tick(t->expires) <= base->clk + dist && t->expires < min) {
+                min = t->expires;
+            }
+        }
+        if(min != HRTIMER_NEVER) {
+            return min;
+        }
+    }
+
+    /* nothing due within one round */
+    for(int idx = 0; idx < HRTIMER_WHEEL_SIZE; idx++) {
+        list_for_each(pos, &base->wheel[idx]) {
+            struct hrtimer *t = list_entry(pos, struct hrtimer, entry);
+            if(t->expires < min) {
+                min = t->expires;
+            }
+        }
+    }
+    return min;
+}
+
+void hrtimer_init(struct hrtimer *timer, void (*function)(struct hrtimer *), void *data)
+{
+    list_init(&timer->entry);
+    timer->expires  = 0;
+    timer->function = function;
+    timer->data     = data;
+    timer->cpu      = -1;
+    timer->slot     = 0;
+}
+
+/* Arm the timer on the current pcpu, re-arming it if it was already queued. O(1). */
+void hrtimer_start(struct hrtimer *timer, u64 expires)
+{
+    u64 daif = irq_save();
+
+    hrtimer_cancel(timer);
+
+    int cpu = coreid();
+    struct hrtimer_base *base = &hrtimer_bases[cpu];
+
+    arch_spin_lock(&base->lock);
+
+    timer->expires = expires;
+    timer->cpu     = cpu;
+    __hrtimer_enqueue(base, timer);
+
+    if(expires < base->next_expiry) {
+        hrtimer_program(base, expires);
+    }
+
+    arch_spin_unlock(&base->lock);
+    irq_restore(daif);
+}
+
+/*
+ * O(1): CNTHP is not reprogrammed, cancelling the earliest timer only costs
+ * one spurious interrupt that finds nothing due.
+ */
+void hrtimer_cancel(struct hrtimer *timer)
+{
+    int cpu = timer->cpu;
+    if(cpu < 0) {
+        return;
+    }
+
+    struct hrtimer_base *base = &hrtimer_bases[cpu];
+    u64 daif = irq_save();
+
+    arch_spin_lock(&base->lock);
+    if(timer->cpu == cpu) {
+        __hrtimer_dequeue(base, timer);
+    }
+    arch_spin_unlock(&base->lock);
+    irq_restore(daif);
+}
+
+/* Dequeue one timer due at now, scanning every tick since the last run, one round at most */
+static struct hrtimer *hrtimer_pop_expired(struct hrtimer_base *base, u64 now)
+{
+    u64 now_tick = hrtimer_tick(now);
+    u64 tick = base->clk;
+    struct list_head *pos;
+
+    if(now_tick - tick >= HRTIMER_WHEEL_SIZE) {
+        tick = now_tick - HRTIMER_WHEEL_SIZE + 1;
+    }
+
+    for(; tick <= now_tick; tick++) {
+        int idx = tick & HRTIMER_WHEEL_MASK;
+        if(!hrtimer_slot_pending(base, idx)) {
+            continue;
+        }
+        list_for_each(pos, &base->wheel[idx]) {
+            struct hrtimer *t = list_entry(pos, struct hrtimer, entry);
+            if(t->expires <= now) {
+                __hrtimer_dequeue(base, t);
+                base->clk = tick;
+                return t;
+            }
+        }
+    }
+
+    /* the current tick may still hold timers due later in it */
+    base->clk = now_tick;
+    return NULL;
+}
+
+void hrtimer_irq_handler(void)
+{
+    struct hrtimer_base *base = &hrtimer_bases[coreid()];
+    struct hrtimer *timer;
+
+    arch_spin_lock(&base->lock);
+
+    u64 now = hrtimer_now();
+    while((timer = hrtimer_pop_expired(base, now)) != NULL) {
+        /* the callback may re-arm or cancel timers, so run it unlocked */
+        arch_spin_unlock(&base->lock);
+        timer->function(timer);
+        arch_spin_lock(&base->lock);
+    }
+
+    hrtimer_program(base, hrtimer_next_expiry(base));
+    arch_spin_unlock(&base->lock);
+}
+
+void hrtimer_percpu_init(void)
+{
+    struct hrtimer_base *base = &hrtimer_bases[coreid()];
+
+    read_sysreg(hrtimer_freq, cntfrq_el0);
+
+    arch_spinlock_init(&base->lock);
+    for(int i = 0; i < HRTIMER_WHEEL_SIZE; i++) {
+        list_init(&base->wheel[i]);
+    }
+    for(int i = 0; i < HRTIMER_WHEEL_SIZE / 64; i++) {
+        base->pending[i] = 0;
+    }
+    base->clk = hrtimer_tick(hrtimer_now());
+
+    /* tickless: CNTHP only runs while a timer is armed */
+    hrtimer_program(base, HRTIMER_NEVER);
+    /* CNTHP interrupt is owned by the hypervisor */
+    gicv3_ops.unmask(HYP_TIMER_IRQ);
+}
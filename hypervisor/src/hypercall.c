@@ -0,0 +1,45 @@
+#include <types.h>
+#include <vcpu.h>
+#include <vm.h>
+#include <vpsci.h>
+#include <sched.h>
+#include <hypercall.h>
+#include <exitstat.h>
+#include <xlog.h>
+
+/*
+ * A guest spinning on a lock tells us who holds it. If the holder is
+ * preempted it runs right away on this pcpu, otherwise the caller just
+ * goes to the back of the run queue.
+ */
+static u64 hc_yield_to(struct vcpu *vcpu, u64 target)
+{
+    struct vcpu *to = NULL;
+
+    if(target != XHYPER_YIELD_ANY) {
+        if(target >= (u64)vcpu->vm->nvcpu) {
+            return (u64)(s64)PSCI_RET_INVALID_PARAMS;
+        }
+        to = vcpu->vm->vcpus[target];
+        if(to == vcpu) {
+            return PSCI_RET_SUCCESS;
+        }
+    }
+
+    sched_yield(vcpu, to);
+    return PSCI_RET_SUCCESS;
+}
+
+u64 hypercall_handler(struct vcpu *vcpu, u64 funid, u64 arg0, u64 arg1)
+{
+    switch(funid) {
+        case XHYPER_HC_YIELD_TO:
+            return hc_yield_to(vcpu, arg0);
+        case XHYPER_HC_EXIT_STAT:
+            /* the guest's own counters, see exitstat.h for the reasons and fields */
+            return exit_stat_query(vcpu, arg0, arg1);
+        default:
+            LOG_WARN_RATELIMITED("Unknown hypercall %p from vcpu %d\n", funid, vcpu->cpuid);
+            return (u64)(s64)PSCI_RET_NOT_SUPPORTED;
+    }
+}
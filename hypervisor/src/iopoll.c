@@ -0,0 +1,75 @@
+#define XLOG_SUBSYS XLOG_VIRTIO
+
+#include <types.h>
+#include <arch.h>
+#include <vcpu.h>
+#include <gicv3.h>
+#include <sched.h>
+#include <logbuf.h>
+#include <printf.h>
+#include <xlog.h>
+#include <virtio.h>
+#include <iopoll.h>
+
+/*
+ * I/O polling pcpu. Set up before the vms are created, the scheduler then
+ * never queues a vcpu on it, and sched_start() hands it to iopoll_run().
+ * The transport switches to polling once the poller runs: until then, or
+ * if the pcpu never comes up, the queues work on notifications.
+ */
+
+static int iopoll_cpu = -1;
+static volatile bool iopoll_running;
+
+static u64 iopoll_passes;
+static u64 iopoll_busy;         /* passes that found work */
+
+/* Reserve cpu for polling, -1 keeps every pcpu for vcpus */
+int iopoll_set_cpu(int cpu)
+{
+    if(cpu < 0) {
+        return 0;
+    }
+    if(cpu >= nr_pcpus || nr_pcpus < 2 || pcpus[cpu].policy != SCHED_POLICY_FAIR) {
+        LOG_WARN("pcpu %d cannot be the I/O polling pcpu\n", cpu);
+        return -1;
+    }
+
+    pcpus[cpu].policy = SCHED_POLICY_IOPOLL;
+    iopoll_cpu = cpu;
+    return 0;
+}
+
+bool iopoll_active(void)
+{
+    return iopoll_running;
+}
+
+void iopoll_run(void)
+{
+    LOG_INFO("pcpu %d: polling the virtqueues of all vms\n", coreid());
+    iopoll_running = true;
+    dmb(ish);
+
+    while(1) {
+        iopoll_passes++;
+        if(virtio_poll() > 0) {
+            iopoll_busy++;
+        } else {
+            /* nothing to do, the uart is the next best thing */
+            logbuf_drain();
+        }
+        /* timers and SGIs */
+        irq_enable;
+        isb();
+        irq_disable;
+    }
+}
+
+void iopoll_dump(void)
+{
+    if(iopoll_cpu >= 0) {
+        printf("  iopoll: pcpu %d %s, %d passes, %d busy\n", iopoll_cpu,
+               iopoll_running ? "polling" : "not started", (u32)iopoll_passes, (u32)iopoll_busy);
+    }
+}
@@ -1,3 +1,5 @@
+#define XLOG_SUBSYS XLOG_MM
+
 #include <stddef.h>
 #include "types.h"
 #include "utils.h"
@@ -21,6 +23,7 @@ void *alloc_one_page()
     struct header *page = pages.freelist;
 
     if(page == NULL) {
+        arch_spin_unlock(&pages.lock);
         return NULL;
     }
 
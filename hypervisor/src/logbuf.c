@@ -0,0 +1,212 @@
+#include <types.h>
+#include <arch.h>
+#include <layout.h>
+#include <spinlock.h>
+#include <pl011.h>
+#include <logbuf.h>
+#include <virtio_console.h>
+
+struct logbuf {
+    char line[LOGBUF_LINE_MAX];     /* line being formatted */
+    int  line_len;
+    bool async;
+
+    /* single producer (the owner pcpu), single consumer (whoever holds uart_lock) */
+    char ring[LOGBUF_SIZE];
+    volatile u32 head;
+    volatile u32 tail;
+    volatile u32 dropped;           /* lines lost because the ring was full */
+};
+
+static struct logbuf logbufs[NCPU];
+
+/* Serializes uart output, a line is never interleaved with another one */
+static spinlock_t uart_lock = {.coreid = -1, .lock = 0, .name = "uart_lock"};
+/* pcpu whose ring is drained in the middle of a line, -1 if none */
+static int drain_cpu = -1;
+static volatile bool log_panic;
+
+static void logbuf_write_sync(const char *s, int len)
+{
+    for(int i = 0; i < len; i++) {
+        pl011_putc(s[i]);
+    }
+}
+
+/*
+ * Push ring bytes of a pcpu to the uart until it ends a line or the tx fifo
+ * is full, uart_lock held. Returns true if the line was completed.
+ */
+static bool logbuf_drain_line(struct logbuf *lb, bool wait)
+{
+    u32 tail = lb->tail;
+    u32 head = lb->head;
+    asm volatile("dmb ishld" ::: "memory");
+
+    /* a guest console line left open is ended first */
+    if(tail != head) {
+        vconsole_break_line();
+    }
+
+    while(tail != head) {
+        char c = lb->ring[tail % LOGBUF_SIZE];
+        if(wait) {
+            pl011_putc(c);
+        } else if(!pl011_try_putc(c)) {
+            break;
+        }
+        tail++;
+        if(c == '\n') {
+            lb->tail = tail;
+            return true;
+        }
+    }
+    lb->tail = tail;
+    return tail == head;
+}
+
+static void logbuf_drain_locked(bool wait)
+{
+    /* finish the line that was cut short last time first */
+    if(drain_cpu >= 0) {
+        if(!logbuf_drain_line(&logbufs[drain_cpu], wait)) {
+            return;
+        }
+        drain_cpu = -1;
+    }
+
+    for(int cpu = 0; cpu < NCPU; cpu++) {
+        struct logbuf *lb = &logbufs[cpu];
+
+        if(lb->dropped != 0) {
+            lb->dropped = 0;
+            /* rare, no need to be non-blocking */
+            logbuf_write_sync("[logbuf: lines dropped]\n", 24);
+        }
+
+        while(lb->tail != lb->head) {
+            if(!logbuf_drain_line(lb, wait)) {
+                drain_cpu = cpu;
+                return;
+            }
+        }
+    }
+
+    /* then the guests' virtio consoles */
+    vconsole_drain_locked(wait);
+}
+
+static bool logbuf_pending(void)
+{
+    for(int cpu = 0; cpu < NCPU; cpu++) {
+        if(logbufs[cpu].tail != logbufs[cpu].head) {
+            return true;
+        }
+    }
+    return vconsole_pending();
+}
+
+/*
+ * Non-blocking, stops as soon as the uart fifo is full or another pcpu is
+ * draining. Returns whether anything is left.
+ */
+bool logbuf_drain(void)
+{
+    if(log_panic || !arch_spin_trylock(&uart_lock)) {
+        return logbuf_pending();
+    }
+    logbuf_drain_locked(false);
+    arch_spin_unlock(&uart_lock);
+    return logbuf_pending();
+}
+
+/* Blocking, everything buffered is on the uart when it returns */
+void logbuf_flush(void)
+{
+    if(log_panic) {
+        return;
+    }
+    arch_spin_lock(&uart_lock);
+    logbuf_drain_locked(true);
+    arch_spin_unlock(&uart_lock);
+}
+
+static void logbuf_commit(struct logbuf *lb)
+{
+    int len = lb->line_len;
+    lb->line_len = 0;
+
+    if(log_panic) {
+        logbuf_write_sync(lb->line, len);
+        return;
+    }
+
+    if(!lb->async) {
+        /* keep the order with what this pcpu buffered before */
+        arch_spin_lock(&uart_lock);
+        logbuf_drain_locked(true);
+        vconsole_break_line();
+        logbuf_write_sync(lb->line, len);
+        arch_spin_unlock(&uart_lock);
+        return;
+    }
+
+    u32 head = lb->head;
+    if(LOGBUF_SIZE - (head - lb->tail) < (u32)len) {
+        lb->dropped++;
+        return;
+    }
+    for(int i = 0; i < len; i++) {
+        lb->ring[(head + i) % LOGBUF_SIZE] = lb->line[i];
+    }
+    /* the drainer sees head only after the bytes */
+    asm volatile("dmb ishst" ::: "memory");
+    lb->head = head + len;
+
+    /* filling up faster than idle pcpus drain it, push out what the fifo takes */
+    if(head + len - lb->tail > LOGBUF_SIZE / 2) {
+        logbuf_drain();
+    }
+}
+
+/* Called by printf() with the IRQ masked */
+void logbuf_putc(char c)
+{
+    struct logbuf *lb = &logbufs[coreid()];
+
+    lb->line[lb->line_len++] = c;
+    if(c == '\n') {
+        logbuf_commit(lb);
+    } else if(lb->line_len == LOGBUF_LINE_MAX - 1) {
+        /* overlong line, break it */
+        lb->line[lb->line_len++] = '\n';
+        logbuf_commit(lb);
+    }
+}
+
+/* Lines of this pcpu go to its ring from now on, set once it runs vcpus. Returns the old mode */
+bool logbuf_set_async(bool async)
+{
+    bool old = logbufs[coreid()].async;
+    logbufs[coreid()].async = async;
+    return old;
+}
+
+/*
+ * Synchronous from now on, flush what every pcpu buffered. Locks are ignored,
+ * the pcpu holding uart_lock may be the one that panicked.
+ */
+void logbuf_panic(void)
+{
+    log_panic = true;
+    drain_cpu = -1;
+    for(int cpu = 0; cpu < NCPU; cpu++) {
+        while(logbufs[cpu].tail != logbufs[cpu].head) {
+            logbuf_drain_line(&logbufs[cpu], true);
+        }
+    }
+    /* and the half formatted line of this pcpu */
+    struct logbuf *lb = &logbufs[coreid()];
+    logbuf_write_sync(lb->line, lb->line_len);
+    lb->line_len = 0;
+}
@@ -8,6 +8,17 @@
 #include <guest.h>
 #include <vm.h>
 #include <gicv3.h>
+#include <hrtimer.h>
+#include <vtimer.h>
+#include <vcpu.h>
+#include <vpsci.h>
+#include <sched.h>
+#include <trace.h>
+#include <cpufeature.h>
+#include <vgicv3.h>
+#include <trap.h>
+#include <iopoll.h>
+#include <partition.h>
 
 __attribute__((aligned(SZ_4K))) char sp_stack[SZ_4K * NCPU] = {0};
 
@@ -25,42 +36,77 @@ extern void test_create_vm_mapping(void);
 extern guest_t guest_vm_image;
 extern guest_t guest_virt_dtb;
 extern guest_t guest_rootfs;
+extern void _start_secondary();
 
-int hyper_init_secondary()
+/* cpu is the logical id handed over through the PSCI CPU_ON context id */
+int hyper_init_secondary(int cpu)
 {
+    pcpu_percpu_init(cpu);
     LOG_INFO("core %d is activated\n", coreid());
 
+    cpufeature_percpu_check();
+
     gic_percpu_init();
+    trace_percpu_init();
+    hrtimer_percpu_init();
+    vtimer_percpu_init();
+    sched_percpu_init();
     irq_enable;
     stage2_mmu_init();
     hyper_setup();
-    start_vcpu();
+    sched_start();
     
     return 0;
 }
 
+/* All pcpus run the scheduler, bring the secondaries up once the vcpus exist */
+static void start_secondary_cpus(void)
+{
+    for(int cpu = 1; cpu < nr_pcpus; cpu++) {
+        int ret = (int)smc_call(PSCI_SYSTEM_CPUON, gic_rdists[cpu].mpidr, (u64)_start_secondary, cpu);
+        if(ret != PSCI_RET_SUCCESS) {
+            LOG_WARN("Unable to power on pcpu %d: %d\n", cpu, ret);
+        }
+    }
+}
+
 
 int hyper_init_primary()
 {
+    /* the boot core is logical cpu 0, tpidr_el2 -> pcpus[0] before anything takes a lock */
+    pcpu_percpu_init(0);
+
     /* uart init */
     pl011_init();
     print_logo();
 
+    /* everything below may pick its code path from the features */
+    cpufeature_init();
+
     /* xmalloc init */
     xmalloc_init();
     /* kalloc init */
     kalloc_init();
 
+    pcpu_init();
+    vcpu_init();
+    LOG_INFO("Pcpu/vcpu arrays have been initialized\n");
+
     /* gicv3 init */
     gic_v3_init();
+    trace_percpu_init();
+    hrtimer_percpu_init();
+    vtimer_percpu_init();
+    sched_percpu_init();
     irq_enable;
     
     stage2_mmu_init();
     hyper_setup();
 
-    pcpu_init();
-    vcpu_init();
-    LOG_INFO("Pcpu/vcpu arrays have been initialized\n");
+    /* exit handlers, per exception class and trapped system register */
+    el1_sync_init();
+    sched_trap_init();
+    vgic_trap_init();
 
     vm_config_t guest_vm_cfg = {
         .guest_image  = &guest_vm_image,
@@ -71,11 +117,39 @@ int hyper_init_primary()
         .rootfs_addr  = 0x84000000,  /* rootfs ipa */
         .ram_size     = 0x8000000,   /* 128M */
         .ncpu         = 2,
+        /* the guest's console= has to be hvc0 with this */
+        .virtio_console = false,
+        /* /dev/vda, the initramfs image shared copy-on-write: cpio -t < /dev/vda */
+        .virtio_blk      = &guest_rootfs,
+        .virtio_blk_size = 0,
+        /* only useful with a second vm on the switch, see bench_net_run() of the guest */
+        .virtio_net      = false,
+    };
+
+    /*
+     * ARINC-653 style cyclic schedules, one entry per partitioned pcpu. The
+     * windows name vms by their index in vms[] below, -1 leaves the pcpu
+     * idle, e.g. { .cpu = 1, .nr_windows = 2, .windows = {{0, 5000}, {-1, 5000}} }.
+     * The other pcpus keep the fair scheduler.
+     */
+    static const struct partition_config partition_cfg[] = {
+    };
+
+    /* -1, or a pcpu that only busy polls the virtqueues of all vms, before the vms exist */
+    iopoll_set_cpu(-1);
+
+    vm_t *vms[] = {
+        create_guest_vm(&guest_vm_cfg),
     };
 
-    create_guest_vm(&guest_vm_cfg);
+    /* before any pcpu enters the scheduler */
+    if(partition_configure(partition_cfg, sizeof(partition_cfg) / sizeof(partition_cfg[0]),
+                           vms, sizeof(vms) / sizeof(vms[0])) != 0) {
+        abort("Bad partition schedule in the boot configuration");
+    }
 
-    start_vcpu();
+    start_secondary_cpus();
+    sched_start();
 
     while(1) {}
 
@@ -0,0 +1,159 @@
+#define XLOG_SUBSYS XLOG_SCHED
+
+#include <types.h>
+#include <arch.h>
+#include <layout.h>
+#include <hrtimer.h>
+#include <vcpu.h>
+#include <vm.h>
+#include <sched.h>
+#include <partition.h>
+#include <xlog.h>
+
+/*
+ * Switch to a cyclic schedule on cpu. Must be called before the scheduler is
+ * started on that pcpu; the vcpus of the vms listed only run in their windows
+ * and only on partitioned pcpus from then on.
+ */
+int partition_set_schedule(int cpu, const struct partition_window *windows, int nr)
+{
+    if(cpu < 0 || cpu >= nr_pcpus || nr <= 0 || nr > PARTITION_MAX_WINDOWS) {
+        LOG_WARN("Invalid partition schedule for pcpu %d\n", cpu);
+        return -1;
+    }
+
+    pcpu_t *pcpu = &pcpus[cpu];
+    struct partition_sched *ps = &pcpu->part;
+
+    /* already partitioned, or the I/O polling pcpu */
+    if(pcpu->policy != SCHED_POLICY_FAIR) {
+        LOG_WARN("pcpu %d is not a fair pcpu, it can't be partitioned\n", cpu);
+        return -1;
+    }
+
+    /* nothing is changed unless the whole table is good */
+    for(int i = 0; i < nr; i++) {
+        if(windows[i].duration_us == 0) {
+            LOG_WARN("Partition window %d of pcpu %d is empty\n", i, cpu);
+            return -1;
+        }
+    }
+
+    for(int i = 0; i < nr; i++) {
+        ps->windows[i] = windows[i];
+        if(windows[i].vm != NULL) {
+            windows[i].vm->partition_cpus |= 1UL << cpu;
+        }
+    }
+    ps->nr_windows = nr;
+    ps->cur        = 0;
+    ps->cpu        = cpu;
+    pcpu->policy   = SCHED_POLICY_PARTITION;
+
+    /* vcpu 0 was made runnable when its vm was created */
+    for(int i = 0; i < nr; i++) {
+        struct vm *vm = windows[i].vm;
+        for(int v = 0; vm != NULL && v < vm->nvcpu; v++) {
+            sched_rehome(vm->vcpus[v]);
+        }
+    }
+
+    return 0;
+}
+
+/* The schedules of the boot configuration, returns -1 if one of them was rejected */
+int partition_configure(const struct partition_config *cfg, int nr, struct vm **vms, int nvms)
+{
+    struct partition_window windows[PARTITION_MAX_WINDOWS];
+    int ret = 0;
+
+    for(int c = 0; c < nr; c++) {
+        int nw = cfg[c].nr_windows;
+        bool bad = nw <= 0 || nw > PARTITION_MAX_WINDOWS;
+
+        for(int i = 0; !bad && i < nw; i++) {
+            int vm = cfg[c].windows[i].vm;
+            if(vm < -1 || vm >= nvms) {
+                LOG_ERR("pcpu %d: partition window %d names vm %d, only %d vms\n", cfg[c].cpu, i, vm, nvms);
+                bad = true;
+                break;
+            }
+            windows[i].vm          = vm < 0 ? NULL : vms[vm];
+            windows[i].duration_us = cfg[c].windows[i].duration_us;
+        }
+
+        if(bad || partition_set_schedule(cfg[c].cpu, windows, nw) != 0) {
+            LOG_ERR("pcpu %d: partition schedule rejected\n", cfg[c].cpu);
+            ret = -1;
+        }
+    }
+    return ret;
+}
+
+static void partition_account(struct partition_sched *ps, u64 jitter)
+{
+    if(ps->nr_switches == 0 || jitter < ps->jitter_min) {
+        ps->jitter_min = jitter;
+    }
+    if(jitter > ps->jitter_max) {
+        ps->jitter_max = jitter;
+    }
+    ps->jitter_sum += jitter;
+    ps->nr_switches++;
+}
+
+/* CNTHP fired at a window boundary */
+static void partition_switch(struct hrtimer *timer)
+{
+    struct partition_sched *ps = timer->data;
+    u64 now = hrtimer_now();
+
+    partition_account(ps, now - ps->next_switch);
+
+    do {
+        ps->cur = (ps->cur + 1) % ps->nr_windows;
+        if(ps->cur == 0) {
+            ps->frames++;
+            if(ps->frames % PARTITION_REPORT_FRAMES == 0) {
+                partition_report(ps);
+            }
+        }
+        ps->next_switch += hrtimer_us_to_cnt(ps->windows[ps->cur].duration_us);
+        /* too late for a whole window, skip it rather than running it short */
+        if(ps->next_switch <= now) {
+            ps->overruns++;
+        }
+    } while(ps->next_switch <= now);
+
+    hrtimer_start(&ps->timer, ps->next_switch);
+    pcpus[ps->cpu].need_resched = true;
+}
+
+/* Start the major frame on the current pcpu */
+void partition_start(struct partition_sched *ps)
+{
+    ps->frames      = 0;
+    ps->nr_switches = 0;
+    ps->overruns    = 0;
+    ps->jitter_min  = 0;
+    ps->jitter_max  = 0;
+    ps->jitter_sum  = 0;
+
+    ps->cur         = 0;
+    ps->next_switch = hrtimer_now() + hrtimer_us_to_cnt(ps->windows[0].duration_us);
+
+    hrtimer_init(&ps->timer, partition_switch, ps);
+    hrtimer_start(&ps->timer, ps->next_switch);
+
+    LOG_INFO("pcpu %d: cyclic schedule with %d windows\n", ps->cpu, ps->nr_windows);
+}
+
+void partition_report(struct partition_sched *ps)
+{
+    u64 avg = ps->nr_switches ? ps->jitter_sum / ps->nr_switches : 0;
+
+    LOG_INFO("pcpu %d: %d frames, %d switches, %d overruns, jitter min %d max %d avg %d ns\n",
+             ps->cpu, (u32)ps->frames, (u32)ps->nr_switches, (u32)ps->overruns,
+             (u32)hrtimer_cnt_to_ns(ps->jitter_min), (u32)hrtimer_cnt_to_ns(ps->jitter_max),
+             (u32)hrtimer_cnt_to_ns(avg));
+}
@@ -1,6 +1,7 @@
 
 #include <pl011.h>
 #include <layout.h>
+#include <console.h>
 
 #define REG(reg)    (volatile unsigned int *)(PL011BASE + reg)
 
@@ -37,6 +38,16 @@ void pl011_putc(char c)
     *REG(PL011DR) = c;
 }
 
+/* Non-blocking, false if the transmit fifo is full */
+bool pl011_try_putc(char c)
+{
+    if(*REG(PL011FR) & PL011_FR_TXFF) {
+        return false;
+    }
+    *REG(PL011DR) = c;
+    return true;
+}
+
 void pl011_puts(char *s)
 {
     char c;
@@ -65,7 +76,7 @@ void pl011_irq_handler()
             int c = pl011_getc();
             if(c < 0)
                 break;
-            pl011_putc(c);
+            console_input(c);
         }   
     }
     // Interrupt Clear Register,
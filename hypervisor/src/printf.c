@@ -1,6 +1,8 @@
 #include <pl011.h>
 #include <types.h>
 #include <utils.h>
+#include <arch.h>
+#include <logbuf.h>
 
 #define va_list         __builtin_va_list
 #define va_start(v, l)  __builtin_va_start(v, l)
@@ -8,6 +10,13 @@
 #define va_end(v)       __builtin_va_end(v)
 #define va_copy(d, s)   __builtin_va_copy(d, s)
 
+static void log_puts(const char *s)
+{
+    while(*s) {
+        logbuf_putc(*s++);
+    }
+}
+
 enum printopt {
     PRINT_0X      = 1 << 0,
     ZERO_PADDING  = 1 << 1,
@@ -43,13 +52,13 @@ static void print64(s64 num, int base, bool sign, int digit, enum printopt opt)
     int len = strlen(cur);
     if(digit > 0) {
         while(digit-- > len)
-        pl011_putc(' ');
+        logbuf_putc(' ');
     }
-    pl011_puts(cur);
+    log_puts(cur);
     if(digit < 0) {
         digit = -digit;
         while(digit-- > len)
-            pl011_putc(' ');
+            logbuf_putc(' ');
     }
 }
 
@@ -100,36 +109,39 @@ static int vprintf(const char *fmt, va_list ap)
                 print64((u64)p, 16, false, digit, PRINT_0X);
             break;
                 case 'c':
-                pl011_putc(va_arg(ap, int));
+                logbuf_putc(va_arg(ap, int));
                 break;
             case 's':
                 s = va_arg(ap, char *);
                 if(!s)
                 s = "(null)";
-                pl011_puts(s);
+                log_puts(s);
                 break;
             case '%':
-                pl011_putc('%');
+                logbuf_putc('%');
                 break;
             default:
-                pl011_putc('%');
-                pl011_putc(c);
+                logbuf_putc('%');
+                logbuf_putc(c);
                 break;
             }
         } else {
-            pl011_putc(c);
+            logbuf_putc(c);
         }
     }
 
     return 0;
 }
 
+/* Buffered, see logbuf.h; the IRQ is masked so a line is formatted in one go */
 int printf(const char *fmt, ...)
 {
     va_list ap;
+    u64 daif = irq_save();
     va_start(ap, fmt);
     vprintf(fmt, ap);
     va_end(ap);
+    irq_restore(daif);
     return 0;
 }
 
@@ -137,6 +149,10 @@ void abort(const char *fmt, ...)
 {
     va_list ap;
 
+    irq_disable;
+    /* no buffering from now on, and get out what the other pcpus had queued */
+    logbuf_panic();
+
     va_start(ap, fmt);
     printf("[X-Hyper abort]: ");
     vprintf(fmt, ap);
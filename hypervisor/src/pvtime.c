@@ -0,0 +1,51 @@
+#include <types.h>
+#include <arch.h>
+#include <layout.h>
+#include <kalloc.h>
+#include <vmm.h>
+#include <vm.h>
+#include <vcpu.h>
+#include <vpsci.h>
+#include <hrtimer.h>
+#include <pvtime.h>
+#include <xlog.h>
+
+/* the fast path in vector.S scales the vcpu id by this */
+_Static_assert(sizeof(struct pvtime_stolen) == 1 << PVTIME_STOLEN_SHIFT, "pvtime_stolen size used by vector.S");
+
+/* Allocate the stolen time page of a vm and map it at PVTIME_IPA */
+void pvtime_init(struct vm *vm)
+{
+    struct pvtime_stolen *st = alloc_one_page();
+    if(st == NULL) {
+        abort("Unable to alloc the pv time page");
+    }
+
+    create_guest_mapping(vm->vttbr, PVTIME_IPA, (u64)st, PAGESIZE, S2PTE_NORMAL | S2PTE_RW);
+    vm->pvtime = st;
+}
+
+u64 pvtime_handler(struct vcpu *vcpu, u64 funid, u64 arg)
+{
+    switch(funid) {
+        case PV_TIME_FEATURES:
+            return (arg == PV_TIME_FEATURES || arg == PV_TIME_ST) ? PSCI_RET_SUCCESS : (u64)PSCI_RET_NOT_SUPPORTED;
+        case PV_TIME_ST:
+            /* the structure of the calling vcpu */
+            return PVTIME_IPA + vcpu->cpuid * sizeof(struct pvtime_stolen);
+        default:
+            return (u64)PSCI_RET_NOT_SUPPORTED;
+    }
+}
+
+/*
+ * Called at every schedule-in. The guest sees the page through a
+ * non-cacheable stage 2 mapping, so a plain 64-bit store is coherent and
+ * single-copy atomic for it.
+ */
+void pvtime_update(struct vcpu *vcpu)
+{
+    struct pvtime_stolen *st = &vcpu->vm->pvtime[vcpu->cpuid];
+
+    *(volatile u64 *)&st->stolen_time = hrtimer_cnt_to_ns(vcpu->steal);
+}
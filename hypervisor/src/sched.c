@@ -0,0 +1,703 @@
+#define XLOG_SUBSYS XLOG_SCHED
+
+#include <types.h>
+#include <arch.h>
+#include <layout.h>
+#include <spinlock.h>
+#include <list.h>
+#include <gicv3.h>
+#include <hrtimer.h>
+#include <vcpu.h>
+#include <vgicv3.h>
+#include <sched.h>
+#include <partition.h>
+#include <trace.h>
+#include <logbuf.h>
+#include <xlog.h>
+#include <exitstat.h>
+#include <trap.h>
+#include <iopoll.h>
+
+/*
+ * vcpu scheduler. Every pcpu owns a FIFO run queue of READY vcpus; a pcpu
+ * whose queue runs dry steals the coldest vcpu from the busiest queue, and a
+ * periodic balance timer evens out the queues of pcpus that are busy.
+ *
+ * Gang vms have their vcpus co-scheduled: the first one dispatched pulls its
+ * READY siblings onto their pcpus, and the first one preempted pushes the
+ * running siblings off theirs, so no vcpu spins on a lock held by a
+ * descheduled sibling.
+ *
+ * A pcpu may instead run a static cyclic schedule (partition.c): it then only
+ * runs the vcpus of the vm owning the current time window, and the vcpus of
+ * partitioned vms never leave the partitioned pcpus. The I/O polling pcpu
+ * (iopoll.c) runs no vcpu at all.
+ *
+ * Lock order: vcpu->lock -> rq.lock, at most one rq.lock is held at a time.
+ * Everything runs with the IRQ masked except the idle loop.
+ */
+
+extern void switch_out(void);
+
+static inline bool vcpu_allowed(vcpu_t *vcpu, int cpu)
+{
+    u64 part = vcpu->vm->partition_cpus;
+
+    /* partitioned vms and the others never share a pcpu */
+    if(part != 0 ? (part & (1UL << cpu)) == 0 : pcpus[cpu].policy != SCHED_POLICY_FAIR) {
+        return false;
+    }
+    return vcpu->affinity == 0 || (vcpu->affinity & (1UL << cpu)) != 0;
+}
+
+static inline int pcpu_load(pcpu_t *pcpu)
+{
+    return pcpu->rq.nr_queued + (pcpu->vcpu != NULL);
+}
+
+/* rq.lock held */
+static void rq_enqueue(pcpu_t *pcpu, vcpu_t *vcpu)
+{
+    list_add_tail(&vcpu->rq_entry, &pcpu->rq.queue);
+    pcpu->rq.nr_queued++;
+    vcpu->pcpu = pcpu->cpuid;
+}
+
+/* rq.lock held */
+static void rq_dequeue(pcpu_t *pcpu, vcpu_t *vcpu)
+{
+    list_del(&vcpu->rq_entry);
+    pcpu->rq.nr_queued--;
+}
+
+static void sched_enqueue(pcpu_t *pcpu, vcpu_t *vcpu)
+{
+    arch_spin_lock(&pcpu->rq.lock);
+    rq_enqueue(pcpu, vcpu);
+    arch_spin_unlock(&pcpu->rq.lock);
+}
+
+/*
+ * Queue a vcpu again that was taken off a run queue or just put, unless it
+ * was powered off meanwhile (sched_power_off() only unlinks queued vcpus)
+ * or a CPU_ON already queued it again. Returns whether it was queued.
+ */
+static bool sched_requeue(pcpu_t *pcpu, vcpu_t *vcpu)
+{
+    arch_spin_lock(&vcpu->lock);
+    bool queue = vcpu->state == VCPU_READY && list_empty(&vcpu->rq_entry);
+    if(queue) {
+        sched_enqueue(pcpu, vcpu);
+    }
+    arch_spin_unlock(&vcpu->lock);
+
+    return queue;
+}
+
+/* Pop the head of the local run queue */
+static vcpu_t *sched_pick_local(pcpu_t *pcpu)
+{
+    vcpu_t *vcpu = NULL;
+
+    arch_spin_lock(&pcpu->rq.lock);
+    if(!list_empty(&pcpu->rq.queue)) {
+        vcpu = list_first_entry(&pcpu->rq.queue, vcpu_t, rq_entry);
+        rq_dequeue(pcpu, vcpu);
+    }
+    arch_spin_unlock(&pcpu->rq.lock);
+
+    return vcpu;
+}
+
+/* Take the vcpu allowed on cpu that has been off a pcpu the longest */
+static vcpu_t *sched_steal_from(pcpu_t *from, int cpu)
+{
+    vcpu_t *victim = NULL;
+    struct list_head *pos;
+
+    arch_spin_lock(&from->rq.lock);
+    list_for_each(pos, &from->rq.queue) {
+        vcpu_t *vcpu = list_entry(pos, vcpu_t, rq_entry);
+        if(vcpu_allowed(vcpu, cpu) && (victim == NULL || vcpu->last_ran < victim->last_ran)) {
+            victim = vcpu;
+        }
+    }
+    if(victim != NULL) {
+        rq_dequeue(from, victim);
+    }
+    arch_spin_unlock(&from->rq.lock);
+
+    return victim;
+}
+
+/* Busiest online pcpu other than cpu, NULL if nobody has queued vcpus */
+static pcpu_t *sched_busiest(int cpu)
+{
+    pcpu_t *busiest = NULL;
+
+    for(int i = 0; i < nr_pcpus; i++) {
+        pcpu_t *p = &pcpus[i];
+        if(i == cpu || !p->online || p->rq.nr_queued == 0) {
+            continue;
+        }
+        if(busiest == NULL || pcpu_load(p) > pcpu_load(busiest)) {
+            busiest = p;
+        }
+    }
+    return busiest;
+}
+
+/* Take the vcpu of a gang vm queued here, wherever it is in the queue */
+static vcpu_t *sched_pick_gang(pcpu_t *pcpu, struct vm *vm)
+{
+    vcpu_t *vcpu = NULL;
+    struct list_head *pos;
+
+    arch_spin_lock(&pcpu->rq.lock);
+    list_for_each(pos, &pcpu->rq.queue) {
+        vcpu_t *v = list_entry(pos, vcpu_t, rq_entry);
+        if(v->vm == vm) {
+            vcpu = v;
+            rq_dequeue(pcpu, vcpu);
+            break;
+        }
+    }
+    arch_spin_unlock(&pcpu->rq.lock);
+
+    return vcpu;
+}
+
+static vcpu_t *sched_pick_next(pcpu_t *pcpu)
+{
+    vcpu_t *next;
+
+    /* only the window owner runs, no stealing from the fair pcpus */
+    if(pcpu->policy == SCHED_POLICY_PARTITION) {
+        struct vm *vm = partition_current_vm(&pcpu->part);
+        return vm != NULL ? sched_pick_gang(pcpu, vm) : NULL;
+    }
+
+    struct vm *gang = pcpu->gang_vm;
+    if(gang != NULL) {
+        pcpu->gang_vm = NULL;
+        next = sched_pick_gang(pcpu, gang);
+        if(next != NULL) {
+            return next;
+        }
+    }
+
+    next = sched_pick_local(pcpu);
+    if(next != NULL) {
+        return next;
+    }
+
+    pcpu_t *busiest = sched_busiest(pcpu->cpuid);
+    if(busiest != NULL) {
+        next = sched_steal_from(busiest, pcpu->cpuid);
+    }
+    return next;
+}
+
+/* Where a vcpu becoming READY should queue: its last pcpu if idle, any idle one, else the least loaded */
+static pcpu_t *sched_select_pcpu(vcpu_t *vcpu)
+{
+    pcpu_t *best = NULL;
+    pcpu_t *offline = NULL;
+
+    if(vcpu->pcpu >= 0 && vcpu_allowed(vcpu, vcpu->pcpu) &&
+       pcpus[vcpu->pcpu].online && pcpus[vcpu->pcpu].idle) {
+        return &pcpus[vcpu->pcpu];
+    }
+
+    /* only the pcpus the GIC probe found will ever come up */
+    for(int i = 0; i < nr_pcpus; i++) {
+        pcpu_t *p = &pcpus[i];
+        if(!vcpu_allowed(vcpu, i)) {
+            continue;
+        }
+        if(!p->online) {
+            /* picked up once it comes up */
+            if(offline == NULL) {
+                offline = p;
+            }
+            continue;
+        }
+        if(p->idle) {
+            return p;
+        }
+        if(best == NULL || pcpu_load(p) < pcpu_load(best)) {
+            best = p;
+        }
+    }
+
+    if(best == NULL) {
+        best = offline;
+    }
+    if(best == NULL) {
+        LOG_WARN("vcpu %d: no online pcpu in affinity %p\n", vcpu->cpuid, vcpu->affinity);
+        best = this_cpu();
+    }
+    return best;
+}
+
+/* A vcpu was queued on pcpu, it must notice it */
+static void sched_notify(pcpu_t *pcpu)
+{
+    if(pcpu->cpuid != coreid()) {
+        gic_send_sgi(pcpu->cpuid, IPI_RESCHED);
+        return;
+    }
+
+    /* schedule() tells whether it belongs to the current window */
+    if(pcpu->vcpu == NULL || pcpu->policy == SCHED_POLICY_PARTITION) {
+        pcpu->need_resched = true;
+    } else if(!hrtimer_queued(&pcpu->slice_timer)) {
+        hrtimer_start(&pcpu->slice_timer, hrtimer_now() + hrtimer_us_to_cnt(SCHED_SLICE_US));
+    }
+}
+
+/* Force pcpu through schedule(), preferring a vcpu of gang vm if one is given */
+static void sched_gang_kick(pcpu_t *pcpu, struct vm *gang)
+{
+    if(gang != NULL) {
+        pcpu->gang_vm = gang;
+    }
+    pcpu->need_resched = true;
+
+    if(pcpu->cpuid != coreid()) {
+        gic_send_sgi(pcpu->cpuid, IPI_RESCHED);
+    }
+}
+
+/* A gang vcpu was loaded, the first one pulls the READY siblings in */
+static void sched_gang_load(vcpu_t *vcpu)
+{
+    struct vm *vm = vcpu->vm;
+
+    arch_spin_lock(&vm->gang_lock);
+    bool first = vm->gang_nr_running++ == 0;
+    if(first) {
+        vm->gang_closing = false;
+    }
+    arch_spin_unlock(&vm->gang_lock);
+
+    if(!first) {
+        return;
+    }
+
+    for(int i = 0; i < vm->nvcpu; i++) {
+        vcpu_t *v = vm->vcpus[i];
+        if(v != vcpu && v->state == VCPU_READY && v->pcpu >= 0) {
+            sched_gang_kick(&pcpus[v->pcpu], vm);
+        }
+    }
+}
+
+/* A gang vcpu was put, the first one preempted pushes the running siblings out */
+static void sched_gang_put(vcpu_t *vcpu, bool preempted)
+{
+    struct vm *vm = vcpu->vm;
+    bool kick = false;
+
+    arch_spin_lock(&vm->gang_lock);
+    vm->gang_nr_running--;
+    if(preempted && !vm->gang_closing && vm->gang_nr_running > 0) {
+        vm->gang_closing = true;
+        kick = true;
+    }
+    arch_spin_unlock(&vm->gang_lock);
+
+    if(!kick) {
+        return;
+    }
+
+    for(int i = 0; i < vm->nvcpu; i++) {
+        vcpu_t *v = vm->vcpus[i];
+        if(v != vcpu && v->state == VCPU_RUNNING) {
+            sched_gang_kick(&pcpus[v->pcpu], NULL);
+        }
+    }
+}
+
+/* vcpu->lock held */
+static void __sched_wakeup(vcpu_t *vcpu)
+{
+    vcpu->state    = VCPU_READY;
+    vcpu->ready_at = hrtimer_now();
+
+    pcpu_t *pcpu = sched_select_pcpu(vcpu);
+    sched_enqueue(pcpu, vcpu);
+    trace(VCPU_WAKEUP, vcpu, pcpu->cpuid, 0);
+
+    /* its gang is on the pcpus right now, join it instead of waiting for a slice */
+    if(vcpu->vm->gang_sched && vcpu->vm->gang_nr_running > 0) {
+        sched_gang_kick(pcpu, vcpu->vm);
+    } else {
+        sched_notify(pcpu);
+    }
+}
+
+/* Make a powered off (ALLOCED) or blocked vcpu runnable */
+void sched_wakeup(vcpu_t *vcpu)
+{
+    u64 daif = irq_save();
+
+    arch_spin_lock(&vcpu->lock);
+    if(vcpu->state == VCPU_ALLOCED || vcpu->state == VCPU_BLOCKED) {
+        __sched_wakeup(vcpu);
+    }
+    arch_spin_unlock(&vcpu->lock);
+
+    irq_restore(daif);
+}
+
+/* Power a vcpu off (back to ALLOCED), wherever it is; only CPU_ON brings it back */
+void sched_power_off(vcpu_t *vcpu)
+{
+    u64 daif = irq_save();
+
+    arch_spin_lock(&vcpu->lock);
+    switch(vcpu->state) {
+        case VCPU_READY: {
+            pcpu_t *pcpu = &pcpus[vcpu->pcpu];
+            arch_spin_lock(&pcpu->rq.lock);
+            /* a picker may have dequeued it already, vcpu_load() sees it is off */
+            if(!list_empty(&vcpu->rq_entry)) {
+                rq_dequeue(pcpu, vcpu);
+            }
+            arch_spin_unlock(&pcpu->rq.lock);
+            break;
+        }
+        case VCPU_RUNNING:
+            sched_gang_kick(&pcpus[vcpu->pcpu], NULL);
+            break;
+        default:
+            break;
+    }
+    vcpu->state = VCPU_ALLOCED;
+    arch_spin_unlock(&vcpu->lock);
+
+    irq_restore(daif);
+}
+
+/* Give the pcpu away at the next exit, to vcpu to if it is preempted, else to the next in line */
+void sched_yield(vcpu_t *vcpu, vcpu_t *to)
+{
+    pcpu_t *pcpu = this_cpu();
+
+    pcpu->yield_to     = to;
+    pcpu->need_resched = true;
+}
+
+/*
+ * A trapped WFE: the guest waits for a lock. The likely holder is a sibling
+ * that got preempted, the one waiting the longest; without one, only yield
+ * if somebody else wants this pcpu.
+ */
+void sched_on_spin(vcpu_t *vcpu)
+{
+    struct vm *vm = vcpu->vm;
+    vcpu_t *holder = NULL;
+
+    for(int i = 0; i < vm->nvcpu; i++) {
+        vcpu_t *v = vm->vcpus[i];
+        if(v != vcpu && v->state == VCPU_READY && (holder == NULL || v->ready_at < holder->ready_at)) {
+            holder = v;
+        }
+    }
+
+    if(holder != NULL || this_cpu()->rq.nr_queued > 0) {
+        sched_yield(vcpu, holder);
+    }
+}
+
+/* Take a specific READY vcpu off whatever run queue it is on, for a directed yield */
+static vcpu_t *sched_pick_vcpu(pcpu_t *pcpu, vcpu_t *vcpu)
+{
+    vcpu_t *picked = NULL;
+    int cpu = vcpu->pcpu;
+
+    if(vcpu->state != VCPU_READY || cpu < 0 || !vcpu_allowed(vcpu, pcpu->cpuid)) {
+        return NULL;
+    }
+
+    pcpu_t *from = &pcpus[cpu];
+    arch_spin_lock(&from->rq.lock);
+    if(vcpu->pcpu == cpu && !list_empty(&vcpu->rq_entry)) {
+        rq_dequeue(from, vcpu);
+        picked = vcpu;
+    }
+    arch_spin_unlock(&from->rq.lock);
+
+    return picked;
+}
+
+/* Move a queued vcpu whose pcpu it may no longer run on, after its vm was partitioned */
+void sched_rehome(vcpu_t *vcpu)
+{
+    u64 daif = irq_save();
+
+    arch_spin_lock(&vcpu->lock);
+    /* off the queue it is being loaded or requeued somewhere, that rechecks */
+    if(vcpu->state == VCPU_READY && !list_empty(&vcpu->rq_entry) && !vcpu_allowed(vcpu, vcpu->pcpu)) {
+        pcpu_t *old = &pcpus[vcpu->pcpu];
+        arch_spin_lock(&old->rq.lock);
+        rq_dequeue(old, vcpu);
+        arch_spin_unlock(&old->rq.lock);
+
+        pcpu_t *pcpu = sched_select_pcpu(vcpu);
+        sched_enqueue(pcpu, vcpu);
+        sched_notify(pcpu);
+    }
+    arch_spin_unlock(&vcpu->lock);
+
+    irq_restore(daif);
+}
+
+/* Something is pending for vcpu: wake it up, or make its pcpu exit the guest to deliver it */
+void sched_kick(vcpu_t *vcpu)
+{
+    u64 daif = irq_save();
+
+    arch_spin_lock(&vcpu->lock);
+    if(vcpu->state == VCPU_BLOCKED) {
+        __sched_wakeup(vcpu);
+    } else if(vcpu->state == VCPU_RUNNING && vcpu->pcpu != coreid()) {
+        gic_send_sgi(vcpu->pcpu, IPI_RESCHED);
+    }
+    arch_spin_unlock(&vcpu->lock);
+
+    irq_restore(daif);
+}
+
+/* WFI/WFE，HCR_TWI使WFI陷入，没有待处理的中断时让出pcpu */
+/* HCR_TWE使WFE陷入, guest在自旋等锁, 让给可能持有锁的被抢占的兄弟vcpu */
+static int sched_trap_wfx(vcpu_t *vcpu, u64 esr)
+{
+    int reason;
+
+    if((ESR_ISS(esr) & 0x1) == 0) {
+        reason = EXIT_WFI;
+        sched_block(vcpu);
+    } else {
+        reason = EXIT_WFE;
+        sched_on_spin(vcpu);
+    }
+    vcpu->regs.elr += 4;
+    return reason;
+}
+
+void sched_trap_init(void)
+{
+    trap_ec_register(ESR_EC_WFX, sched_trap_wfx);
+}
+
+/*
+ * The current vcpu waits for an interrupt. Checked under vcpu->lock, so an
+ * injection racing with us either sees BLOCKED and wakes it, or its pending
+ * virq is seen here.
+ */
+void sched_block(vcpu_t *vcpu)
+{
+    arch_spin_lock(&vcpu->lock);
+    if(!vgic_has_pending(vcpu)) {
+        vcpu->state = VCPU_BLOCKED;
+        this_cpu()->need_resched = true;
+        trace(VCPU_BLOCK, vcpu, 0, 0);
+    }
+    arch_spin_unlock(&vcpu->lock);
+}
+
+static void sched_idle(pcpu_t *pcpu)
+{
+    trace(IDLE, NULL, 0, 0);
+    pcpu->idle = true;
+    /* log output pending, poll the uart instead of sleeping */
+    if(!logbuf_drain()) {
+        /* a wakeup on another pcpu sends an SGI, which ends the wfi even though it is masked */
+        asm volatile("wfi" ::: "memory");
+    }
+    irq_enable;
+    isb();
+    irq_disable;
+    pcpu->idle = false;
+}
+
+/* Whether the running prev has to make room for a queued vcpu */
+static bool sched_should_preempt(pcpu_t *pcpu, vcpu_t *prev)
+{
+    /* a sibling was preempted, the gang leaves the pcpus whether or not somebody waits here */
+    if(prev->vm->gang_sched && prev->vm->gang_closing) {
+        return true;
+    }
+
+    if(pcpu->policy == SCHED_POLICY_PARTITION) {
+        struct vm *vm = partition_current_vm(&pcpu->part);
+        if(prev->vm != vm) {
+            return true;
+        }
+
+        /* round robin among the vcpus of the window owner */
+        bool waiting = false;
+        struct list_head *pos;
+        arch_spin_lock(&pcpu->rq.lock);
+        list_for_each(pos, &pcpu->rq.queue) {
+            if(list_entry(pos, vcpu_t, rq_entry)->vm == vm) {
+                waiting = true;
+                break;
+            }
+        }
+        arch_spin_unlock(&pcpu->rq.lock);
+        return waiting;
+    }
+
+    return pcpu->rq.nr_queued > 0;
+}
+
+/* Switch the current vcpu out if it blocked or its slice is over, with the IRQ masked */
+void schedule(void)
+{
+    pcpu_t *pcpu = this_cpu();
+    vcpu_t *prev = pcpu->vcpu;
+    vcpu_t *next = NULL;
+    vcpu_t *yield_to = pcpu->yield_to;
+
+    pcpu->need_resched = false;
+    pcpu->yield_to     = NULL;
+
+    if(yield_to != NULL && yield_to->state != VCPU_READY) {
+        yield_to = NULL;
+    }
+
+    if(prev != NULL) {
+        /* nobody is waiting, keep running */
+        if(prev->state == VCPU_RUNNING && yield_to == NULL && !sched_should_preempt(pcpu, prev)) {
+            return;
+        }
+
+        arch_spin_lock(&prev->lock);
+        bool preempted = prev->state == VCPU_RUNNING;
+        if(preempted) {
+            prev->state    = VCPU_READY;
+            prev->ready_at = hrtimer_now();
+        }
+        arch_spin_unlock(&prev->lock);
+
+        vcpu_put(prev);
+        if(prev->vm->gang_sched) {
+            sched_gang_put(prev, preempted);
+        }
+
+        if(preempted) {
+            sched_requeue(pcpu, prev);
+        }
+    }
+
+    /* directed yield: run it here, wherever it was queued */
+    if(yield_to != NULL) {
+        next = sched_pick_vcpu(pcpu, yield_to);
+        if(next != NULL && !vcpu_load(next)) {
+            next = NULL;
+        }
+    }
+
+    while(next == NULL) {
+        next = sched_pick_next(pcpu);
+        if(next == NULL) {
+            sched_idle(pcpu);
+            continue;
+        }
+        /* fails if it was powered off while queued */
+        if(!vcpu_load(next)) {
+            next = NULL;
+        }
+    }
+    if(next->vm->gang_sched) {
+        sched_gang_load(next);
+    }
+    trace(SCHED_SWITCH, next, prev != NULL ? prev - vcpus : -1, next - vcpus);
+}
+
+/* On the way back to the guest */
+void sched_exit_check(void)
+{
+    pcpu_t *pcpu = this_cpu();
+
+    if(pcpu->need_resched) {
+        schedule();
+    }
+    vgic_flush_pending(pcpu->vcpu);
+}
+
+/* Idle until a vcpu shows up, then enter it, never returns */
+void sched_start(void)
+{
+    pcpu_t *pcpu = this_cpu();
+
+    LOG_INFO("pcpu %d: scheduler started\n", coreid());
+
+    irq_disable;
+    /* from now on this pcpu runs guests, keep the uart off its path */
+    logbuf_set_async(true);
+    if(pcpu->policy == SCHED_POLICY_PARTITION) {
+        partition_start(&pcpu->part);
+    }
+    if(pcpu->policy == SCHED_POLICY_IOPOLL) {
+        iopoll_run();
+    }
+    schedule();
+    switch_out();
+}
+
+void sched_ipi_handler(void)
+{
+    pcpu_t *pcpu = this_cpu();
+
+    trace(IPI, pcpu->vcpu, pcpu->rq.nr_queued, 0);
+    if(pcpu->rq.nr_queued > 0) {
+        sched_notify(pcpu);
+    }
+}
+
+static void sched_slice_expire(struct hrtimer *timer)
+{
+    pcpu_t *pcpu = timer->data;
+    pcpu->need_resched = true;
+}
+
+/* Pull one vcpu from the busiest pcpu when it has at least two more than this one */
+static void sched_balance(struct hrtimer *timer)
+{
+    pcpu_t *pcpu = timer->data;
+    pcpu_t *busiest = sched_busiest(pcpu->cpuid);
+
+    if(busiest != NULL && pcpu_load(busiest) - pcpu_load(pcpu) >= 2) {
+        vcpu_t *vcpu = sched_steal_from(busiest, pcpu->cpuid);
+        if(vcpu != NULL && sched_requeue(pcpu, vcpu)) {
+            sched_notify(pcpu);
+        }
+    }
+
+    /* the only chance to get the log out while every pcpu is busy */
+    logbuf_drain();
+
+    hrtimer_start(timer, hrtimer_now() + hrtimer_us_to_cnt(SCHED_BALANCE_US));
+}
+
+void sched_percpu_init(void)
+{
+    pcpu_t *pcpu = this_cpu();
+
+    arch_spinlock_init(&pcpu->rq.lock);
+    list_init(&pcpu->rq.queue);
+    pcpu->rq.nr_queued = 0;
+
+    hrtimer_init(&pcpu->slice_timer, sched_slice_expire, pcpu);
+    hrtimer_init(&pcpu->balance_timer, sched_balance, pcpu);
+    hrtimer_start(&pcpu->balance_timer, hrtimer_now() + hrtimer_us_to_cnt(SCHED_BALANCE_US));
+
+    /* physical SGIs are owned by the hypervisor, the guests only see virtual ones */
+    gicv3_ops.unmask(IPI_RESCHED);
+
+    pcpu->online = true;
+}
@@ -1,30 +1,60 @@
 #include "spinlock.h"
 #include "printf.h"
+#include "cpufeature.h"
 
-void arch_spin_lock(spinlock_t *spinlock)
+/* LL/SC: 在独占监视器上自旋, 所有ARMv8 cpu都支持 */
+static inline void arch_spin_lock_llsc(spinlock_t *spinlock)
 {
-    if(spin_check(spinlock)) {
-        abort("spinlock - %s is alredy held by core: %d", spinlock->name, spinlock->coreid);
-    }
+    u32 tmp, one = 1;
 
     asm volatile(
-        /* 获取spinlock->lock的地址 */
-        "mov x1, %0\n"
-        /* w2 = 1 */
-        "mov w2, #1\n"
-        /* 独占访问 - 从内存位置x1加载值到w3 */
-        "1: ldxr w3, [x1]\n"
-        /* 如果w3的值不为零, 则跳转到标签 1 */
-        "cbnz w3, 1b\n"
-        /* 使用stxr指令将w2的值尝试写入spinlock->lock
-         * 它将返回的状态存储在w3中。
-         * 如果spinlock->lock被其他线程改变了, stxr将失败, 并将w3设置为非零值。
+        /* 独占访问 - 从spinlock->lock加载值到tmp, acquire语义保证临界区内的访问不会提前 */
+        "1: ldaxrb %w0, [%2]\n"
+        /* 如果tmp的值不为零, 说明锁被占用, 跳转到标签 1 */
+        "cbnz %w0, 1b\n"
+        /* 使用stxr指令将1尝试写入spinlock->lock
+         * 它将返回的状态存储在tmp中。
+         * 如果spinlock->lock被其他线程改变了, stxr将失败, 并将tmp设置为非零值。
         */
-        "stxr w3, w2, [x1]\n"
+        "stxrb %w0, %w1, [%2]\n"
         /* 如果上述stxr失败, 则继续跳转到标签1尝试获取锁 */
-        "cbnz w3, 1b\n"
-        :: "r" (&spinlock->lock) : "memory"
+        "cbnz %w0, 1b\n"
+        : "=&r" (tmp) : "r" (one), "r" (&spinlock->lock) : "memory"
     );
+}
+
+/*
+ * FEAT_LSE: one swpab per attempt instead of a ldaxrb/stxrb pair that can fail
+ * under contention, and waiters spin on a plain load so the line stays shared.
+ */
+static inline void arch_spin_lock_lse(spinlock_t *spinlock)
+{
+    u32 old, one = 1;
+
+    asm volatile(
+        ".arch_extension lse\n"
+        "1: swpab %w1, %w0, [%2]\n"
+        "cbz %w0, 3f\n"
+        "2: ldrb %w0, [%2]\n"
+        "cbnz %w0, 2b\n"
+        "b 1b\n"
+        "3:\n"
+        : "=&r" (old) : "r" (one), "r" (&spinlock->lock) : "memory"
+    );
+}
+
+void arch_spin_lock(spinlock_t *spinlock)
+{
+    if(spin_check(spinlock)) {
+        abort("spinlock - %s is alredy held by core: %d", spinlock->name, spinlock->coreid);
+    }
+
+    /* both take the same byte and are released by the same stlrb, so they mix */
+    if(cpu_has(CPU_FEAT_LSE)) {
+        arch_spin_lock_lse(spinlock);
+    } else {
+        arch_spin_lock_llsc(spinlock);
+    }
     spinlock->coreid = coreid();
     isb();
 }
@@ -39,7 +69,32 @@ void arch_spin_unlock(spinlock_t *spinlock)
         printf("core id: %d\n", coreid());
         abort("spinlock - %s is unlocked by invalid coreid: %d", spinlock->name,spinlock->coreid);
     }
-    /* 直接将锁的值改为0就可以 */
-    asm volatile("str wzr, %0" : "=m"(spinlock->lock) :: "memory");
+    /* 直接将锁的值改为0就可以, release语义保证临界区内的访问在解锁前完成 */
+    asm volatile("stlrb wzr, %0" : "=Q"(spinlock->lock) :: "memory");
+    isb();
+}
+
+/* 只尝试一次, 拿不到锁立即返回false */
+bool arch_spin_trylock(spinlock_t *spinlock)
+{
+    u32 fail = 1, val;
+
+    if(spin_check(spinlock)) {
+        return false;
+    }
+
+    asm volatile(
+        "ldaxrb %w1, [%2]\n"
+        "cbnz %w1, 1f\n"
+        "mov %w1, #1\n"
+        "stxrb %w0, %w1, [%2]\n"
+        "1:\n"
+        : "+&r" (fail), "=&r" (val) : "r" (&spinlock->lock) : "memory"
+    );
+    if(fail) {
+        return false;
+    }
+    spinlock->coreid = coreid();
     isb();
-}
\ No newline at end of file
+    return true;
+}
@@ -0,0 +1,64 @@
+#include <types.h>
+#include <arch.h>
+#include <layout.h>
+#include <printf.h>
+#include <hrtimer.h>
+#include <vcpu.h>
+#include <trace.h>
+
+#if XHYPER_TRACE
+
+struct trace_ring trace_rings[NCPU];
+
+void __trace(enum trace_event event, struct vcpu *vcpu, u64 arg0, u64 arg1)
+{
+    struct trace_ring *ring = this_cpu()->trace;
+    u64 head = ring->head;
+    struct trace_record *rec = &ring->records[head & (TRACE_RING_RECORDS - 1)];
+
+    rec->ts    = hrtimer_now();
+    rec->event = event;
+    rec->vcpu  = vcpu != NULL ? vcpu - vcpus : TRACE_NO_VCPU;
+    rec->arg0  = arg0;
+    rec->arg1  = arg1;
+
+    /* a dump taken while running sees head only after the record is complete */
+    asm volatile("dmb ishst" ::: "memory");
+    ring->head = head + 1;
+}
+
+void trace_percpu_init(void)
+{
+    struct trace_ring *ring = &trace_rings[coreid()];
+
+    this_cpu()->trace = ring;
+
+    ring->cpu         = coreid();
+    ring->record_size = sizeof(struct trace_record);
+    ring->nr_records  = TRACE_RING_RECORDS;
+    ring->head        = 0;
+    read_sysreg(ring->freq, cntfrq_el0);
+    ring->magic       = TRACE_MAGIC;
+}
+
+/* Where the rings are, for the qemu monitor: pmemsave <addr> <size> trace.bin */
+void trace_info(void)
+{
+    printf("trace rings at %p, size %x\n", trace_rings, sizeof(trace_rings));
+    for(int i = 0; i < NCPU; i++) {
+        printf("  pcpu %d: %d records written\n", i, (u32)trace_rings[i].head);
+    }
+}
+
+#else
+
+void trace_percpu_init(void)
+{
+}
+
+void trace_info(void)
+{
+    printf("tracing is not built in, rebuild with make PROFILE=trace\n");
+}
+
+#endif
@@ -0,0 +1,168 @@
+#include <types.h>
+#include <arch.h>
+#include <printf.h>
+#include <xlog.h>
+#include <vcpu.h>
+#include <exitstat.h>
+#include <trace.h>
+#include <trap.h>
+
+/*
+ * Exit dispatch. Subsystems register a handler per exception class and per
+ * trapped system register at boot, the exit path is then one indexed load
+ * for the class and one hash probe (usually) for the register.
+ */
+
+static trap_ec_handler_t trap_ec_handlers[ESR_EC_NR];
+
+/* open addressing, sysreg 0 is not a valid encoding and marks a free slot */
+struct trap_sysreg_slot {
+    u32 sysreg;
+    trap_sysreg_handler_t handler;
+};
+
+static struct trap_sysreg_slot trap_sysregs[TRAP_SYSREG_SLOTS];
+
+static inline u32 trap_sysreg_hash(u32 sysreg)
+{
+    /* Fibonacci hashing, the encodings differ mostly in their low fields */
+    return (sysreg * 0x9E3779B1U) >> (32 - __builtin_ctz(TRAP_SYSREG_SLOTS));
+}
+
+void trap_ec_register(u32 ec, trap_ec_handler_t handler)
+{
+    if(ec >= ESR_EC_NR) {
+        abort("Invalid exception class %d", ec);
+    }
+    if(trap_ec_handlers[ec] != NULL && trap_ec_handlers[ec] != handler) {
+        abort("Exception class 0x%x already has a handler", ec);
+    }
+    trap_ec_handlers[ec] = handler;
+}
+
+void trap_sysreg_register(u32 sysreg, trap_sysreg_handler_t handler)
+{
+    u32 idx = trap_sysreg_hash(sysreg);
+
+    for(int n = 0; n < TRAP_SYSREG_SLOTS; n++, idx = (idx + 1) & (TRAP_SYSREG_SLOTS - 1)) {
+        struct trap_sysreg_slot *slot = &trap_sysregs[idx];
+        if(slot->sysreg == 0 || slot->sysreg == sysreg) {
+            slot->sysreg  = sysreg;
+            slot->handler = handler;
+            return;
+        }
+    }
+    abort("Trapped system register table is full");
+}
+
+static trap_sysreg_handler_t trap_sysreg_lookup(u32 sysreg)
+{
+    u32 idx = trap_sysreg_hash(sysreg);
+
+    for(int n = 0; n < TRAP_SYSREG_SLOTS; n++, idx = (idx + 1) & (TRAP_SYSREG_SLOTS - 1)) {
+        struct trap_sysreg_slot *slot = &trap_sysregs[idx];
+        if(slot->sysreg == sysreg) {
+            return slot->handler;
+        }
+        if(slot->sysreg == 0) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* ESR_EC_SYS64: a trapped MSR/MRS, dispatched on the register encoding */
+int trap_sysreg(struct vcpu *vcpu, u64 esr)
+{
+    u32  iss    = ESR_ISS(esr);
+    bool write  = !(iss & 1);
+    /* The Rt value from the issued instruction, the general-purpose register used for the transfer. */
+    int  rt     = (iss >> 5) & 0x1F;
+    u32  sysreg = iss & SYSREG_ISS_MASK;
+
+    trace(SYSREG, vcpu, sysreg, write);
+
+    trap_sysreg_handler_t handler = trap_sysreg_lookup(sysreg);
+    if(handler == NULL) {
+        LOG_WARN_RATELIMITED("Unhandled system register %p from vcpu %d\n", sysreg, vcpu->cpuid);
+        return -1;
+    }
+
+    /* Rt 31 is xzr */
+    u64 val = (write && rt != 31) ? vcpu->regs.x[rt] : 0;
+    if(handler(vcpu, sysreg, &val, write) < 0) {
+        return -1;
+    }
+    if(!write && rt != 31) {
+        vcpu->regs.x[rt] = val;
+    }
+
+    vcpu->regs.elr += 4;
+    return EXIT_SYSREG;
+}
+
+/*
+ * Take a synchronous exception with syndrome esr to the guest's EL1, as the
+ * cpu would. The EL1 state of the running vcpu is live in the registers.
+ */
+static void trap_inject_sync(struct vcpu *vcpu, u64 esr)
+{
+    u64 vbar, offset;
+
+    read_sysreg(vbar, vbar_el1);
+    switch(SPSR_M(vcpu->regs.spsr)) {
+        case 0x4: offset = 0x000; break;   /* EL1t, current EL with SP_EL0 */
+        case 0x5: offset = 0x200; break;   /* EL1h, current EL with SP_ELx */
+        default:  offset = 0x400; break;   /* EL0, lower EL using aarch64 */
+    }
+
+    write_sysreg(elr_el1, vcpu->regs.elr);
+    write_sysreg(spsr_el1, vcpu->regs.spsr);
+    write_sysreg(esr_el1, esr);
+
+    vcpu->regs.spsr = SPSR_M(0x5) | SPSR_DAIF;
+    vcpu->regs.elr  = vbar + offset;
+}
+
+/* An undefined instruction exception, for an instruction the hypervisor does not emulate */
+void trap_inject_undef(struct vcpu *vcpu)
+{
+    trap_inject_sync(vcpu, (ESR_EC_UNKNOWN << 26) | ESR_IL);
+}
+
+/*
+ * A synchronous external data abort at far, for a load/store to an MMIO
+ * region the hypervisor can't emulate: no device answers there, as far as
+ * the guest can tell. No valid syndrome, as for any external abort.
+ */
+void trap_inject_dabt(struct vcpu *vcpu, u64 far)
+{
+    /* taken from EL0 or from EL1 itself */
+    u64 ec = (SPSR_M(vcpu->regs.spsr) & 0xc) == 0 ? ESR_EC_DABT_LOW : ESR_EC_DABT_CUR;
+
+    write_sysreg(far_el1, far);
+    trap_inject_sync(vcpu, (ec << 26) | ESR_IL | ESR_DFSC_EXT_ABORT);
+}
+
+/* Returns the exit reason, an unhandled trap becomes an UNDEF of the guest, or a data abort */
+int trap_handle(struct vcpu *vcpu, u64 esr)
+{
+    trap_ec_handler_t handler = trap_ec_handlers[ESR_EC(esr)];
+    int reason = handler != NULL ? handler(vcpu, esr) : -1;
+
+    if(reason < 0) {
+        u64 elr;
+        read_sysreg(elr, elr_el2);
+        LOG_WARN_RATELIMITED("Unhandled trap of vcpu %d: esr_ec %p, esr_iss %p, elr %p\n",
+                             vcpu->cpuid, ESR_EC(esr), ESR_ISS(esr), elr);
+        if(ESR_EC(esr) == ESR_EC_DABT_LOW) {
+            u64 far;
+            read_sysreg(far, far_el2);
+            trap_inject_dabt(vcpu, far);
+        } else {
+            trap_inject_undef(vcpu);
+        }
+        reason = EXIT_OTHER;
+    }
+    return reason;
+}
@@ -10,9 +10,22 @@ u64 strlen(const char *s)
 }
 
 /*---------------------memset-------------------------------*/
+/*
+ * Word at a time when the pointers allow it. DC ZVA would be faster for page
+ * clearing but faults on Device memory, which is all EL2 has with the MMU off.
+ */
 void *memset(void *dst, int c, u64 n) {
     char *d = dst;
 
+    if(((u64)d & 0x7) == 0) {
+        u64 w = (u8)c * 0x0101010101010101UL;
+        u64 *dw = (u64 *)d;
+        for(; n >= 8; n -= 8) {
+            *dw++ = w;
+        }
+        d = (char *)dw;
+    }
+
     while(n-- > 0) {
         *d++ = c;
     }
@@ -25,6 +38,17 @@ void *memcpy(void *dst, const void *src, size_t count)
 {
     char *pTo = (char *)dst;
     char *pFrom = (char *)src;
+
+    if((((u64)pTo | (u64)pFrom) & 0x7) == 0) {
+        u64 *wTo = (u64 *)pTo;
+        const u64 *wFrom = (const u64 *)pFrom;
+        for(; count >= 8; count -= 8) {
+            *wTo++ = *wFrom++;
+        }
+        pTo = (char *)wTo;
+        pFrom = (char *)wFrom;
+    }
+
     while (count-- > 0)
     {
         *pTo++ = *pFrom++;
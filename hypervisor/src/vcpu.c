@@ -1,20 +1,37 @@
+#define XLOG_SUBSYS XLOG_VCPU
+
 #include <xlog.h>
 #include <vcpu.h>
 #include <types.h>
 #include <arch.h>
 #include <printf.h>
 #include <vgicv3.h>
+#include <vtimer.h>
+#include <hrtimer.h>
+#include <sched.h>
+#include <pvtime.h>
+#include <utils.h>
 
 pcpu_t pcpus[NCPU];
-vcpu_t vcpus[NCPU];
-static spinlock_t vcpus_lock;
+vcpu_t vcpus[NVCPU];
 
-/* Acquire the pcpu according to current core id */
-pcpu_t *cur_pcpu()
-{
-    int id = coreid();
-    return &pcpus[id];
-}
+/* vector.S addresses the vcpu through these offsets, see save_vm_regs/fpsimd_save */
+_Static_assert(offsetof(vcpu_t, regs) == 0, "regs offset used by vector.S");
+_Static_assert(offsetof(vcpu_t, regs.spsr) == 8 * 31, "spsr offset used by vector.S");
+_Static_assert(offsetof(vcpu_t, regs.elr) == 8 * 32, "elr offset used by vector.S");
+_Static_assert(offsetof(vcpu_t, exit_entry) == 8 * 33, "exit_entry offset used by vector.S");
+_Static_assert(offsetof(vcpu_t, fast_exits) == VCPU_FAST_EXITS_OFFSET, "fast_exits offset used by vector.S");
+_Static_assert(offsetof(vcpu_t, cpuid) == VCPU_CPUID_OFFSET, "cpuid offset used by vector.S");
+_Static_assert(offsetof(struct fpsimd_state, fpsr) == 32 * 16, "fpsr offset used by fpsimd_save");
+_Static_assert(offsetof(struct fpsimd_state, fpcr) == 32 * 16 + 8, "fpcr offset used by fpsimd_save");
+_Static_assert(offsetof(vcpu_t, fpsimd) % 16 == 0, "fpsimd_save stores q registers, 16 byte aligned");
+
+_Static_assert(offsetof(pcpu_t, vcpu) == PCPU_VCPU_OFFSET, "pcpu vcpu offset used by vector.S");
+_Static_assert(offsetof(pcpu_t, cpuid) == PCPU_CPUID_OFFSET, "pcpu cpuid offset used by coreid()");
+
+/* vcpu->affinity is a u64 bitmap of pcpus */
+_Static_assert(NCPU <= 64, "NCPU above 64 does not fit vcpu affinity");
+static spinlock_t vcpus_lock;
 
 /* Initialize the physical cpu array
  * core 0 ---> pcpus[0]
@@ -24,16 +41,34 @@ pcpu_t *cur_pcpu()
 void pcpu_init()
 {
     for(int i=0; i < NCPU; i++){
-        pcpus[i].cpuid = i;
-        pcpus[i].vcpu  = NULL;
+        pcpus[i].cpuid        = i;
+        pcpus[i].vcpu         = NULL;
+        pcpus[i].last_vcpu    = NULL;
+        pcpus[i].online       = false;
+        pcpus[i].idle         = false;
+        pcpus[i].need_resched = false;
+        pcpus[i].gang_vm      = NULL;
+        pcpus[i].yield_to     = NULL;
+        pcpus[i].policy       = SCHED_POLICY_FAIR;
     }
     return;
 }
 
+/*
+ * Point tpidr_el2 at the pcpu_t of logical cpu id. Must run first on every
+ * core, coreid() and with it every spinlock read the core id from there.
+ */
+void pcpu_percpu_init(int id)
+{
+    pcpus[id].cpuid = id;
+    write_sysreg(tpidr_el2, &pcpus[id]);
+    isb();
+}
+
 void vcpu_init()
 {
     arch_spinlock_init(&vcpus_lock);
-    for(int i=0; i < NCPU; i++){
+    for(int i=0; i < NVCPU; i++){
         vcpus[i].state = VCPU_UNUSED;
     }
     return;
@@ -42,7 +77,7 @@ void vcpu_init()
 static vcpu_t *vcpu_alloc()
 {
     arch_spin_lock(&vcpus_lock);
-    for(vcpu_t *vcpu = vcpus; vcpu < &vcpu[NCPU]; vcpu++){
+    for(vcpu_t *vcpu = vcpus; vcpu < &vcpus[NVCPU]; vcpu++){
         if(vcpu->state == VCPU_UNUSED) {
             vcpu->state = VCPU_ALLOCED;
             arch_spin_unlock(&vcpus_lock);
@@ -64,6 +99,16 @@ vcpu_t *create_vcpu(vm_t *vm, int vcpuid, u64 entry)
     vcpu->core_name = "Cortex-A72";
     vcpu->vm        = vm;
     vcpu->cpuid     = vcpuid;
+    vcpu->affinity  = 0;
+    vcpu->pcpu      = -1;
+    vcpu->on_cpu    = false;
+    vcpu->last_ran  = 0;
+    vcpu->ready_at  = 0;
+    vcpu->steal     = 0;
+    exit_stat_reset(vcpu);
+    memset(vcpu->mmio_cache, 0, sizeof(vcpu->mmio_cache));
+    arch_spinlock_init(&vcpu->lock);
+    list_init(&vcpu->rq_entry);
 
     /*
         程序状态保存寄存器（SPSR）
@@ -85,9 +130,12 @@ vcpu_t *create_vcpu(vm_t *vm, int vcpuid, u64 entry)
     read_sysreg(cnt, cntfrq_el0);
     vcpu->sys_regs.cntfrq_el0 = cnt;
 
+    /* all vcpus of a vm share the same virtual time base */
+    vtimer_init(vcpu, vm->cntvoff, vm->vtimer_exclude_desched);
+
     u64 val;
     read_sysreg(val, cntfrq_el0);
-    LOG_INFO("cntfrq_el0 is %p\n", val);
+    LOG_DEBUG("cntfrq_el0 is %p\n", val);
     
     if(vcpuid == 0) {  /* If it is the primary virtual cpu, set the dtb address (ipa) */
         vcpu->regs.x[0] = vm->dtb;
@@ -113,42 +161,140 @@ static void restore_sysreg(vcpu_t *vcpu)
     write_sysreg(tcr_el1, vcpu->sys_regs.tcr_el1);
     write_sysreg(vbar_el1, vcpu->sys_regs.vbar_el1);
     write_sysreg(sctlr_el1, vcpu->sys_regs.sctlr_el1);
-    write_sysreg(cntv_ctl_el0, vcpu->sys_regs.cntv_ctl_el0);
-    write_sysreg(cntv_tval_el0, vcpu->sys_regs.cntv_tval_el0);
     write_sysreg(cntfrq_el0, vcpu->sys_regs.cntfrq_el0);
+    write_sysreg(mair_el1, vcpu->sys_regs.mair_el1);
+    write_sysreg(amair_el1, vcpu->sys_regs.amair_el1);
+    write_sysreg(cpacr_el1, vcpu->sys_regs.cpacr_el1);
+    write_sysreg(contextidr_el1, vcpu->sys_regs.contextidr_el1);
+    write_sysreg(tpidr_el0, vcpu->sys_regs.tpidr_el0);
+    write_sysreg(tpidr_el1, vcpu->sys_regs.tpidr_el1);
+    write_sysreg(tpidrro_el0, vcpu->sys_regs.tpidrro_el0);
+    write_sysreg(par_el1, vcpu->sys_regs.par_el1);
+    write_sysreg(esr_el1, vcpu->sys_regs.esr_el1);
+    write_sysreg(far_el1, vcpu->sys_regs.far_el1);
+    write_sysreg(afsr0_el1, vcpu->sys_regs.afsr0_el1);
+    write_sysreg(afsr1_el1, vcpu->sys_regs.afsr1_el1);
+    write_sysreg(cntkctl_el1, vcpu->sys_regs.cntkctl_el1);
+    write_sysreg(csselr_el1, vcpu->sys_regs.csselr_el1);
+}
+
+static void save_sysreg(vcpu_t *vcpu)
+{
+    read_sysreg(vcpu->sys_regs.spsr_el1, spsr_el1);
+    read_sysreg(vcpu->sys_regs.elr_el1, elr_el1);
+    read_sysreg(vcpu->sys_regs.sp_el0, sp_el0);
+    read_sysreg(vcpu->sys_regs.sp_el1, sp_el1);
+    read_sysreg(vcpu->sys_regs.ttbr0_el1, ttbr0_el1);
+    read_sysreg(vcpu->sys_regs.ttbr1_el1, ttbr1_el1);
+    read_sysreg(vcpu->sys_regs.tcr_el1, tcr_el1);
+    read_sysreg(vcpu->sys_regs.vbar_el1, vbar_el1);
+    read_sysreg(vcpu->sys_regs.sctlr_el1, sctlr_el1);
+    read_sysreg(vcpu->sys_regs.mair_el1, mair_el1);
+    read_sysreg(vcpu->sys_regs.amair_el1, amair_el1);
+    read_sysreg(vcpu->sys_regs.cpacr_el1, cpacr_el1);
+    read_sysreg(vcpu->sys_regs.contextidr_el1, contextidr_el1);
+    read_sysreg(vcpu->sys_regs.tpidr_el0, tpidr_el0);
+    read_sysreg(vcpu->sys_regs.tpidr_el1, tpidr_el1);
+    read_sysreg(vcpu->sys_regs.tpidrro_el0, tpidrro_el0);
+    read_sysreg(vcpu->sys_regs.par_el1, par_el1);
+    read_sysreg(vcpu->sys_regs.esr_el1, esr_el1);
+    read_sysreg(vcpu->sys_regs.far_el1, far_el1);
+    read_sysreg(vcpu->sys_regs.afsr0_el1, afsr0_el1);
+    read_sysreg(vcpu->sys_regs.afsr1_el1, afsr1_el1);
+    read_sysreg(vcpu->sys_regs.cntkctl_el1, cntkctl_el1);
+    read_sysreg(vcpu->sys_regs.csselr_el1, csselr_el1);
 }
 
-extern void switch_out(void);
+extern void fpsimd_save(struct fpsimd_state *state);
+extern void fpsimd_restore(struct fpsimd_state *state);
 
-static void switch_vcpu(vcpu_t *vcpu)
+/* Save the EL1 state of a vcpu that is leaving the current pcpu */
+void vcpu_save_state(vcpu_t *vcpu)
 {
-    cur_pcpu()->vcpu = vcpu;
-    /* tpidr_el2保存当前执行的vcpu的地址，在上下文中可以用于获取vcpu */
-    write_sysreg(tpidr_el2, vcpu);
+    save_sysreg(vcpu);
+    fpsimd_save(&vcpu->fpsimd);
+    vtimer_save(vcpu);
+    save_gic_context(&vcpu->gic_context);
+}
 
-    vcpu->state = VCPU_RUNNING;
-    /* 设置stage2转换的页表基地址寄存器 */
-    write_sysreg(vttbr_el2, vcpu->vm->vttbr);
-    flush_tlb();
-    /* 设置EL1/EL0系统寄存器的初始状态 */
+/* Load the EL1 state of a vcpu onto the current pcpu */
+void vcpu_restore_state(vcpu_t *vcpu)
+{
     restore_sysreg(vcpu);
-    /* 恢复gic上下文 */
+    fpsimd_restore(&vcpu->fpsimd);
+    vtimer_restore(vcpu);
     restore_gic_context(&vcpu->gic_context);
-    isb();
-    /* 切换到EL1 */
-    switch_out();
 }
 
-void start_vcpu()
+/*
+ * Make vcpu the current one of this pcpu, the exception return path
+ * (restore_vm_regs) picks up its registers through tpidr_el2->vcpu. The
+ * caller took it off a run queue. Returns false if it is no longer READY,
+ * e.g. powered off while queued, or was queued again by a CPU_ON since.
+ */
+bool vcpu_load(vcpu_t *vcpu)
 {
-    int id = coreid();
-    vcpu_t *vcpu = &vcpus[id];
+    pcpu_t *pcpu = this_cpu();
+
+    /* the pcpu it was running on may still be saving its context */
+    while(vcpu->on_cpu)
+        ;
+    dsb(ish);
+
+    arch_spin_lock(&vcpu->lock);
+    if(vcpu->state != VCPU_READY || !list_empty(&vcpu->rq_entry)) {
+        arch_spin_unlock(&vcpu->lock);
+        return false;
+    }
+    vcpu->on_cpu = true;
+    vcpu->pcpu   = pcpu->cpuid;
+    vcpu->state  = VCPU_RUNNING;
+    arch_spin_unlock(&vcpu->lock);
+
+    vcpu->steal += hrtimer_now() - vcpu->ready_at;
+    pvtime_update(vcpu);
+
+    /* vector.S通过tpidr_el2->vcpu找到当前执行的vcpu */
+    pcpu->vcpu = vcpu;
+
+    /* 设置stage2转换的页表基地址寄存器 */
+    write_sysreg(vttbr_el2, vcpu->vm->vttbr);
+    /*
+     * All vms share VMID 0, and a guest may have used local TLB maintenance
+     * for entries that are still cached here, flush unless this pcpu last
+     * ran the same vcpu.
+     */
+    if(pcpu->last_vcpu != vcpu) {
+        flush_tlb();
+    }
 
-    if(vcpu->state != VCPU_READY) {
-        abort("vcpu is not ready");
+    /* 设置EL1/EL0系统寄存器的状态，恢复虚拟定时器和gic上下文 */
+    vcpu_restore_state(vcpu);
+    vgic_flush_pending(vcpu);
+
+    /* only slice when someone else is waiting for this pcpu */
+    if(pcpu->rq.nr_queued > 0) {
+        hrtimer_start(&pcpu->slice_timer, hrtimer_now() + hrtimer_us_to_cnt(SCHED_SLICE_US));
+    } else {
+        hrtimer_cancel(&pcpu->slice_timer);
     }
+    isb();
+
+    return true;
+}
+
+/* Save the current vcpu, after which any pcpu may load it */
+void vcpu_put(vcpu_t *vcpu)
+{
+    pcpu_t *pcpu = this_cpu();
+
+    hrtimer_cancel(&pcpu->slice_timer);
+    vcpu_save_state(vcpu);
 
-    LOG_INFO("pcpu %d: starting vcpu %d\n", id, vcpu->cpuid);
+    vcpu->last_ran  = hrtimer_now();
+    pcpu->last_vcpu = vcpu;
+    pcpu->vcpu      = NULL;
 
-    switch_vcpu(vcpu);
+    dsb(ish);
+    vcpu->on_cpu = false;
 }
\ No newline at end of file
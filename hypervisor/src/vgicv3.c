@@ -1,3 +1,5 @@
+#define XLOG_SUBSYS XLOG_VGIC
+
 #include <vm.h>
 #include <types.h>
 #include <xlog.h>
@@ -12,6 +14,10 @@
 #include <gicv3.h>
 #include <vgicv3.h>
 #include <spinlock.h>
+#include <vtimer.h>
+#include <sched.h>
+#include <trace.h>
+#include <trap.h>
 
 
 /* Alloc and initialize a virtual gic cpu interface */
@@ -23,6 +29,11 @@ struct vgicv3_cpu *create_vgic_cpu(int vcpuid)
     }
 
     vgic_cpu->used_lr = 0;
+    arch_spinlock_init(&vgic_cpu->lock);
+    for(int i = 0; i < VGIC_PENDING_WORDS; i++) {
+        vgic_cpu->pending[i]    = 0;
+        vgic_cpu->pending_hw[i] = 0;
+    }
 
     for(struct vgicv3_irq_config *v = vgic_cpu->sgis; v < &vgic_cpu->sgis[GIC_NSGI]; v++) {
         v->enabled = 0;
@@ -82,35 +93,231 @@ static int alloc_lr(struct vgicv3_cpu *vgic_cpu)
 }
 
 
-int virq_inject(struct vcpu *vcpu, u32 pirq, u32 virq)
+/* virq 已经在某个LR中处于pending状态 */
+static bool vgic_lr_pending(struct vgicv3_cpu *vgic_cpu, u32 virq)
+{
+    for(int i = 0; i < gic_max_lrs; i++) {
+        if((vgic_cpu->used_lr & (1 << i)) != 0) {
+            u64 lr = gic_read_list_reg(i);
+            if(LR_IS_PENDING(lr) && LR_GET_VINTID(lr) == virq) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/*
+ * 把pending的虚拟中断写入空闲的LR，只能对当前pcpu上运行的vcpu调用。
+ * LR不够时打开underflow maintenance中断，LR空出来后再trap回来继续写。
+ */
+void vgic_flush_pending(struct vcpu *vcpu)
 {
     struct vgicv3_cpu *vgic_cpu = vcpu->vgic_cpu;
-    u64 lr = gic_create_lr(pirq, virq);
-    int n  = alloc_lr(vgic_cpu);
-    if(n >= 0) {
-        gic_write_list_reg(n, lr);
+    bool left = false;
+    u64 any = 0;
+
+    /* called on every exit, nothing to do in the common case */
+    for(int w = 0; w < VGIC_PENDING_WORDS; w++) {
+        any |= vgic_cpu->pending[w];
+    }
+    if(any == 0) {
+        return;
+    }
+
+    virq_enter(vcpu);
+
+    arch_spin_lock(&vgic_cpu->lock);
+    for(int w = 0; w < VGIC_PENDING_WORDS; w++) {
+        while(vgic_cpu->pending[w] != 0) {
+            u32 virq = w * 64 + __builtin_ctzl(vgic_cpu->pending[w]);
+            u64 bit  = 1UL << (virq % 64);
+            bool hw  = (vgic_cpu->pending_hw[w] & bit) != 0;
+
+            if(!vgic_lr_pending(vgic_cpu, virq)) {
+                int n = alloc_lr(vgic_cpu);
+                if(n < 0) {
+                    left = true;
+                    goto out;
+                }
+                gic_write_list_reg(n, hw ? gic_create_lr(virq, virq) : gic_create_sw_lr(virq));
+            }
+            vgic_cpu->pending[w]    &= ~bit;
+            vgic_cpu->pending_hw[w] &= ~bit;
+        }
+    }
+out:
+    arch_spin_unlock(&vgic_cpu->lock);
+
+    write_sysreg(ICH_HCR_EL2, left ? (ICH_HCR_EN | ICH_HCR_UIE) : ICH_HCR_EN);
+}
+
+/* LR underflow: the exit path refills them through vgic_flush_pending() */
+void vgic_maintenance_handler(void)
+{
+    write_sysreg(ICH_HCR_EL2, ICH_HCR_EN);
+}
+
+/* vcpu有等待投递的虚拟中断，WFI时不能让它睡眠 */
+bool vgic_has_pending(struct vcpu *vcpu)
+{
+    struct vgicv3_cpu *vgic_cpu = vcpu->vgic_cpu;
+
+    for(int w = 0; w < VGIC_PENDING_WORDS; w++) {
+        if(vgic_cpu->pending[w] != 0) {
+            return true;
+        }
+    }
+
+    /* list registers of the running vcpu are live in hardware */
+    if(vcpu->on_cpu && vcpu->pcpu == coreid()) {
+        for(int i = 0; i < gic_max_lrs; i++) {
+            if(LR_IS_PENDING(gic_read_list_reg(i))) {
+                return true;
+            }
+        }
     } else {
-        abort("No List Register");
+        for(int i = 0; i < gic_max_lrs; i++) {
+            if(LR_IS_PENDING(vcpu->gic_context.gic_lr[i])) {
+                return true;
+            }
+        }
     }
+    return false;
+}
+
+/*
+ * 向任意vcpu投递虚拟中断: 先记录为pending，当前pcpu上运行的vcpu直接写LR，
+ * 否则唤醒它或者通知它所在的pcpu在下一次退出时写LR。
+ */
+int vgic_inject(struct vcpu *vcpu, u32 virq, bool hw)
+{
+    struct vgicv3_cpu *vgic_cpu = vcpu->vgic_cpu;
+    u64 bit = 1UL << (virq % 64);
+
+    if(virq >= GIC_MAX_IRQ) {
+        return -1;
+    }
+
+    trace(VIRQ_INJECT, vcpu, virq, hw);
+
+    u64 daif = irq_save();
+    arch_spin_lock(&vgic_cpu->lock);
+    vgic_cpu->pending[virq / 64] |= bit;
+    if(hw) {
+        vgic_cpu->pending_hw[virq / 64] |= bit;
+    }
+    arch_spin_unlock(&vgic_cpu->lock);
+
+    if(this_cpu()->vcpu == vcpu) {
+        vgic_flush_pending(vcpu);
+    } else {
+        sched_kick(vcpu);
+    }
+    irq_restore(daif);
 
     return 0;
 }
 
+/* 转发物理中断给vcpu, pirq与virq相同 */
+int virq_inject(struct vcpu *vcpu, u32 pirq, u32 virq)
+{
+    return vgic_inject(vcpu, virq, true);
+}
+
 //开启 irq_num 中断
 static void vgic_irq_enable(struct vcpu *vcpu, int irq_num)
 {
+    /* SGIs are purely virtual, the physical ones belong to the hypervisor */
+    if(irq_num < GIC_NSGI) {
+        return;
+    }
     gicv3_ops.unmask(irq_num);
 }
 
 //关闭 irq_num 中断
 static void vgic_irq_disable(struct vcpu *vcpu, int irq_num)
 {
+    /* the virtual timer PPI is shared by all vcpus multiplexed on a pcpu */
+    if(irq_num < GIC_NSGI || irq_num == VTIMER_IRQ) {
+        return;
+    }
     gicv3_ops.mask(irq_num);
 }
 
+/*
+ * ITARGETSR names vcpus of the guest, the physical SPI is routed to the pcpu
+ * the first targeted vcpu runs on. It follows the vcpu only this far: the
+ * irq is forwarded to its owner from wherever it is taken.
+ */
 static void vgic_target_set(struct vcpu *vcpu, int irq_num, u8 target)
 {
-    gicv3_ops.set_affinity(irq_num, target);
+    struct vm *vm = vcpu->vm;
+
+    if(irq_num < GIC_MIN_SPI0) {
+        return;
+    }
+
+    for(int i = 0; i < vm->nvcpu && i < 8; i++) {
+        if((target & (1 << i)) == 0) {
+            continue;
+        }
+        int pcpu = vm->vcpus[i]->pcpu;
+        if(pcpu >= 0) {
+            gicv3_ops.set_affinity(irq_num, pcpu);
+        }
+        return;
+    }
+}
+
+/*
+ * The vcpu a physical SPI belongs to: the vm that enabled it, and the first
+ * vcpu its ITARGETSR names. NULL when no vm enabled it. Read without the
+ * distributor lock, a guest reconfiguring the irq races with it anyway.
+ */
+static struct vcpu *vgic_spi_owner(u32 irq)
+{
+    for(vcpu_t *v = vcpus; v < &vcpus[NVCPU]; v++) {
+        if(v->state == VCPU_UNUSED || v->cpuid != 0) {
+            continue;
+        }
+        struct vm *vm = v->vm;
+        struct vgicv3_dist *vgic_dist = vm->vgic_dist;
+        if(vgic_dist == NULL || irq - GIC_MIN_SPI0 >= vgic_dist->nspis) {
+            continue;
+        }
+        struct vgicv3_irq_config *spi = &vgic_dist->spis[irq - GIC_MIN_SPI0];
+        if(!spi->enabled) {
+            continue;
+        }
+        for(int i = 0; i < vm->nvcpu && i < 8; i++) {
+            if((spi->affinity & (1 << i)) != 0 && vm->vcpus[i] != NULL) {
+                return vm->vcpus[i];
+            }
+        }
+        return vm->vcpus[0];
+    }
+    return NULL;
+}
+
+/*
+ * Forward a physical irq the hypervisor doesn't handle itself. A PPI goes to
+ * local, the vcpu whose context is on this pcpu, an SPI to its owner
+ * wherever that runs. Returns false, with the irq still active, if nobody
+ * owns it.
+ */
+bool vgic_forward_irq(struct vcpu *local, u32 irq)
+{
+    struct vcpu *vcpu = irq < GIC_MIN_SPI0 ? local : vgic_spi_owner(irq);
+
+    if(vcpu == NULL) {
+        return false;
+    }
+
+    //完成优先级降权, 由guest通过HW LR去deactivate
+    gicv3_ops.guest_eoi(irq);
+    virq_inject(vcpu, irq, irq);
+    return true;
 }
 
 /* EL1访问GICD 会触发地址异常访问陷入到EL2通过mmio读*/
@@ -137,8 +344,9 @@ static int vgicd_read(struct vcpu *vcpu, u64 offset, u64 *val, struct vmmio_acce
         case GICD_TYPER: {
             /* ITLinesNumber */ 
             u32 reg = ((vgic_dist->nspis + 32) >> 5) - 1; // 计算支持的最大SPI
-            /* CPUNumber */
-            reg |= (8 - 1) << GICD_TYPER_CPUNumber_SHIFT; // 假设系统有 8 个 CPU
+            /* CPUNumber, only meaningful without affinity routing, saturates at 8 */
+            int ncpu = vcpu->vm->nvcpu < 8 ? vcpu->vm->nvcpu : 8;
+            reg |= (ncpu - 1) << GICD_TYPER_CPUNumber_SHIFT;
             *val = reg;
             goto finished;
         }
@@ -166,7 +374,7 @@ static int vgicd_read(struct vcpu *vcpu, u64 offset, u64 *val, struct vmmio_acce
         }
 
         case GICD_ISENABLER(0) ... GICD_ISENABLER(31) + 3: {
-            u32 isen;
+            u32 isen = 0;
             irq_num = (offset - GICD_ISENABLER(0)) / sizeof(u32) * 32; // 计算中断号
             for(int i = 0; i < 32; i++) {
                 irq = vgic_irq_get(vcpu, irq_num + i);
@@ -212,7 +420,7 @@ static int vgicd_read(struct vcpu *vcpu, u64 offset, u64 *val, struct vmmio_acce
             goto finished;
     }
 
-    LOG_WARN("[vgicd_read] Unable to handle the GICD_* request\n");
+    LOG_WARN_RATELIMITED("[vgicd_read] Unable to handle the GICD_* request\n");
     arch_spin_unlock(&vgic_dist->lock);
     return -1;
 
@@ -303,7 +511,7 @@ static int vgicd_write(struct vcpu *vcpu, u64 offset, u64 val, struct vmmio_acce
             goto finished;
     }
 
-    LOG_WARN("[vgicd_write] Unable to handle the GICD_* request\n");
+    LOG_WARN_RATELIMITED("[vgicd_write] Unable to handle the GICD_* request\n");
     arch_spin_unlock(&vgic_dist->lock);
     return -1;
 
@@ -319,8 +527,8 @@ static int vgicr_read(struct vcpu *vcpu, u64 offset, u64 *val, struct vmmio_acce
     int irq_num;
     struct vgicv3_irq_config *irq;
 
-    if(gicr_index > (u32)vcpu->vm->nvcpu) {
-        LOG_WARN("Invalid gic redistributor access\n");
+    if(gicr_index >= (u32)vcpu->vm->nvcpu) {
+        LOG_WARN_RATELIMITED("Invalid gic redistributor access\n");
         return -1;
     }
 
@@ -332,14 +540,22 @@ static int vgicr_read(struct vcpu *vcpu, u64 offset, u64 *val, struct vmmio_acce
         case GICR_IGROUPR0:
             *val = 0;
             return 0;
+        /* vcpus are not tied to a physical redistributor, identify as the first one */
         case GICR_IIDR:
-            *val = GICR_READ32(vcpu->cpuid, GICR_IIDR);
+            *val = GICR_READ32(0, GICR_IIDR);
             return 0;
-        case GICR_TYPER:
-            *val = GICR_READ64(vcpu->cpuid, GICR_TYPER);
+        case GICR_TYPER: {
+            /* Affinity = vcpu mpidr, Processor_Number = vcpuid, Last for the last vcpu */
+            u64 typer = (vcpu->sys_regs.mpidr_el1 & 0xff) << 32;
+            typer |= (u64)vcpu->cpuid << 8;
+            if(vcpu->cpuid == vcpu->vm->nvcpu - 1) {
+                typer |= GICR_TYPER_LAST;
+            }
+            *val = typer;
             return 0;
+        }
         case GICR_PIDR2:
-            *val = GICR_READ32(vcpu->cpuid, GICR_PIDR2);
+            *val = GICR_READ32(0, GICR_PIDR2);
             return 0;
         case GICR_ISENABLER0: {
             u32 isen = 0;
@@ -377,7 +593,7 @@ static int vgicr_read(struct vcpu *vcpu, u64 offset, u64 *val, struct vmmio_acce
             return 0;
     }
 
-    LOG_WARN("[vgicr_read] Unable to handle the GICR_* request\n");
+    LOG_WARN_RATELIMITED("[vgicr_read] Unable to handle the GICR_* request\n");
     return 0;
 }
 
@@ -388,8 +604,8 @@ static int vgicr_write(struct vcpu *vcpu, u64 offset, u64 val, struct vmmio_acce
     int irq_num;
     struct vgicv3_irq_config *irq;
 
-    if(gicr_index > (u32)vcpu->vm->nvcpu) {
-        LOG_WARN("Invalid gic redistributor access\n");
+    if(gicr_index >= (u32)vcpu->vm->nvcpu) {
+        LOG_WARN_RATELIMITED("Invalid gic redistributor access\n");
         return -1;
     }
 
@@ -429,7 +645,7 @@ static int vgicr_write(struct vcpu *vcpu, u64 offset, u64 val, struct vmmio_acce
             return 0;
     }
 
-    LOG_WARN("[vgicr_write] Unable to handle the GICR_* request\n");
+    LOG_WARN_RATELIMITED("[vgicr_write] Unable to handle the GICR_* request\n");
     return -1;
 }
 
@@ -443,13 +659,64 @@ struct vgicv3_dist *create_vgic_dist(struct vm *vm)
     /* 0 ~ 31 for SGIs and PPIs */
     vgic_dist->nspis = gic_max_spi - 31;
     vgic_dist->enabled = 0;
-    vgic_dist->spis = (struct vgicv3_irq_config *)xmalloc(vgic_dist->nspis);
+    vgic_dist->spis = (struct vgicv3_irq_config *)xmalloc(vgic_dist->nspis * sizeof(struct vgicv3_irq_config));
     if(vgic_dist->spis == NULL) {
         abort("Unable to alloc vgic_dist->spis, no memory");
     }
+    arch_spinlock_init(&vgic_dist->lock);
 
-    create_mmio_trap(vm, GICD_BASE, GICD_SIZE, vgicd_read, vgicd_write);
-    create_mmio_trap(vm, GICR_BASE, GICR_SIZE, vgicr_read, vgicr_write);
+    /* disabled and targeting vcpu 0 until the guest says otherwise */
+    for(struct vgicv3_irq_config *v = vgic_dist->spis; v < &vgic_dist->spis[vgic_dist->nspis]; v++) {
+        v->priority = 0;
+        v->enabled = 0;
+        v->affinity = 1;
+        v->group = 1;
+    }
+
+    create_mmio_trap(vm, "vgicd", GICD_BASE, GICD_SIZE, vgicd_read, vgicd_write);
+    create_mmio_trap(vm, "vgicr", GICR_BASE, VGICR_SIZE, vgicr_read, vgicr_write);
 
     return vgic_dist;
 }
+
+/* 虚拟SGI: 不再发送物理SGI，直接投递到目标vcpu */
+static int vgicv3_generate_sgi(struct vcpu *vcpu, u32 sysreg, u64 *val, bool wr)
+{
+    u64  regs_sgi = *val;
+    u16  target   = regs_sgi & 0xFFFF;
+    u8   aff1     = (regs_sgi >> 16) & 0xFF;
+    u8   intid    = (regs_sgi >> 24) & 0xF;
+    bool irm      = (regs_sgi >> 40) & 0x1;
+    struct vm *vm = vcpu->vm;
+
+    if(!wr) {
+        return -1;
+    }
+
+    for(int i = 0; i < vm->nvcpu; i++) {
+        struct vcpu *t = vm->vcpus[i];
+        if(irm) {
+            /* all PEs except self */
+            if(t == vcpu) {
+                continue;
+            }
+        } else {
+            /* vcpu mpidr only uses Aff0 */
+            u64 mpidr = t->sys_regs.mpidr_el1;
+            if(aff1 != ((mpidr >> 8) & 0xFF) || !(target & (1 << (mpidr & 0xF)))) {
+                continue;
+            }
+        }
+        vgic_inject(t, intid, false);
+    }
+
+    return 0;
+}
+
+#define VSYSREG_ICC_SGI1R_EL1   SYSREG_OPCODE(3, 0, 12, 11, 5)
+
+/* Guest GIC system registers the hypervisor emulates */
+void vgic_trap_init(void)
+{
+    trap_sysreg_register(VSYSREG_ICC_SGI1R_EL1, vgicv3_generate_sgi);
+}
@@ -0,0 +1,404 @@
+#define XLOG_SUBSYS XLOG_VIRTIO
+
+#include <types.h>
+#include <arch.h>
+#include <layout.h>
+#include <spinlock.h>
+#include <xmalloc.h>
+#include <kalloc.h>
+#include <utils.h>
+#include <xlog.h>
+#include <printf.h>
+#include <vm.h>
+#include <virtio.h>
+#include <virtio_blk.h>
+
+/*
+ * virtio-blk on an in-memory disk. The base image is linked into the
+ * hypervisor like the rootfs and never written, so any number of vms can
+ * share it. Each vm writes to its own copy-on-write overlay of hypervisor
+ * pages, a page is copied from the base on its first write only.
+ *
+ * Requests move data straight between the guest buffers and the page that
+ * holds the block, the overlay page or the base image in place, without
+ * going through a bounce buffer. Blocks past the end of the image read as
+ * zeros until written.
+ */
+
+struct vblk {
+    struct vblk *next;
+    struct vm *vm;
+    struct virtio_dev *dev;
+
+    guest_t *image;             /* base image, NULL for an empty disk */
+    u64   size;                 /* in bytes, a multiple of the sector size */
+    char ***overlay;            /* written pages, under the request queue lock */
+
+    u64   reads;
+    u64   writes;
+    u64   read_bytes;
+    u64   write_bytes;
+    u64   flushes;
+    u64   errors;
+    u64   cow_pages;            /* overlay pages allocated */
+};
+
+struct virtio_blk_req_hdr {
+    u32 type;
+    u32 reserved;
+    u64 sector;
+};
+
+struct virtio_blk_config {
+    u64 capacity;               /* in 512 byte sectors */
+    u32 size_max;
+    u32 seg_max;
+    u16 cylinders;
+    u8  heads;
+    u8  sectors;
+    u32 blk_size;
+};
+
+static struct vblk *vblks;
+/* source of the blocks no one wrote, shared by all disks */
+static char *vblk_zero_page;
+
+static u64 vblk_image_size(struct vblk *vb)
+{
+    return vb->image == NULL ? 0 : vb->image->image_size;
+}
+
+/*
+ * The overlay page holding the byte at pos, NULL if it was never written.
+ * With alloc the page is created, filled from the base image unless the
+ * caller overwrites it whole.
+ */
+static char *vblk_overlay(struct vblk *vb, u64 pos, bool alloc, bool whole)
+{
+    u64 pfn = pos / PAGESIZE;
+    char **l2 = vb->overlay[pfn / VBLK_PTRS_PER_PAGE];
+    char *page;
+
+    if(l2 == NULL) {
+        if(!alloc) {
+            return NULL;
+        }
+        l2 = alloc_one_page();
+        if(l2 == NULL) {
+            return NULL;
+        }
+        vb->overlay[pfn / VBLK_PTRS_PER_PAGE] = l2;
+    }
+
+    page = l2[pfn % VBLK_PTRS_PER_PAGE];
+    if(page == NULL && alloc) {
+        u64 start = pfn * PAGESIZE;
+
+        page = alloc_one_page();
+        if(page == NULL) {
+            return NULL;
+        }
+        /* pages come zeroed, only the part the image covers is copied */
+        if(!whole && start < vblk_image_size(vb)) {
+            u64 n = vblk_image_size(vb) - start;
+            memcpy(page, (char *)vb->image->start_addr + start, n < PAGESIZE ? n : PAGESIZE);
+        }
+        l2[pfn % VBLK_PTRS_PER_PAGE] = page;
+        vb->cow_pages++;
+    }
+    return page;
+}
+
+/* Disk [pos, pos + len) to the guest at ipa, returns the bytes copied */
+static u64 vblk_read(struct vblk *vb, u64 pos, u64 ipa, u64 len)
+{
+    u64 done = 0;
+
+    while(done < len) {
+        u64 off = pos + done;
+        u64 n = PAGESIZE - (off & (PAGESIZE - 1));
+        const char *src;
+        char *page;
+
+        if(n > len - done) {
+            n = len - done;
+        }
+
+        page = vblk_overlay(vb, off, false, false);
+        if(page != NULL) {
+            src = page + (off & (PAGESIZE - 1));
+        } else if(off < vblk_image_size(vb)) {
+            /* the shared base image, in place */
+            src = (char *)vb->image->start_addr + off;
+            if(n > vblk_image_size(vb) - off) {
+                n = vblk_image_size(vb) - off;
+            }
+        } else {
+            src = vblk_zero_page;
+        }
+
+        if(virtio_copy_to_guest(vb->vm, ipa + done, src, n) != n) {
+            break;
+        }
+        done += n;
+    }
+    return done;
+}
+
+/* The guest at ipa to disk [pos, pos + len), returns the bytes copied */
+static u64 vblk_write(struct vblk *vb, u64 pos, u64 ipa, u64 len)
+{
+    u64 done = 0;
+
+    while(done < len) {
+        u64 off = pos + done;
+        u64 n = PAGESIZE - (off & (PAGESIZE - 1));
+        char *page;
+
+        if(n > len - done) {
+            n = len - done;
+        }
+
+        page = vblk_overlay(vb, off, true, n == PAGESIZE);
+        if(page == NULL) {
+            LOG_WARN_RATELIMITED("No page for the disk overlay of %s\n", vb->vm->name);
+            break;
+        }
+        if(virtio_copy_from_guest(vb->vm, page + (off & (PAGESIZE - 1)), ipa + done, n) != n) {
+            break;
+        }
+        done += n;
+    }
+    return done;
+}
+
+/*
+ * The data of a request: all its buffers but the header at the start of
+ * the first one and the status byte at the end of the last one.
+ */
+static void vblk_data_seg(struct virtq_req *req, int i, u64 *ipa, u64 *len)
+{
+    struct virtq_seg *seg = &req->segs[i];
+    u64 start = i == 0 ? sizeof(struct virtio_blk_req_hdr) : 0;
+    u64 end = i == req->nsegs - 1 ? seg->len - 1 : seg->len;
+
+    *ipa = seg->ipa + start;
+    *len = end > start ? end - start : 0;
+}
+
+static u8 vblk_rw(struct vblk *vb, struct virtq_req *req, bool in, u64 sector, u32 *written)
+{
+    u64 pos = sector * VIRTIO_BLK_SECTOR_SIZE;
+    u64 total = 0;
+    u64 ipa, len;
+
+    for(int i = 0; i < req->nsegs; i++) {
+        vblk_data_seg(req, i, &ipa, &len);
+        if(len > 0 && req->segs[i].write != in) {
+            return VIRTIO_BLK_S_IOERR;
+        }
+        total += len;
+    }
+    if(total % VIRTIO_BLK_SECTOR_SIZE != 0 || sector > vb->size / VIRTIO_BLK_SECTOR_SIZE ||
+       total > vb->size - pos) {
+        return VIRTIO_BLK_S_IOERR;
+    }
+
+    for(int i = 0; i < req->nsegs; i++) {
+        vblk_data_seg(req, i, &ipa, &len);
+        if(len == 0) {
+            continue;
+        }
+        if((in ? vblk_read(vb, pos, ipa, len) : vblk_write(vb, pos, ipa, len)) != len) {
+            return VIRTIO_BLK_S_IOERR;
+        }
+        pos += len;
+    }
+
+    if(in) {
+        vb->reads++;
+        vb->read_bytes += total;
+        *written += total;
+    } else {
+        vb->writes++;
+        vb->write_bytes += total;
+    }
+    return VIRTIO_BLK_S_OK;
+}
+
+static u8 vblk_get_id(struct vblk *vb, struct virtq_req *req, u32 *written)
+{
+    char id[VIRTIO_BLK_ID_BYTES] = { 0 };
+    const char *prefix = "xhyper-";
+    u64 n = 0, ipa, len;
+
+    /* not nul terminated when it fills the field */
+    for(const char *s = prefix; *s && n < sizeof(id); s++) {
+        id[n++] = *s;
+    }
+    for(const char *s = vb->vm->name; *s && n < sizeof(id); s++) {
+        id[n++] = *s;
+    }
+
+    n = 0;
+    for(int i = 0; i < req->nsegs && n < sizeof(id); i++) {
+        vblk_data_seg(req, i, &ipa, &len);
+        if(len == 0 || !req->segs[i].write) {
+            continue;
+        }
+        if(len > sizeof(id) - n) {
+            len = sizeof(id) - n;
+        }
+        if(virtio_copy_to_guest(vb->vm, ipa, id + n, len) != len) {
+            return VIRTIO_BLK_S_IOERR;
+        }
+        n += len;
+    }
+    *written += n;
+    return VIRTIO_BLK_S_OK;
+}
+
+/* Serves one request, returns the bytes written to the guest for the used ring */
+static u32 vblk_handle(struct vblk *vb, struct virtq_req *req)
+{
+    struct virtq_seg *last = &req->segs[req->nsegs - 1];
+    struct virtio_blk_req_hdr hdr;
+    u32 written = 0;
+    u8 status;
+
+    /* the header is one readable buffer, the status the end of a writable one */
+    if(req->nsegs < 2 || req->segs[0].write || req->segs[0].len < sizeof(hdr) ||
+       !last->write || last->len == 0) {
+        LOG_WARN_RATELIMITED("Malformed virtio-blk request from %s\n", vb->vm->name);
+        vb->errors++;
+        return 0;
+    }
+    if(virtio_copy_from_guest(vb->vm, &hdr, req->segs[0].ipa, sizeof(hdr)) != sizeof(hdr)) {
+        vb->errors++;
+        return 0;
+    }
+
+    switch(hdr.type) {
+        case VIRTIO_BLK_T_IN:
+        case VIRTIO_BLK_T_OUT:
+            status = vblk_rw(vb, req, hdr.type == VIRTIO_BLK_T_IN, hdr.sector, &written);
+            break;
+        case VIRTIO_BLK_T_FLUSH:
+            /* the overlay is the disk, nothing is cached in front of it */
+            vb->flushes++;
+            status = VIRTIO_BLK_S_OK;
+            break;
+        case VIRTIO_BLK_T_GET_ID:
+            status = vblk_get_id(vb, req, &written);
+            break;
+        default:
+            status = VIRTIO_BLK_S_UNSUPP;
+            break;
+    }
+    if(status != VIRTIO_BLK_S_OK) {
+        vb->errors++;
+    }
+
+    if(virtio_copy_to_guest(vb->vm, last->ipa + last->len - 1, &status, 1) == 1) {
+        written++;
+    }
+    return written;
+}
+
+static void vblk_notify(struct virtio_dev *dev, int queue)
+{
+    struct vblk *vb = dev->priv;
+    struct virtq *vq = &dev->vqs[VBLK_REQQ];
+    struct virtq_req req;
+    bool used = false;
+
+    /* everything the guest queued, completed with one interrupt */
+    arch_spin_lock(&vq->lock);
+    while(virtq_pop(dev, vq, &req) > 0) {
+        virtq_push(dev, vq, req.head, vblk_handle(vb, &req));
+        used = true;
+    }
+    if(used) {
+        virtq_notify(dev, vq);
+    }
+    arch_spin_unlock(&vq->lock);
+}
+
+static u32 vblk_config_read(struct virtio_dev *dev, u64 offset, int size)
+{
+    struct vblk *vb = dev->priv;
+    struct virtio_blk_config cfg = {
+        .capacity = vb->size / VIRTIO_BLK_SECTOR_SIZE,
+        /* room for the header and the status */
+        .seg_max  = VIRTQ_MAX_SEGS - 2,
+        /* writes then cover whole overlay pages, none copies the base first */
+        .blk_size = PAGESIZE,
+    };
+    u32 val = 0;
+
+    memcpy(&val, (char *)&cfg + offset, size);
+    return val;
+}
+
+static const struct virtio_ops vblk_ops = {
+    .device_id    = VIRTIO_ID_BLOCK,
+    .features     = (1UL << VIRTIO_BLK_F_SEG_MAX) | (1UL << VIRTIO_BLK_F_BLK_SIZE) |
+                    (1UL << VIRTIO_BLK_F_FLUSH),
+    .nqueues      = 1,
+    .config_size  = sizeof(struct virtio_blk_config),
+    .notify       = vblk_notify,
+    .config_read  = vblk_config_read,
+};
+
+/*
+ * A disk of size bytes on top of image, at least as large as the image
+ * when size is 0. Either may be missing, but not both.
+ */
+struct vblk *vblk_create(struct vm *vm, guest_t *image, u64 size)
+{
+    struct vblk *vb = (struct vblk *)xmalloc(sizeof(struct vblk));
+    if(vb == NULL) {
+        abort("Unable to alloc a virtio block device, no memory");
+    }
+    memset(vb, 0, sizeof(struct vblk));
+
+    if(size == 0 && image != NULL) {
+        size = image->image_size;
+    }
+    size = ALIGN_PAGE(size);
+    if(size == 0 || size > VBLK_MAX_SIZE) {
+        abort("Bad virtio-blk disk size %d KiB for %s", (u32)(size >> 10), vm->name);
+    }
+
+    if(vblk_zero_page == NULL) {
+        vblk_zero_page = alloc_one_page();
+    }
+    vb->overlay = (char ***)alloc_one_page();
+    if(vb->overlay == NULL || vblk_zero_page == NULL) {
+        abort("Unable to alloc the virtio-blk overlay");
+    }
+    vb->vm    = vm;
+    vb->image = image;
+    vb->size  = size;
+
+    vb->dev = virtio_dev_create(vm, &vblk_ops, vb);
+    if(vb->dev == NULL) {
+        abort("No virtio slot left for the disk of %s", vm->name);
+    }
+
+    vb->next = vblks;
+    vblks = vb;
+
+    LOG_INFO("%s: virtio-blk on slot %d, %d KiB over %s\n", vm->name, vb->dev->slot,
+             (u32)(size >> 10), image != NULL ? image->guest_name : "nothing");
+    return vb;
+}
+
+void vblk_dump(void)
+{
+    for(struct vblk *vb = vblks; vb != NULL; vb = vb->next) {
+        printf("  %s disk: %d reads %d KiB, %d writes %d KiB, %d flushes, %d errors, %d overlay pages\n",
+               vb->vm->name, (u32)vb->reads, (u32)(vb->read_bytes >> 10), (u32)vb->writes,
+               (u32)(vb->write_bytes >> 10), (u32)vb->flushes, (u32)vb->errors, (u32)vb->cow_pages);
+    }
+}
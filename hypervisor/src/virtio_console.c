@@ -0,0 +1,369 @@
+#define XLOG_SUBSYS XLOG_VIRTIO
+
+#include <types.h>
+#include <arch.h>
+#include <layout.h>
+#include <spinlock.h>
+#include <xmalloc.h>
+#include <kalloc.h>
+#include <utils.h>
+#include <xlog.h>
+#include <printf.h>
+#include <gicv3.h>
+#include <pl011.h>
+#include <logbuf.h>
+#include <vm.h>
+#include <virtio.h>
+#include <virtio_console.h>
+
+/*
+ * virtio-console, one port per vm. The transmit queue is drained a batch
+ * at a time into a per-vm output ring, so a guest pays one exit per
+ * buffer and not per character. The rings are multiplexed onto the uart
+ * with the hypervisor log by logbuf.c: lines of different sources are not
+ * mixed, and with more than one vm every line is prefixed with its name.
+ * Uart input goes to the console that has the focus (see console.c)
+ * through the receive queue.
+ *
+ * A vm with a virtio console does not get the pl011 passed through, and
+ * the uart interrupt then belongs to the hypervisor.
+ */
+
+struct vconsole {
+    struct vconsole *next;
+    struct vm *vm;
+    struct virtio_dev *dev;
+
+    /* guest output: produced under the transmit queue lock, consumed under uart_lock */
+    char *out;
+    volatile u32 out_head;
+    volatile u32 out_tail;
+    bool bol;                   /* the uart is at the start of one of our lines */
+
+    /* uart input, under the receive queue lock */
+    char in[VCONSOLE_IN_SIZE];
+    u32  in_head;
+    u32  in_tail;
+
+    u64  tx_bytes;
+    u64  tx_batches;            /* transmit queue notifications */
+    u64  rx_bytes;
+};
+
+static struct vconsole *vconsoles;
+static int nr_vconsoles;
+/* console that stopped in the middle of a line on the uart, uart_lock held */
+static struct vconsole *mux_partial;
+
+static void vconsole_put_out(struct vconsole *vc, char c)
+{
+    vc->out[vc->out_head % VCONSOLE_OUT_SIZE] = c;
+    dmb(ishst);
+    vc->out_head++;
+}
+
+/* Copy len bytes of guest output at ipa into the ring, waiting on the uart when it is full */
+static void vconsole_copy_out(struct vconsole *vc, u64 ipa, u32 len)
+{
+    while(len > 0) {
+        u32 head = vc->out_head;
+        u32 space = VCONSOLE_OUT_SIZE - (head - vc->out_tail);
+        if(space == 0) {
+            /* the guest writes faster than the uart goes, it waits like on a real one */
+            logbuf_flush();
+            continue;
+        }
+
+        u32 off = head % VCONSOLE_OUT_SIZE;
+        u32 n = len;
+        if(n > space) {
+            n = space;
+        }
+        if(n > VCONSOLE_OUT_SIZE - off) {
+            n = VCONSOLE_OUT_SIZE - off;
+        }
+        if(virtio_copy_from_guest(vc->vm, vc->out + off, ipa, n) != n) {
+            return;
+        }
+        /* the drainer sees head only after the bytes */
+        dmb(ishst);
+        vc->out_head = head + n;
+        vc->tx_bytes += n;
+        ipa += n;
+        len -= n;
+    }
+}
+
+static void vconsole_tx(struct vconsole *vc)
+{
+    struct virtio_dev *dev = vc->dev;
+    struct virtq *vq = &dev->vqs[VCONSOLE_TXQ];
+    struct virtq_req req;
+    bool used = false;
+
+    arch_spin_lock(&vq->lock);
+    while(virtq_pop(dev, vq, &req) > 0) {
+        for(int i = 0; i < req.nsegs; i++) {
+            if(!req.segs[i].write) {
+                vconsole_copy_out(vc, req.segs[i].ipa, req.segs[i].len);
+            }
+        }
+        virtq_push(dev, vq, req.head, 0);
+        used = true;
+    }
+    if(used) {
+        virtq_notify(dev, vq);
+    }
+    vc->tx_batches++;
+    arch_spin_unlock(&vq->lock);
+
+    /* push out what the uart fifo takes now, idle pcpus do the rest */
+    logbuf_drain();
+}
+
+/* Hand buffered input to the guest's receive buffers, receive queue lock held */
+static void vconsole_rx_locked(struct vconsole *vc)
+{
+    struct virtio_dev *dev = vc->dev;
+    struct virtq *vq = &dev->vqs[VCONSOLE_RXQ];
+    struct virtq_req req;
+    bool used = false;
+
+    while(vc->in_head != vc->in_tail && virtq_pop(dev, vq, &req) > 0) {
+        u32 len = 0;
+
+        for(int i = 0; i < req.nsegs && vc->in_head != vc->in_tail; i++) {
+            struct virtq_seg *seg = &req.segs[i];
+            u32 done = 0;
+
+            if(!seg->write) {
+                continue;
+            }
+            while(done < seg->len && vc->in_head != vc->in_tail) {
+                u32 off = vc->in_tail % VCONSOLE_IN_SIZE;
+                u32 n = vc->in_head - vc->in_tail;
+                if(n > VCONSOLE_IN_SIZE - off) {
+                    n = VCONSOLE_IN_SIZE - off;
+                }
+                if(n > seg->len - done) {
+                    n = seg->len - done;
+                }
+                if(virtio_copy_to_guest(vc->vm, seg->ipa + done, vc->in + off, n) != n) {
+                    break;
+                }
+                vc->in_tail += n;
+                done += n;
+            }
+            len += done;
+        }
+        vc->rx_bytes += len;
+        virtq_push(dev, vq, req.head, len);
+        used = true;
+    }
+    if(used) {
+        virtq_notify(dev, vq);
+    }
+}
+
+void vconsole_input(struct vconsole *vc, char c)
+{
+    struct virtq *vq = &vc->dev->vqs[VCONSOLE_RXQ];
+
+    arch_spin_lock(&vq->lock);
+    /* dropped if the guest does not read */
+    if(vc->in_head - vc->in_tail < VCONSOLE_IN_SIZE) {
+        vc->in[vc->in_head++ % VCONSOLE_IN_SIZE] = c;
+    }
+    vconsole_rx_locked(vc);
+    arch_spin_unlock(&vq->lock);
+}
+
+static void vconsole_notify(struct virtio_dev *dev, int queue)
+{
+    struct vconsole *vc = dev->priv;
+
+    if(queue == VCONSOLE_TXQ) {
+        vconsole_tx(vc);
+    } else {
+        /* new receive buffers, input may be waiting for them */
+        struct virtq *vq = &dev->vqs[VCONSOLE_RXQ];
+        arch_spin_lock(&vq->lock);
+        vconsole_rx_locked(vc);
+        arch_spin_unlock(&vq->lock);
+    }
+}
+
+static void vconsole_reset(struct virtio_dev *dev)
+{
+    struct vconsole *vc = dev->priv;
+    struct virtq *vq = &dev->vqs[VCONSOLE_RXQ];
+
+    /* what the guest already wrote still goes out */
+    arch_spin_lock(&vq->lock);
+    vc->in_tail = vc->in_head;
+    arch_spin_unlock(&vq->lock);
+}
+
+/* struct virtio_console_config: cols, rows (u16), max_nr_ports, emerg_wr (u32) */
+static u32 vconsole_config_read(struct virtio_dev *dev, u64 offset, int size)
+{
+    /* no size, one port */
+    return offset == 4 ? 1 : 0;
+}
+
+static void vconsole_config_write(struct virtio_dev *dev, u64 offset, u32 val, int size)
+{
+    struct vconsole *vc = dev->priv;
+    struct virtq *vq = &dev->vqs[VCONSOLE_TXQ];
+
+    /* emerg_wr, usable before the queues are set up */
+    if(offset == 8) {
+        arch_spin_lock(&vq->lock);
+        if(VCONSOLE_OUT_SIZE - (vc->out_head - vc->out_tail) == 0) {
+            logbuf_flush();
+        }
+        vconsole_put_out(vc, val & 0xFF);
+        vc->tx_bytes++;
+        arch_spin_unlock(&vq->lock);
+        logbuf_drain();
+    }
+}
+
+static const struct virtio_ops vconsole_ops = {
+    .device_id    = VIRTIO_ID_CONSOLE,
+    .features     = 1UL << VIRTIO_CONSOLE_F_EMERG_WRITE,
+    .nqueues      = 2,
+    .config_size  = 12,
+    .reset        = vconsole_reset,
+    .notify       = vconsole_notify,
+    .config_read  = vconsole_config_read,
+    .config_write = vconsole_config_write,
+};
+
+struct vconsole *vconsole_create(struct vm *vm)
+{
+    struct vconsole *vc = (struct vconsole *)xmalloc(sizeof(struct vconsole));
+    if(vc == NULL) {
+        abort("Unable to alloc a virtio console, no memory");
+    }
+    memset(vc, 0, sizeof(struct vconsole));
+
+    vc->out = alloc_one_page();
+    if(vc->out == NULL) {
+        abort("Unable to alloc the virtio console ring");
+    }
+    vc->vm  = vm;
+    vc->bol = true;
+
+    vc->dev = virtio_dev_create(vm, &vconsole_ops, vc);
+    if(vc->dev == NULL) {
+        abort("No virtio slot left for the console of %s", vm->name);
+    }
+
+    /* published last, the multiplexer walks the list without a lock */
+    vc->next = vconsoles;
+    dmb(ishst);
+    vconsoles = vc;
+    nr_vconsoles++;
+
+    /* uart input comes to the hypervisor from now on */
+    gicv3_ops.unmask(UART_IRQ_LINE);
+    return vc;
+}
+
+/* The console after vc, or the first one for NULL. NULL after the last. */
+struct vconsole *vconsole_next(struct vconsole *vc)
+{
+    return vc == NULL ? vconsoles : vc->next;
+}
+
+const char *vconsole_name(struct vconsole *vc)
+{
+    return vc->vm->name;
+}
+
+bool vconsole_owns_uart(void)
+{
+    return vconsoles != NULL;
+}
+
+bool vconsole_pending(void)
+{
+    for(struct vconsole *vc = vconsoles; vc != NULL; vc = vc->next) {
+        if(vc->out_tail != vc->out_head) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Another source takes the uart, end the line a console left open */
+void vconsole_break_line(void)
+{
+    if(mux_partial != NULL) {
+        pl011_putc('\n');
+        mux_partial->bol = true;
+        mux_partial = NULL;
+    }
+}
+
+static void vconsole_prefix(struct vconsole *vc)
+{
+    const char *s = vc->vm->name;
+
+    /* a few bytes, written synchronously */
+    pl011_putc('[');
+    while(*s) {
+        pl011_putc(*s++);
+    }
+    pl011_puts("] ");
+}
+
+/*
+ * Push console output to the uart, uart_lock held. Without wait it stops
+ * as soon as the fifo is full. Returns whether everything went out.
+ */
+bool vconsole_drain_locked(bool wait)
+{
+    for(struct vconsole *vc = vconsoles; vc != NULL; vc = vc->next) {
+        u32 tail = vc->out_tail;
+        u32 head = vc->out_head;
+        dmb(ishld);
+
+        while(tail != head) {
+            char c = vc->out[tail % VCONSOLE_OUT_SIZE];
+
+            if(mux_partial != vc) {
+                vconsole_break_line();
+            }
+            if(vc->bol) {
+                if(nr_vconsoles > 1) {
+                    vconsole_prefix(vc);
+                }
+                vc->bol = false;
+                mux_partial = vc;
+            }
+            if(wait) {
+                pl011_putc(c);
+            } else if(!pl011_try_putc(c)) {
+                vc->out_tail = tail;
+                return false;
+            }
+            tail++;
+            if(c == '\n') {
+                vc->bol = true;
+                mux_partial = NULL;
+            }
+        }
+        vc->out_tail = tail;
+    }
+    return true;
+}
+
+void vconsole_dump(void)
+{
+    for(struct vconsole *vc = vconsoles; vc != NULL; vc = vc->next) {
+        printf("  %s console: tx %d bytes in %d batches, rx %d bytes, %d bytes queued\n", vc->vm->name,
+               (u32)vc->tx_bytes, (u32)vc->tx_batches, (u32)vc->rx_bytes, vc->out_head - vc->out_tail);
+    }
+}
@@ -0,0 +1,607 @@
+#define XLOG_SUBSYS XLOG_VIRTIO
+
+#include <types.h>
+#include <arch.h>
+#include <layout.h>
+#include <spinlock.h>
+#include <xmalloc.h>
+#include <utils.h>
+#include <printf.h>
+#include <xlog.h>
+#include <trace.h>
+#include <vmm.h>
+#include <vm.h>
+#include <vcpu.h>
+#include <vmmio.h>
+#include <vgicv3.h>
+#include <virtio.h>
+#include <iopoll.h>
+
+/*
+ * virtio-mmio v2 transport. The 32 slots of the QEMU virt layout (see the
+ * virtio_mmio nodes of virt.dts) are one trap per vm, a slot without a
+ * device reads as device id 0 which the guest driver skips. Device models
+ * register a struct virtio_ops and process their virtqueues on notify.
+ *
+ * Lock order: dev->lock (register file) before vq->lock. The used ring
+ * side never takes dev->lock, InterruptStatus is updated atomically.
+ *
+ * Notifications in both directions follow VIRTIO_F_EVENT_IDX when the
+ * driver takes it. With a polling pcpu (iopoll.c) the drivers are asked
+ * never to notify, and virtio_poll() finds the new buffers instead.
+ */
+
+/* offered for every device, on top of its own */
+#define VIRTIO_TRANSPORT_FEATURES   ((1UL << VIRTIO_F_VERSION_1) | (1UL << VIRTIO_F_EVENT_IDX))
+
+/* every device of every vm, for the console */
+static struct virtio_dev *virtio_devs;
+static spinlock_t virtio_devs_lock = {.coreid = -1, .lock = 0, .name = "virtio_devs_lock"};
+
+/*
+ * Hypervisor pointer to [ipa, ipa + size) of a vm. Guest pages are not
+ * contiguous in PA, so a ring is only usable if its pages happen to be.
+ */
+static void *virtio_map(struct vm *vm, u64 ipa, u64 size)
+{
+    u64 pa = ipa_to_pa(vm->vttbr, ipa);
+    if(pa == 0) {
+        return NULL;
+    }
+
+    u64 page = ipa & ~(u64)(PAGESIZE - 1);
+    for(u64 p = page + PAGESIZE; p < ipa + size; p += PAGESIZE) {
+        if(ipa_to_pa(vm->vttbr, p) != pa + (p - ipa)) {
+            return NULL;
+        }
+    }
+    return (void *)pa;
+}
+
+u64 virtio_copy_from_guest(struct vm *vm, void *dst, u64 ipa, u64 len)
+{
+    u64 done = 0;
+
+    while(done < len) {
+        u64 pa = ipa_to_pa(vm->vttbr, ipa + done);
+        if(pa == 0) {
+            break;
+        }
+        u64 n = PAGESIZE - ((ipa + done) & (PAGESIZE - 1));
+        if(n > len - done) {
+            n = len - done;
+        }
+        memcpy((char *)dst + done, (void *)pa, n);
+        done += n;
+    }
+    return done;
+}
+
+u64 virtio_copy_to_guest(struct vm *vm, u64 ipa, const void *src, u64 len)
+{
+    u64 done = 0;
+
+    while(done < len) {
+        u64 pa = ipa_to_pa(vm->vttbr, ipa + done);
+        if(pa == 0) {
+            break;
+        }
+        u64 n = PAGESIZE - ((ipa + done) & (PAGESIZE - 1));
+        if(n > len - done) {
+            n = len - done;
+        }
+        memcpy((void *)pa, (const char *)src + done, n);
+        done += n;
+    }
+    return done;
+}
+
+/* Guest to guest, the one copy between the buffers of two vms */
+u64 virtio_copy_between(struct vm *dst_vm, u64 dst_ipa, struct vm *src_vm, u64 src_ipa, u64 len)
+{
+    u64 done = 0;
+
+    while(done < len) {
+        u64 dst = ipa_to_pa(dst_vm->vttbr, dst_ipa + done);
+        u64 src = ipa_to_pa(src_vm->vttbr, src_ipa + done);
+        if(dst == 0 || src == 0) {
+            break;
+        }
+        u64 n = PAGESIZE - ((dst_ipa + done) & (PAGESIZE - 1));
+        u64 m = PAGESIZE - ((src_ipa + done) & (PAGESIZE - 1));
+        if(n > m) {
+            n = m;
+        }
+        if(n > len - done) {
+            n = len - done;
+        }
+        memcpy((void *)dst, (void *)src, n);
+        done += n;
+    }
+    return done;
+}
+
+bool virtio_has_feature(struct virtio_dev *dev, int bit)
+{
+    return (dev->driver_features >> bit) & 0x1;
+}
+
+static void virtio_raise(struct virtio_dev *dev, u32 bits)
+{
+    __atomic_fetch_or(&dev->isr, bits, __ATOMIC_RELEASE);
+    /* edge triggered SPI, the guest routes the virtio interrupts to cpu 0 */
+    vgic_inject(dev->vm->vcpus[0], dev->irq, false);
+}
+
+void virtio_config_changed(struct virtio_dev *dev)
+{
+    __atomic_fetch_add(&dev->config_generation, 1, __ATOMIC_RELAXED);
+    virtio_raise(dev, VIRTIO_MMIO_INT_CONFIG);
+}
+
+/* A broken ring: stop using the device until the driver resets it */
+static void virtio_dev_fail(struct virtio_dev *dev)
+{
+    __atomic_fetch_or(&dev->status, VIRTIO_STATUS_NEEDS_RESET, __ATOMIC_RELAXED);
+    virtio_config_changed(dev);
+}
+
+/* Tell the driver whether to notify of the buffers it makes available next, vq->lock held */
+static void virtq_arm(struct virtio_dev *dev, struct virtq *vq)
+{
+    int q = vq - dev->vqs;
+    bool kick = !iopoll_active() && !(dev->ops->no_notify & (1U << q));
+
+    if(virtio_has_feature(dev, VIRTIO_F_EVENT_IDX)) {
+        /* half the index space ahead, a driver never gets that far */
+        vring_avail_event(vq) = kick ? vq->last_avail : (u16)(vq->last_avail + 0x8000);
+    } else {
+        vq->used->flags = kick ? 0 : VRING_USED_F_NO_NOTIFY;
+    }
+}
+
+/*
+ * Take the next descriptor chain made available by the driver, with
+ * vq->lock held. Returns 1 with req filled, 0 if the ring is empty and
+ * < 0 on a malformed chain.
+ */
+int virtq_pop(struct virtio_dev *dev, struct virtq *vq, struct virtq_req *req)
+{
+    if(!vq->ready || (dev->status & VIRTIO_STATUS_NEEDS_RESET)) {
+        return 0;
+    }
+
+    u16 avail_idx = vq->avail->idx;
+    if(vq->last_avail == avail_idx) {
+        /* ask for a notification, then look again for buffers made available meanwhile */
+        virtq_arm(dev, vq);
+        dmb(ish);
+        avail_idx = vq->avail->idx;
+        if(vq->last_avail == avail_idx) {
+            return 0;
+        }
+    }
+    if((u16)(avail_idx - vq->last_avail) > vq->num) {
+        LOG_WARN_RATELIMITED("virtio slot %d: avail idx %d, last taken %d\n", dev->slot, avail_idx, vq->last_avail);
+        virtio_dev_fail(dev);
+        return -1;
+    }
+    /* the ring entry is read after the index that published it */
+    dmb(ishld);
+
+    u16 idx = vq->avail->ring[vq->last_avail & (vq->num - 1)];
+    vq->last_avail++;
+
+    req->head  = idx;
+    req->nsegs = 0;
+    for(int n = 0; ; n++) {
+        if(idx >= vq->num || n >= vq->num || req->nsegs >= VIRTQ_MAX_SEGS) {
+            LOG_WARN_RATELIMITED("virtio slot %d: bad descriptor chain at %d\n", dev->slot, req->head);
+            virtio_dev_fail(dev);
+            return -1;
+        }
+
+        volatile struct vring_desc *d = &vq->desc[idx];
+        u16 flags = d->flags;
+        struct virtq_seg *seg = &req->segs[req->nsegs++];
+
+        seg->ipa   = d->addr;
+        seg->len   = d->len;
+        seg->write = !!(flags & VRING_DESC_F_WRITE);
+
+        if(!(flags & VRING_DESC_F_NEXT)) {
+            break;
+        }
+        idx = d->next;
+    }
+    return 1;
+}
+
+/* Return a chain to the driver with len bytes written into it, with vq->lock held */
+void virtq_push(struct virtio_dev *dev, struct virtq *vq, u16 head, u32 len)
+{
+    volatile struct vring_used_elem *e = &vq->used->ring[vq->used_idx & (vq->num - 1)];
+
+    e->id  = head;
+    e->len = len;
+    vq->used_idx++;
+    /* the element is visible before the index that publishes it */
+    dmb(ishst);
+    vq->used->idx = vq->used_idx;
+}
+
+/* Interrupt the driver for the used buffers, unless it asked not to be */
+void virtq_notify(struct virtio_dev *dev, struct virtq *vq)
+{
+    /* the used index is published before the driver's wishes are read */
+    dmb(ish);
+    if(virtio_has_feature(dev, VIRTIO_F_EVENT_IDX)) {
+        u16 old = vq->signalled_used;
+        vq->signalled_used = vq->used_idx;
+        if(!vring_need_event(vring_used_event(vq), vq->used_idx, old)) {
+            return;
+        }
+    } else if(vq->avail->flags & VRING_AVAIL_F_NO_INTERRUPT) {
+        return;
+    }
+    dev->interrupts++;
+    virtio_raise(dev, VIRTIO_MMIO_INT_VRING);
+}
+
+static void virtq_reset(struct virtq *vq)
+{
+    arch_spin_lock(&vq->lock);
+    vq->num        = 0;
+    vq->ready      = false;
+    vq->desc_ipa   = 0;
+    vq->avail_ipa  = 0;
+    vq->used_ipa   = 0;
+    vq->desc       = NULL;
+    vq->avail      = NULL;
+    vq->used       = NULL;
+    vq->last_avail = 0;
+    vq->used_idx   = 0;
+    arch_spin_unlock(&vq->lock);
+}
+
+/* QueueReady 1: translate the three rings once, 0 if they are unusable */
+static bool virtq_enable(struct virtio_dev *dev, struct virtq *vq)
+{
+    u16 num = vq->num;
+
+    if(num == 0 || num > VIRTQ_MAX_SIZE || (num & (num - 1)) != 0) {
+        LOG_WARN("virtio slot %d: queue size %d is not supported\n", dev->slot, num);
+        return false;
+    }
+    if((vq->desc_ipa & 15) || (vq->avail_ipa & 1) || (vq->used_ipa & 3)) {
+        LOG_WARN("virtio slot %d: misaligned virtqueue\n", dev->slot);
+        return false;
+    }
+
+    void *desc  = virtio_map(dev->vm, vq->desc_ipa, sizeof(struct vring_desc) * num);
+    void *avail = virtio_map(dev->vm, vq->avail_ipa, sizeof(struct vring_avail) + sizeof(u16) * (num + 1));
+    void *used  = virtio_map(dev->vm, vq->used_ipa, sizeof(struct vring_used) + sizeof(struct vring_used_elem) * num + sizeof(u16));
+    if(desc == NULL || avail == NULL || used == NULL) {
+        LOG_WARN("virtio slot %d: virtqueue not in contiguous guest memory\n", dev->slot);
+        return false;
+    }
+
+    arch_spin_lock(&vq->lock);
+    vq->desc       = desc;
+    vq->avail      = avail;
+    vq->used       = used;
+    vq->last_avail = 0;
+    vq->used_idx   = 0;
+    vq->signalled_used = 0;
+    vq->polled_avail   = 0;
+    vq->ready      = true;
+    virtq_arm(dev, vq);
+    arch_spin_unlock(&vq->lock);
+    return true;
+}
+
+static void virtio_dev_reset(struct virtio_dev *dev)
+{
+    for(int i = 0; i < VIRTIO_MAX_QUEUES; i++) {
+        virtq_reset(&dev->vqs[i]);
+    }
+    dev->status              = 0;
+    dev->device_features_sel = 0;
+    dev->driver_features_sel = 0;
+    dev->driver_features     = 0;
+    dev->queue_sel           = 0;
+    dev->isr                 = 0;
+
+    if(dev->ops->reset) {
+        dev->ops->reset(dev);
+    }
+}
+
+static void virtio_set_status(struct virtio_dev *dev, u32 status)
+{
+    if(status == 0) {
+        virtio_dev_reset(dev);
+        return;
+    }
+
+    /* FEATURES_OK only sticks for a subset of what we offer, and a modern driver */
+    if((status & VIRTIO_STATUS_FEATURES_OK) && !(dev->status & VIRTIO_STATUS_FEATURES_OK)) {
+        u64 offered = dev->ops->features | VIRTIO_TRANSPORT_FEATURES;
+        if((dev->driver_features & ~offered) || !virtio_has_feature(dev, VIRTIO_F_VERSION_1)) {
+            LOG_WARN("virtio slot %d: driver features %p refused\n", dev->slot, dev->driver_features);
+            status &= ~VIRTIO_STATUS_FEATURES_OK;
+        }
+    }
+    dev->status = status;
+}
+
+static struct virtq *virtio_cur_vq(struct virtio_dev *dev)
+{
+    if(dev->queue_sel >= (u32)dev->ops->nqueues) {
+        return NULL;
+    }
+    return &dev->vqs[dev->queue_sel];
+}
+
+static u32 virtio_reg_read(struct virtio_dev *dev, u64 reg, int size)
+{
+    struct virtq *vq = virtio_cur_vq(dev);
+    u64 features = dev->ops->features | VIRTIO_TRANSPORT_FEATURES;
+
+    if(reg >= VIRTIO_MMIO_CONFIG) {
+        reg -= VIRTIO_MMIO_CONFIG;
+        if(dev->ops->config_read == NULL || reg + size > dev->ops->config_size) {
+            return 0;
+        }
+        return dev->ops->config_read(dev, reg, size);
+    }
+
+    switch(reg) {
+        case VIRTIO_MMIO_MAGIC_VALUE:       return VIRTIO_MMIO_MAGIC;
+        case VIRTIO_MMIO_VERSION:           return 2;
+        case VIRTIO_MMIO_DEVICE_ID:         return dev->ops->device_id;
+        case VIRTIO_MMIO_VENDOR_ID:         return VIRTIO_MMIO_VENDOR;
+        case VIRTIO_MMIO_DEVICE_FEATURES:
+            if(dev->device_features_sel > 1) {
+                return 0;
+            }
+            return features >> (32 * dev->device_features_sel);
+        case VIRTIO_MMIO_QUEUE_NUM_MAX:     return vq ? VIRTQ_MAX_SIZE : 0;
+        case VIRTIO_MMIO_QUEUE_NUM:         return vq ? vq->num : 0;
+        case VIRTIO_MMIO_QUEUE_READY:       return vq ? vq->ready : 0;
+        case VIRTIO_MMIO_INTERRUPT_STATUS:  return __atomic_load_n(&dev->isr, __ATOMIC_ACQUIRE);
+        case VIRTIO_MMIO_STATUS:            return dev->status;
+        case VIRTIO_MMIO_QUEUE_DESC_LOW:    return vq ? (u32)vq->desc_ipa : 0;
+        case VIRTIO_MMIO_QUEUE_DESC_HIGH:   return vq ? vq->desc_ipa >> 32 : 0;
+        case VIRTIO_MMIO_QUEUE_AVAIL_LOW:   return vq ? (u32)vq->avail_ipa : 0;
+        case VIRTIO_MMIO_QUEUE_AVAIL_HIGH:  return vq ? vq->avail_ipa >> 32 : 0;
+        case VIRTIO_MMIO_QUEUE_USED_LOW:    return vq ? (u32)vq->used_ipa : 0;
+        case VIRTIO_MMIO_QUEUE_USED_HIGH:   return vq ? vq->used_ipa >> 32 : 0;
+        /* no shared memory regions */
+        case VIRTIO_MMIO_SHM_LEN_LOW:
+        case VIRTIO_MMIO_SHM_LEN_HIGH:
+        case VIRTIO_MMIO_SHM_BASE_LOW:
+        case VIRTIO_MMIO_SHM_BASE_HIGH:     return 0xFFFFFFFF;
+        case VIRTIO_MMIO_CONFIG_GENERATION: return __atomic_load_n(&dev->config_generation, __ATOMIC_RELAXED);
+        default:
+            LOG_WARN_RATELIMITED("virtio slot %d: read of write-only register %x\n", dev->slot, reg);
+            return 0;
+    }
+}
+
+/* Returns the queue the driver notified, or -1 */
+static int virtio_reg_write(struct virtio_dev *dev, u64 reg, u32 val, int size)
+{
+    struct virtq *vq = virtio_cur_vq(dev);
+
+    if(reg >= VIRTIO_MMIO_CONFIG) {
+        reg -= VIRTIO_MMIO_CONFIG;
+        if(dev->ops->config_write != NULL && reg + size <= dev->ops->config_size) {
+            dev->ops->config_write(dev, reg, val, size);
+        }
+        return -1;
+    }
+
+    switch(reg) {
+        case VIRTIO_MMIO_DEVICE_FEATURES_SEL:
+            dev->device_features_sel = val;
+            break;
+        case VIRTIO_MMIO_DRIVER_FEATURES:
+            if(dev->driver_features_sel <= 1) {
+                int shift = 32 * dev->driver_features_sel;
+                dev->driver_features &= ~(0xFFFFFFFFUL << shift);
+                dev->driver_features |= (u64)val << shift;
+            }
+            break;
+        case VIRTIO_MMIO_DRIVER_FEATURES_SEL:
+            dev->driver_features_sel = val;
+            break;
+        case VIRTIO_MMIO_QUEUE_SEL:
+            dev->queue_sel = val;
+            break;
+        case VIRTIO_MMIO_QUEUE_NOTIFY:
+            if(val < (u32)dev->ops->nqueues) {
+                return val;
+            }
+            break;
+        case VIRTIO_MMIO_INTERRUPT_ACK:
+            __atomic_fetch_and(&dev->isr, ~val, __ATOMIC_RELAXED);
+            break;
+        case VIRTIO_MMIO_STATUS:
+            virtio_set_status(dev, val);
+            break;
+        default:
+            /* the queue layout only changes while the queue is off */
+            if(vq == NULL || vq->ready) {
+                if(reg == VIRTIO_MMIO_QUEUE_READY && vq != NULL && val == 0) {
+                    virtq_reset(vq);
+                }
+                break;
+            }
+            switch(reg) {
+                case VIRTIO_MMIO_QUEUE_NUM:        vq->num = val; break;
+                case VIRTIO_MMIO_QUEUE_READY:      if(val) { virtq_enable(dev, vq); } break;
+                case VIRTIO_MMIO_QUEUE_DESC_LOW:   vq->desc_ipa  = (vq->desc_ipa  & ~0xFFFFFFFFUL) | val; break;
+                case VIRTIO_MMIO_QUEUE_DESC_HIGH:  vq->desc_ipa  = (vq->desc_ipa  & 0xFFFFFFFFUL) | (u64)val << 32; break;
+                case VIRTIO_MMIO_QUEUE_AVAIL_LOW:  vq->avail_ipa = (vq->avail_ipa & ~0xFFFFFFFFUL) | val; break;
+                case VIRTIO_MMIO_QUEUE_AVAIL_HIGH: vq->avail_ipa = (vq->avail_ipa & 0xFFFFFFFFUL) | (u64)val << 32; break;
+                case VIRTIO_MMIO_QUEUE_USED_LOW:   vq->used_ipa  = (vq->used_ipa  & ~0xFFFFFFFFUL) | val; break;
+                case VIRTIO_MMIO_QUEUE_USED_HIGH:  vq->used_ipa  = (vq->used_ipa  & 0xFFFFFFFFUL) | (u64)val << 32; break;
+                default:
+                    LOG_WARN_RATELIMITED("virtio slot %d: write to read-only register %x\n", dev->slot, reg);
+                    break;
+            }
+            break;
+    }
+    return -1;
+}
+
+/* Serves both the trap of the whole window and the ones of the devices, so the slot comes from the ipa */
+static int virtio_mmio_read(struct vcpu *vcpu, u64 offset, u64 *val, struct vmmio_access *vmmio)
+{
+    int slot = (vmmio->ipa - VIRTIO_MMIO_BASE) / VIRTIO_MMIO_SLOT_SIZE;
+    u64 reg  = (vmmio->ipa - VIRTIO_MMIO_BASE) % VIRTIO_MMIO_SLOT_SIZE;
+    struct virtio_dev *dev = vcpu->vm->virtio[slot];
+
+    if(dev == NULL) {
+        /* an empty transport, device id 0 */
+        *val = reg == VIRTIO_MMIO_MAGIC_VALUE ? VIRTIO_MMIO_MAGIC :
+               reg == VIRTIO_MMIO_VERSION ? 2 : 0;
+        return 0;
+    }
+
+    arch_spin_lock(&dev->lock);
+    *val = virtio_reg_read(dev, reg, vmmio->accsize);
+    arch_spin_unlock(&dev->lock);
+    return 0;
+}
+
+static int virtio_mmio_write(struct vcpu *vcpu, u64 offset, u64 val, struct vmmio_access *vmmio)
+{
+    int slot = (vmmio->ipa - VIRTIO_MMIO_BASE) / VIRTIO_MMIO_SLOT_SIZE;
+    u64 reg  = (vmmio->ipa - VIRTIO_MMIO_BASE) % VIRTIO_MMIO_SLOT_SIZE;
+    struct virtio_dev *dev = vcpu->vm->virtio[slot];
+
+    if(dev == NULL) {
+        return 0;
+    }
+
+    arch_spin_lock(&dev->lock);
+    int queue = virtio_reg_write(dev, reg, val, vmmio->accsize);
+    arch_spin_unlock(&dev->lock);
+
+    /* the device runs the queue without the register file locked */
+    if(queue >= 0 && (dev->status & VIRTIO_STATUS_DRIVER_OK)) {
+        trace(VIRTIO_NOTIFY, vcpu, slot, queue);
+        dev->notifies++;
+        /* a driver that did not listen, the polling pcpu gets to it anyway */
+        if(!iopoll_active()) {
+            dev->ops->notify(dev, queue);
+        }
+    }
+    return 0;
+}
+
+/* One trap covers every transport slot of the vm, the empty ones end up there */
+void virtio_mmio_init(struct vm *vm)
+{
+    create_mmio_trap(vm, "virtio-empty", VIRTIO_MMIO_BASE, VIRTIO_MMIO_SLOTS * VIRTIO_MMIO_SLOT_SIZE,
+                     virtio_mmio_read, virtio_mmio_write);
+}
+
+/* Plug a device model into the first free slot of the vm */
+struct virtio_dev *virtio_dev_create(struct vm *vm, const struct virtio_ops *ops, void *priv)
+{
+    int slot;
+
+    if(ops->nqueues > VIRTIO_MAX_QUEUES) {
+        abort("virtio device %d wants %d queues", ops->device_id, ops->nqueues);
+    }
+
+    for(slot = 0; slot < VIRTIO_MMIO_SLOTS; slot++) {
+        if(vm->virtio[slot] == NULL) {
+            break;
+        }
+    }
+    if(slot == VIRTIO_MMIO_SLOTS) {
+        LOG_WARN("No free virtio-mmio slot in vm %s\n", vm->name);
+        return NULL;
+    }
+
+    struct virtio_dev *dev = (struct virtio_dev *)xmalloc(sizeof(struct virtio_dev));
+    if(dev == NULL) {
+        abort("Unable to alloc a virtio device, no memory");
+    }
+    memset(dev, 0, sizeof(struct virtio_dev));
+
+    dev->vm   = vm;
+    dev->ops  = ops;
+    dev->priv = priv;
+    dev->slot = slot;
+    dev->irq  = VIRTIO_MMIO_IRQ(slot);
+    arch_spinlock_init(&dev->lock);
+    for(int i = 0; i < VIRTIO_MAX_QUEUES; i++) {
+        arch_spinlock_init(&dev->vqs[i].lock);
+    }
+
+    arch_spin_lock(&virtio_devs_lock);
+    dev->next   = virtio_devs;
+    virtio_devs = dev;
+    arch_spin_unlock(&virtio_devs_lock);
+
+    vm->virtio[slot] = dev;
+    /* in front of the window's trap, so the device's accesses are counted apart */
+    vmmio_handler_register(vm, "virtio", slot, VIRTIO_MMIO_BASE + slot * VIRTIO_MMIO_SLOT_SIZE,
+                           VIRTIO_MMIO_SLOT_SIZE, virtio_mmio_read, virtio_mmio_write);
+
+    LOG_INFO("virtio device %d at %p irq %d in vm %s\n", ops->device_id,
+             VIRTIO_MMIO_BASE + slot * VIRTIO_MMIO_SLOT_SIZE, dev->irq, vm->name);
+    return dev;
+}
+
+/*
+ * One pass of the polling pcpu over the queues of all vms. A queue goes to
+ * its device when the driver made buffers available since the last time,
+ * as a notification would. Returns the number of queues that had some.
+ */
+int virtio_poll(void)
+{
+    int busy = 0;
+
+    for(struct virtio_dev *dev = virtio_devs; dev != NULL; dev = dev->next) {
+        if((dev->status & (VIRTIO_STATUS_DRIVER_OK | VIRTIO_STATUS_NEEDS_RESET)) != VIRTIO_STATUS_DRIVER_OK) {
+            continue;
+        }
+        for(int q = 0; q < dev->ops->nqueues; q++) {
+            struct virtq *vq = &dev->vqs[q];
+            bool work = false;
+
+            if(dev->ops->no_notify & (1U << q)) {
+                continue;
+            }
+            arch_spin_lock(&vq->lock);
+            if(vq->ready) {
+                u16 avail_idx = vq->avail->idx;
+                work = avail_idx != vq->last_avail && avail_idx != vq->polled_avail;
+                vq->polled_avail = avail_idx;
+            }
+            arch_spin_unlock(&vq->lock);
+
+            if(work) {
+                dev->polled++;
+                busy++;
+                dev->ops->notify(dev, q);
+            }
+        }
+    }
+    return busy;
+}
+
+void virtio_dump(void)
+{
+    for(struct virtio_dev *dev = virtio_devs; dev != NULL; dev = dev->next) {
+        printf("  %s slot %d id %d status %x notifies %d polled %d interrupts %d\n", dev->vm->name,
+               dev->slot, dev->ops->device_id, dev->status, (u32)dev->notifies, (u32)dev->polled,
+               (u32)dev->interrupts);
+    }
+}
@@ -0,0 +1,410 @@
+#define XLOG_SUBSYS XLOG_VIRTIO
+
+#include <types.h>
+#include <arch.h>
+#include <layout.h>
+#include <spinlock.h>
+#include <xmalloc.h>
+#include <utils.h>
+#include <xlog.h>
+#include <printf.h>
+#include <vm.h>
+#include <virtio.h>
+#include <virtio_net.h>
+
+/*
+ * virtio-net ports of one in-hypervisor L2 switch, there is no uplink.
+ * A frame a guest transmits is forwarded while its transmit queue is
+ * processed: source addresses are learned, a known unicast destination
+ * gets the frame, anything else is flooded to all other ports. The frame
+ * is copied once, from the sender's buffer straight into a receive buffer
+ * of the destination, and dropped if that port has none posted.
+ *
+ * Interrupt moderation: a sender gets one completion interrupt per
+ * notification, and a receiver one per VNET_RX_COALESCE frames and at the
+ * end of the sender's batch. The receive queues never need a notification
+ * from the driver, frames only arrive from transmit queues, so they
+ * suppress them.
+ *
+ * Lock order: the sender's transmit queue lock, then fdb_lock or the
+ * receive queue lock of a destination. A receive queue lock is never held
+ * while taking another queue lock.
+ */
+
+struct vnet {
+    struct vnet *next;
+    struct vm *vm;
+    struct virtio_dev *dev;
+    u8    mac[6];
+
+    u32   rx_pending;           /* frames not yet signalled, under the receive queue lock */
+
+    u64   tx_frames;
+    u64   tx_bytes;
+    u64   tx_batches;           /* transmit queue notifications */
+    u64   tx_errors;            /* malformed frames, or buffers outside guest ram */
+    u64   rx_frames;
+    u64   rx_bytes;
+    u64   rx_dropped;           /* no receive buffer, one too small, or a failed copy */
+};
+
+struct virtio_net_config {
+    u8  mac[6];
+    u16 status;
+    u16 max_virtqueue_pairs;
+    u16 mtu;
+};
+
+struct vnet_fdb_entry {
+    u8    mac[6];
+    struct vnet *port;
+};
+
+/* Walks the buffers of a chain that go one way, from a byte offset */
+struct vnet_cursor {
+    struct virtq_req *req;
+    bool  write;
+    int   seg;
+    u64   off;
+};
+
+/* ports, published once and never removed */
+static struct vnet *vnets;
+static int nr_vnets;
+
+static struct vnet_fdb_entry fdb[VNET_FDB_SIZE];
+static spinlock_t fdb_lock = {.coreid = -1, .lock = 0, .name = "vnet_fdb_lock"};
+static u64 fdb_learned;
+static u64 flooded;
+
+static inline bool mac_equal(const u8 *a, const u8 *b)
+{
+    for(int i = 0; i < 6; i++) {
+        if(a[i] != b[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static inline bool mac_multicast(const u8 *mac)
+{
+    return mac[0] & 0x1;
+}
+
+static inline u32 fdb_hash(const u8 *mac)
+{
+    return (mac[3] ^ mac[4] ^ mac[5]) & (VNET_FDB_SIZE - 1);
+}
+
+/* A direct mapped table, a colliding address takes the entry over */
+static void fdb_learn(const u8 *mac, struct vnet *port)
+{
+    struct vnet_fdb_entry *e = &fdb[fdb_hash(mac)];
+
+    if(mac_multicast(mac)) {
+        return;
+    }
+    arch_spin_lock(&fdb_lock);
+    if(e->port != port || !mac_equal(e->mac, mac)) {
+        memcpy(e->mac, mac, 6);
+        e->port = port;
+        fdb_learned++;
+    }
+    arch_spin_unlock(&fdb_lock);
+}
+
+static struct vnet *fdb_lookup(const u8 *mac)
+{
+    struct vnet_fdb_entry *e = &fdb[fdb_hash(mac)];
+    struct vnet *port = NULL;
+
+    arch_spin_lock(&fdb_lock);
+    if(e->port != NULL && mac_equal(e->mac, mac)) {
+        port = e->port;
+    }
+    arch_spin_unlock(&fdb_lock);
+    return port;
+}
+
+/* The contiguous bytes at the cursor, at most max, and steps over them */
+static u64 vnet_cursor_next(struct vnet_cursor *c, u64 max, u64 *ipa)
+{
+    while(c->seg < c->req->nsegs) {
+        struct virtq_seg *seg = &c->req->segs[c->seg];
+
+        if(seg->write != c->write || c->off >= seg->len) {
+            c->seg++;
+            c->off = 0;
+            continue;
+        }
+        u64 n = seg->len - c->off;
+        if(n > max) {
+            n = max;
+        }
+        *ipa = seg->ipa + c->off;
+        c->off += n;
+        return n;
+    }
+    return 0;
+}
+
+static u64 vnet_chain_len(struct virtq_req *req, bool write)
+{
+    u64 len = 0;
+
+    for(int i = 0; i < req->nsegs; i++) {
+        if(req->segs[i].write == write) {
+            len += req->segs[i].len;
+        }
+    }
+    return len;
+}
+
+/* Copies a frame of len bytes at src into a receive buffer of dst, receive queue lock held */
+static void vnet_deliver_locked(struct vnet *dst, struct vm *src_vm, struct vnet_cursor src, u64 len)
+{
+    struct virtio_dev *dev = dst->dev;
+    struct virtq *vq = &dev->vqs[VNET_RXQ];
+    struct vnet_cursor c;
+    struct virtq_req req;
+    /* no offloads are offered, the header is zero but for num_buffers */
+    u8 hdr[VNET_HDR_SIZE] = { [10] = 1 };
+    u64 done = 0, n, ipa;
+
+    if(virtq_pop(dev, vq, &req) <= 0) {
+        dst->rx_dropped++;
+        return;
+    }
+
+    if(vnet_chain_len(&req, true) < VNET_HDR_SIZE + len) {
+        virtq_push(dev, vq, req.head, 0);
+        dst->rx_dropped++;
+        return;
+    }
+
+    c = (struct vnet_cursor){ .req = &req, .write = true };
+    while(done < VNET_HDR_SIZE && (n = vnet_cursor_next(&c, VNET_HDR_SIZE - done, &ipa)) > 0) {
+        if(virtio_copy_to_guest(dst->vm, ipa, hdr + done, n) != n) {
+            break;
+        }
+        done += n;
+    }
+    if(done < VNET_HDR_SIZE) {
+        goto drop;
+    }
+
+    done = 0;
+    while(done < len && (n = vnet_cursor_next(&src, len - done, &ipa)) > 0) {
+        u64 d = 0;
+        while(d < n) {
+            u64 dipa;
+            u64 m = vnet_cursor_next(&c, n - d, &dipa);
+            if(m == 0 || virtio_copy_between(dst->vm, dipa, src_vm, ipa + d, m) != m) {
+                break;
+            }
+            d += m;
+        }
+        done += d;
+        if(d < n) {
+            break;
+        }
+    }
+    /* a buffer of the source or the destination isn't guest ram, the frame is lost */
+    if(done < len) {
+        goto drop;
+    }
+    virtq_push(dev, vq, req.head, VNET_HDR_SIZE + done);
+
+    dst->rx_frames++;
+    dst->rx_bytes += done;
+    if(++dst->rx_pending >= VNET_RX_COALESCE) {
+        virtq_notify(dev, vq);
+        dst->rx_pending = 0;
+    }
+    return;
+
+drop:
+    virtq_push(dev, vq, req.head, 0);
+    dst->rx_dropped++;
+}
+
+static void vnet_deliver(struct vnet *dst, struct vm *src_vm, struct vnet_cursor src, u64 len)
+{
+    struct virtq *vq = &dst->dev->vqs[VNET_RXQ];
+
+    arch_spin_lock(&vq->lock);
+    vnet_deliver_locked(dst, src_vm, src, len);
+    arch_spin_unlock(&vq->lock);
+}
+
+/* Switches one transmitted frame, transmit queue lock of src held */
+static void vnet_forward(struct vnet *src, struct virtq_req *req)
+{
+    struct vnet_cursor c = { .req = req, .write = false };
+    u64 len = vnet_chain_len(req, false);
+    u8 eth[12];
+    u64 done = 0, n, ipa;
+    struct vnet *dst;
+
+    if(len < VNET_HDR_SIZE + VNET_ETH_HLEN || len > VNET_HDR_SIZE + VNET_ETH_HLEN + VNET_MTU) {
+        src->tx_errors++;
+        return;
+    }
+    len -= VNET_HDR_SIZE;
+
+    /* past the header, the frame starts with the destination and source addresses */
+    while(done < VNET_HDR_SIZE && (n = vnet_cursor_next(&c, VNET_HDR_SIZE - done, &ipa)) > 0) {
+        done += n;
+    }
+    struct vnet_cursor frame = c;
+    done = 0;
+    while(done < sizeof(eth) && (n = vnet_cursor_next(&c, sizeof(eth) - done, &ipa)) > 0) {
+        if(virtio_copy_from_guest(src->vm, eth + done, ipa, n) != n) {
+            break;
+        }
+        done += n;
+    }
+    if(done < sizeof(eth)) {
+        src->tx_errors++;
+        return;
+    }
+
+    src->tx_frames++;
+    src->tx_bytes += len;
+    fdb_learn(eth + 6, src);
+
+    dst = mac_multicast(eth) ? NULL : fdb_lookup(eth);
+    if(dst == src) {
+        return;
+    }
+    if(dst != NULL) {
+        vnet_deliver(dst, src->vm, frame, len);
+        return;
+    }
+
+    flooded++;
+    for(struct vnet *p = vnets; p != NULL; p = p->next) {
+        if(p != src) {
+            vnet_deliver(p, src->vm, frame, len);
+        }
+    }
+}
+
+/* Interrupts the ports that got frames since their last interrupt */
+static void vnet_rx_flush(void)
+{
+    for(struct vnet *p = vnets; p != NULL; p = p->next) {
+        struct virtq *vq = &p->dev->vqs[VNET_RXQ];
+
+        if(p->rx_pending == 0) {
+            continue;
+        }
+        arch_spin_lock(&vq->lock);
+        if(p->rx_pending > 0) {
+            virtq_notify(p->dev, vq);
+            p->rx_pending = 0;
+        }
+        arch_spin_unlock(&vq->lock);
+    }
+}
+
+static void vnet_tx(struct vnet *vn)
+{
+    struct virtio_dev *dev = vn->dev;
+    struct virtq *vq = &dev->vqs[VNET_TXQ];
+    struct virtq_req req;
+    bool used = false;
+
+    arch_spin_lock(&vq->lock);
+    while(virtq_pop(dev, vq, &req) > 0) {
+        vnet_forward(vn, &req);
+        virtq_push(dev, vq, req.head, 0);
+        used = true;
+    }
+    if(used) {
+        virtq_notify(dev, vq);
+    }
+    vn->tx_batches++;
+    arch_spin_unlock(&vq->lock);
+
+    vnet_rx_flush();
+}
+
+static void vnet_notify(struct virtio_dev *dev, int queue)
+{
+    /* new receive buffers only matter to the next frame */
+    if(queue == VNET_TXQ) {
+        vnet_tx(dev->priv);
+    }
+}
+
+static u32 vnet_config_read(struct virtio_dev *dev, u64 offset, int size)
+{
+    struct vnet *vn = dev->priv;
+    struct virtio_net_config cfg = {
+        .status              = VIRTIO_NET_S_LINK_UP,
+        .max_virtqueue_pairs = 1,
+        .mtu                 = VNET_MTU,
+    };
+    u32 val = 0;
+
+    memcpy(cfg.mac, vn->mac, 6);
+    memcpy(&val, (char *)&cfg + offset, size);
+    return val;
+}
+
+static const struct virtio_ops vnet_ops = {
+    .device_id    = VIRTIO_ID_NET,
+    .features     = (1UL << VIRTIO_NET_F_MAC) | (1UL << VIRTIO_NET_F_STATUS) |
+                    (1UL << VIRTIO_NET_F_MTU),
+    .nqueues      = 2,
+    /* frames come from transmit queues only, kicks would be wasted exits */
+    .no_notify    = 1U << VNET_RXQ,
+    .config_size  = sizeof(struct virtio_net_config),
+    .notify       = vnet_notify,
+    .config_read  = vnet_config_read,
+};
+
+struct vnet *vnet_create(struct vm *vm)
+{
+    struct vnet *vn = (struct vnet *)xmalloc(sizeof(struct vnet));
+    if(vn == NULL) {
+        abort("Unable to alloc a virtio net device, no memory");
+    }
+    memset(vn, 0, sizeof(struct vnet));
+
+    vn->vm = vm;
+    /* locally administered, "XH" then the port number from 1 */
+    vn->mac[0] = 0x02;
+    vn->mac[1] = 'X';
+    vn->mac[2] = 'H';
+    vn->mac[5] = nr_vnets + 1;
+
+    vn->dev = virtio_dev_create(vm, &vnet_ops, vn);
+    if(vn->dev == NULL) {
+        abort("No virtio slot left for the network of %s", vm->name);
+    }
+
+    /* published last, the switch walks the ports without a lock */
+    vn->next = vnets;
+    dmb(ishst);
+    vnets = vn;
+    nr_vnets++;
+
+    LOG_INFO("%s: virtio-net on slot %d, port %d\n", vm->name, vn->dev->slot, nr_vnets);
+    return vn;
+}
+
+void vnet_dump(void)
+{
+    if(vnets != NULL) {
+        printf("  switch: %d ports, %d addresses learned, %d frames flooded\n",
+               nr_vnets, (u32)fdb_learned, (u32)flooded);
+    }
+    for(struct vnet *vn = vnets; vn != NULL; vn = vn->next) {
+        printf("  %s port %d: tx %d frames %d KiB in %d batches, %d errors, rx %d frames %d KiB, %d dropped\n",
+               vn->vm->name, vn->mac[5], (u32)vn->tx_frames, (u32)(vn->tx_bytes >> 10), (u32)vn->tx_batches,
+               (u32)vn->tx_errors, (u32)vn->rx_frames, (u32)(vn->rx_bytes >> 10), (u32)vn->rx_dropped);
+    }
+}
@@ -1,3 +1,5 @@
+#define XLOG_SUBSYS XLOG_VM
+
 #include <vm.h>
 #include <types.h>
 #include <xlog.h>
@@ -10,7 +12,13 @@
 #include <xmalloc.h>
 #include <vmm.h>
 #include <printf.h>
+#include <sched.h>
+#include <virtio.h>
+#include <virtio_console.h>
+#include <virtio_blk.h>
+#include <virtio_net.h>
 
+_Static_assert(sizeof(vm_t) <= PAGESIZE, "vm_t is allocated as one page");
 
 static void vm_init(vm_t *vm, vm_config_t *vm_config)
 {
@@ -20,6 +28,17 @@ static void vm_init(vm_t *vm, vm_config_t *vm_config)
     vm->nvcpu = vm_config->ncpu;
 
     vm->dtb = vm_config->dtb_addr;
+    /* guest virtual counter starts from 0 */
+    read_sysreg(vm->cntvoff, cntpct_el0);
+    vm->vtimer_exclude_desched = vm_config->vtimer_exclude_desched;
+    /*
+     * Each vcpu stops its own virtual counter, siblings would read different
+     * CNTVCTs and a thread moving between them could see time go backwards.
+     */
+    if(vm->vtimer_exclude_desched && vm->nvcpu > 1) {
+        LOG_ERR("vm %s: vtimer_exclude_desched needs a single vcpu, ignored\n", vm->name);
+        vm->vtimer_exclude_desched = false;
+    }
     /* set entry addr for primary core */
     vm->vcpus[0] = create_vcpu(vm, 0, vm_config->entry_addr);
 
@@ -27,9 +46,21 @@ static void vm_init(vm_t *vm, vm_config_t *vm_config)
     for(int cpu = 1; cpu < vm_config->ncpu; cpu++) {
         vm->vcpus[cpu] = create_vcpu(vm, cpu, 0);
     }
+
+    vm->gang_sched = vm_config->gang_sched;
+    arch_spinlock_init(&vm->gang_lock);
+
+    for(int cpu = 0; cpu < vm_config->ncpu; cpu++) {
+        u64 affinity = vm_config->vcpu_affinity[cpu];
+        /* a gang needs its vcpus on distinct pcpus to run them at the same time */
+        if(vm->gang_sched && affinity == 0) {
+            affinity = 1UL << (cpu % nr_pcpus);
+        }
+        vm->vcpus[cpu]->affinity = affinity;
+    }
 }
 
-void create_mmio_trap(struct vm *vm, u64 ipa, u64 size,
+void create_mmio_trap(struct vm *vm, const char *name, u64 ipa, u64 size,
                       int (*vmmio_read)(struct vcpu *, u64, u64 *, struct vmmio_access *),
                       int (*vmmio_write)(struct vcpu *, u64, u64, struct vmmio_access *))
 {
@@ -39,9 +70,8 @@ void create_mmio_trap(struct vm *vm, u64 ipa, u64 size,
         page_unmap(vttbr, ipa, size);
     }
 
-    vmmio_handler_register(vm, ipa, size, vmmio_read, vmmio_write);
-
-    flush_tlb();
+    /* page_unmap() has invalidated the TLBs */
+    vmmio_handler_register(vm, name, -1, ipa, size, vmmio_read, vmmio_write);
 
     return;
 }
@@ -106,7 +136,10 @@ static void do_memory_mapping(u64 *pgt, vm_config_t *vm_config)
 
 static void do_device_mapping(u64 *pgt, vm_config_t *vm_config)
 {
-    create_guest_mapping(pgt, PL011BASE, PL011BASE, PAGESIZE, S2PTE_DEVICE | S2PTE_RW);
+    /* the uart is multiplexed by the hypervisor for a vm with a virtio console */
+    if(!vm_config->virtio_console) {
+        create_guest_mapping(pgt, PL011BASE, PL011BASE, PAGESIZE, S2PTE_DEVICE | S2PTE_RW);
+    }
 }
 
 static int test_mmio_read(struct vcpu *vcpu, u64 offset, u64 *val, struct vmmio_access *vmmio)
@@ -119,7 +152,7 @@ static int test_mmio_write(struct vcpu *vcpu, u64 offset, u64 val, struct vmmio_
     return 0;
 }
 
-void create_guest_vm(vm_config_t *vm_config)
+vm_t *create_guest_vm(vm_config_t *vm_config)
 {
     guest_t *guest_img = vm_config->guest_image;
     guest_t *guest_dtb = vm_config->guest_dtb;
@@ -157,8 +190,8 @@ void create_guest_vm(vm_config_t *vm_config)
     LOG_INFO("-->guest vcpus is    %d\n", vm_config->ncpu);
     LOG_INFO("-->guest ram size is %x\n", vm_config->ram_size);
 
-    /* alloc a vm */
-    vm_t *vm = (vm_t *)xmalloc(sizeof(vm_t));
+    /* alloc a vm, a page as it outgrows the largest xmalloc block with the virtio slots */
+    vm_t *vm = (vm_t *)alloc_one_page();
     if (vm == NULL) {
         abort("Unable to alloc a vm, no memory");
     }
@@ -178,12 +211,27 @@ void create_guest_vm(vm_config_t *vm_config)
     /* map the device memory */
     do_device_mapping(vttbr, vm_config);
 
+    /* stolen time structures for the pv time interface */
+    pvtime_init(vm);
+
     /* create new vgic distributor */
     vm->vgic_dist = create_vgic_dist(vm);
+
+    /* virtio-mmio transports, devices plug into the slots */
+    virtio_mmio_init(vm);
+    if(vm_config->virtio_console) {
+        vconsole_create(vm);
+    }
+    if(vm_config->virtio_blk != NULL || vm_config->virtio_blk_size != 0) {
+        vblk_create(vm, vm_config->virtio_blk, vm_config->virtio_blk_size);
+    }
+    if(vm_config->virtio_net) {
+        vnet_create(vm);
+    }
     
-    /* set vcpu[0] ready */
+    /* power on vcpu[0], the others are started by the guest through psci */
     LOG_INFO("-->Set Guest vm vcpu[0] as ready\n");
-    vm->vcpus[0]->state = VCPU_READY;
+    sched_wakeup(vm->vcpus[0]);
 
-    return;
+    return vm;
 }
\ No newline at end of file
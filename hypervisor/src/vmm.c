@@ -1,3 +1,5 @@
+#define XLOG_SUBSYS XLOG_MM
+
 #include "printf.h"
 #include "types.h"
 #include "layout.h"
@@ -6,6 +8,7 @@
 #include "vmm.h"
 #include "xlog.h"
 #include "utils.h"
+#include "cpufeature.h"
 /*
 遍历 Stage-2 页表（从 L0 到 L2），找到或创建 L3 页表项。
 */
@@ -67,8 +70,77 @@ void create_guest_mapping(u64 *pgt, u64 va, u64 pa, u64 size, u64 mattr)
     }
 }
 
+/* TLBI RIPAS2E1IS, the assembler may not know FEAT_TLBIRANGE */
+#define tlbi_ripas2e1is(arg)    asm volatile("sys #4, c8, c0, #2, %0" :: "r"(arg) : "memory")
+#define tlbi_ipas2e1is(arg)     asm volatile("tlbi ipas2e1is, %0" :: "r"(arg) : "memory")
+
+/* Operand of a range TLBI: 4K granule, (num + 1) << (5 * scale + 1) pages from ipa */
+#define TLBI_RANGE_ARG(ipa, scale, num) \
+    ((1UL << 46) | ((u64)(scale) << 44) | ((u64)(num) << 39) | (((ipa) >> 12) & ((1UL << 37) - 1)))
+#define TLBI_RANGE_PAGES(scale, num)    ((u64)((num) + 1) << (5 * (scale) + 1))
+
+/* Above this many pages a full stage 1+2 flush is cheaper than one TLBI per page */
+#define TLBI_MAX_PAGES          64
+/* Largest span the loop below describes with scales 0-3 and one single page, 2^21 - 1 */
+#define TLBI_RANGE_MAX_PAGES    (TLBI_RANGE_PAGES(3, 31) - 1)
+
+/*
+ * Invalidate the stage 2 entries of [ipa, ipa + size) on all pcpus, after the
+ * page table was changed. Every vm uses VMID 0, the one in VTTBR_EL2 here.
+ */
+void stage2_tlb_flush_range(u64 ipa, u64 size)
+{
+    u64 pages = size / PAGESIZE;
+
+    dsb(ishst);
+
+    bool range = cpu_has(CPU_FEAT_TLBIRANGE);
+
+    if(pages > (range ? TLBI_RANGE_MAX_PAGES : TLBI_MAX_PAGES)) {
+        asm volatile("tlbi vmalls12e1is" ::: "memory");
+        dsb(ish);
+        isb();
+        return;
+    }
+
+    if(range) {
+        /* a few range operations, biggest scale last, odd pages one by one */
+        int scale = 0;
+        while(pages > 0) {
+            if(scale > 3) {
+                abort("TLBI range scale out of bounds");
+            }
+            if(pages % 2 == 1) {
+                tlbi_ipas2e1is(ipa >> 12);
+                ipa += PAGESIZE;
+                pages--;
+                continue;
+            }
+            u64 num = (pages >> (5 * scale + 1)) & 0x1F;
+            if(num > 0) {
+                tlbi_ripas2e1is(TLBI_RANGE_ARG(ipa, scale, num - 1));
+                ipa   += TLBI_RANGE_PAGES(scale, num - 1) * PAGESIZE;
+                pages -= TLBI_RANGE_PAGES(scale, num - 1);
+            }
+            scale++;
+        }
+    } else {
+        for(u64 p = 0; p < pages; p++, ipa += PAGESIZE) {
+            tlbi_ipas2e1is(ipa >> 12);
+        }
+    }
+
+    /* stage 1 entries may cache the old stage 2 translation */
+    dsb(ish);
+    asm volatile("tlbi vmalle1is" ::: "memory");
+    dsb(ish);
+    isb();
+}
+
 void page_unmap(u64 *pgt, u64 va, u64 size)
 {
+    u64 ipa = va;
+
     if(va % PAGESIZE != 0 || size % PAGESIZE != 0) {
         abort("Page_unmap with invalid param");
     }
@@ -82,12 +154,14 @@ void page_unmap(u64 *pgt, u64 va, u64 size)
         free_one_page((void *)pa);
         *pte = 0;
     }
+
+    stage2_tlb_flush_range(ipa, size);
 }
 
 u64 ipa_to_pa(u64 *pgt, u64 ipa)
 {
     u64 *pte = page_walk(pgt, ipa, 0);
-    if(pte == NULL) {
+    if(pte == NULL || !(*pte & PTE_VALID)) {
         return 0;
     }
 
@@ -133,6 +207,10 @@ void stage2_mmu_init(void)
     u64 vtcr = VTCR_T0SZ(20) | VTCR_SL0(2) |
                VTCR_SH0(0) | VTCR_TG0(0) | VTCR_NSW |
                VTCR_NSA | VTCR_PS(4);
+    /* the full VMID width, if the cpu has it */
+    if(cpu_has(CPU_FEAT_VMID16)) {
+        vtcr |= VTCR_VS;
+    }
 
     LOG_INFO("Setting vtcr_el2 to 0x%x\n", vtcr);
     write_sysreg(vtcr_el2, vtcr);
@@ -160,8 +238,10 @@ void hyper_setup()
         HCR_VM  : 开启或关闭 Stage-2 地址转换
         HCR_FMO : 控制快速中断（FIQ）是否路由到 Hypervisor EL2
         HCR_IMO : 控制物理中断（IRQ）是否路由到 Hypervisor EL2
+        HCR_TWI : 虚拟机执行WFI时陷入Hypervisor，让出pcpu给其他vcpu
+        HCR_TWE : 虚拟机执行WFE(自旋锁等待)时陷入Hypervisor，用于检测lock holder被抢占
     */
-    u64 hcr = HCR_TSC | HCR_RW | HCR_VM | HCR_FMO | HCR_IMO;
+    u64 hcr = HCR_TSC | HCR_RW | HCR_VM | HCR_FMO | HCR_IMO | HCR_TWI | HCR_TWE;
     LOG_INFO("Setting hcr_el2 to 0x%x and enable stage 2 address translation\n");
     write_sysreg(hcr_el2, hcr);
 
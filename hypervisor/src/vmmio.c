@@ -1,3 +1,5 @@
+#define XLOG_SUBSYS XLOG_MMIO
+
 #include <types.h>
 #include <arch.h>
 #include <vmmio.h>
@@ -8,28 +10,27 @@
 #include <xlog.h>
 #include <spinlock.h>
 #include <xmalloc.h>
+#include <trace.h>
 
-int vmmio_handler(struct vcpu *vcpu, int reg_num, struct vmmio_access *vmmio)
+/*
+ * One access of the guest to an emulated device. val is what the guest
+ * writes, or where what it reads is returned, it stays 0 if no device
+ * claims the ipa.
+ */
+int vmmio_handler(struct vcpu *vcpu, u64 *val, struct vmmio_access *vmmio)
 {
     /* The header of all the vmmios */
     struct vmmio_info *vmmios = vcpu->vm->vmmios;
     if(vmmios == NULL) {
+        __atomic_fetch_add(&vcpu->vm->mmio_unhandled, 1, __ATOMIC_RELAXED);
         return -1;
     }
 
     u64 ipa = vmmio->ipa;
-    u64 *reg = NULL;
-    u64 val;
+
+    trace(MMIO, vcpu, ipa, vmmio->wnr);
     /* 根据故障地址（vmmio->ipa）查找匹配的 MMIO 设备，
        调用相应的 vmmio_read 或 vmmio_write 函数。*/
-    /* when use WZR or XZR, the srt is 31 */
-    if(reg_num == 31) {
-        val = 0;
-    } else {
-        /* use other common registers */
-        reg = &vcpu->regs.x[reg_num];
-        val = *reg;
-    }
 
     /* 遍历MMIO设备链表 */
     for(struct vmmio_info *m = vmmios; m != NULL; m = m->next) {
@@ -37,25 +38,43 @@ int vmmio_handler(struct vcpu *vcpu, int reg_num, struct vmmio_access *vmmio)
         if(m->base <= ipa && ipa < m->base + m->size) {
             if(vmmio->wnr) {
                 if(m->vmmio_write) {
-                    //LOG_INFO("[VMMIO WRITE]: device base: %p, offset is %p, write value %p, to reg %p\n", m->base, ipa - m->base, val, reg_num);
-                    return m->vmmio_write(vcpu, ipa - m->base, val, vmmio);
+                    __atomic_fetch_add(&m->accesses, 1, __ATOMIC_RELAXED);
+                    LOG_DEBUG("[VMMIO WRITE]: device base: %p, offset is %p, write value %p\n", m->base, ipa - m->base, *val);
+                    return m->vmmio_write(vcpu, ipa - m->base, *val, vmmio);
                 }
             } else {
                 if(m->vmmio_read) {
-                    //LOG_INFO("[VMMIO READ]: device base: %p, offset is %p, read to reg %p\n", m->base, ipa - m->base, reg_num);
-                    return m->vmmio_read(vcpu, ipa - m->base, reg, vmmio);
+                    __atomic_fetch_add(&m->accesses, 1, __ATOMIC_RELAXED);
+                    LOG_DEBUG("[VMMIO READ]: device base: %p, offset is %p\n", m->base, ipa - m->base);
+                    return m->vmmio_read(vcpu, ipa - m->base, val, vmmio);
                 }
             }
         }
     }
 
+    /* reads as 0, writes ignored */
+    __atomic_fetch_add(&vcpu->vm->mmio_unhandled, 1, __ATOMIC_RELAXED);
     return 0;
 }
 
+/* Emulated accesses per trap, the hot device of a dabt heavy vm */
+void vmmio_dump(struct vm *vm)
+{
+    printf("%s mmio accesses:\n", vm->name);
+    for(struct vmmio_info *m = vm->vmmios; m != NULL; m = m->next) {
+        if(m->unit >= 0) {
+            printf("  %s%d\t%10d\n", m->name, m->unit, (u32)m->accesses);
+        } else {
+            printf("  %s\t%10d\n", m->name, (u32)m->accesses);
+        }
+    }
+    printf("  unhandled\t%10d\n", (u32)vm->mmio_unhandled);
+}
+
 /*
     注册新的 MMIO 设备到虚拟机的 vmmios 链表。
 */
-int vmmio_handler_register(struct vm *vm, u64 ipa, u64 size,
+int vmmio_handler_register(struct vm *vm, const char *name, int unit, u64 ipa, u64 size,
                            int (*vmmio_read)(struct vcpu *, u64, u64 *, struct vmmio_access *),
                            int (*vmmio_write)(struct vcpu *, u64, u64, struct vmmio_access *))
 {
@@ -73,6 +92,9 @@ int vmmio_handler_register(struct vm *vm, u64 ipa, u64 size,
 
     new->base = ipa;
     new->size = size;
+    new->name = name;
+    new->unit = unit;
+    new->accesses = 0;
     new->vmmio_read  = vmmio_read;
     new->vmmio_write = vmmio_write;
 
@@ -0,0 +1,341 @@
+#define XLOG_SUBSYS XLOG_MMIO
+
+#include <types.h>
+#include <arch.h>
+#include <layout.h>
+#include <vcpu.h>
+#include <vmmio.h>
+#include <vmmio_emul.h>
+#include <xlog.h>
+
+/*
+ * Data aborts on emulated devices. With a valid syndrome (ISV) the ESR
+ * describes the access, but load/store pair and the writeback forms leave
+ * ISV clear: the faulting instruction is then fetched through the guest's
+ * stage 1 and stage 2 and decoded here. Both end up as a struct mmio_insn
+ * emulated one element at a time through vmmio_handler().
+ *
+ * Decoded instructions are cached per vcpu by pc, as a driver polling a
+ * register traps on the same few instructions over and over. Instructions
+ * that access devices are not expected to be rewritten in place.
+ */
+
+static inline s64 sign_extend(u64 val, int bits)
+{
+    return (s64)(val << (64 - bits)) >> (64 - bits);
+}
+
+static inline bool guest_aarch32(struct vcpu *vcpu)
+{
+    return (vcpu->regs.spsr >> 4) & 0x1;
+}
+
+/* The EL1 state of the running vcpu is live, so is its stack pointer */
+static u64 guest_sp_read(struct vcpu *vcpu)
+{
+    u64 sp;
+
+    if(SPSR_M(vcpu->regs.spsr) == 0x5) {    /* EL1h */
+        read_sysreg(sp, sp_el1);
+    } else {
+        read_sysreg(sp, sp_el0);
+    }
+    return sp;
+}
+
+static void guest_sp_write(struct vcpu *vcpu, u64 sp)
+{
+    if(SPSR_M(vcpu->regs.spsr) == 0x5) {
+        write_sysreg(sp_el1, sp);
+    } else {
+        write_sysreg(sp_el0, sp);
+    }
+}
+
+/* Rt 31 is xzr */
+static inline u64 guest_reg_read(struct vcpu *vcpu, int rt)
+{
+    return rt == 31 ? 0 : vcpu->regs.x[rt];
+}
+
+static inline void guest_reg_write(struct vcpu *vcpu, int rt, u64 val)
+{
+    if(rt != 31) {
+        vcpu->regs.x[rt] = val;
+    }
+}
+
+/*
+ * Guest VA to PA through both stages, as the guest at its current EL would
+ * see it. PAR_EL1 belongs to the guest and is put back. ~0 on a fault.
+ */
+static u64 guest_va_to_pa(struct vcpu *vcpu, u64 va)
+{
+    u64 par, saved;
+
+    read_sysreg(saved, par_el1);
+    if(SPSR_M(vcpu->regs.spsr) == 0x0) {    /* EL0t */
+        asm volatile("at s12e0r, %0" : : "r"(va));
+    } else {
+        asm volatile("at s12e1r, %0" : : "r"(va));
+    }
+    isb();
+    read_sysreg(par, par_el1);
+    write_sysreg(par_el1, saved);
+
+    if(par & PAR_F) {
+        return ~0UL;
+    }
+    return (par & PAR_PA_MASK) | (va & (PAGESIZE - 1));
+}
+
+static int fetch_insn(struct vcpu *vcpu, u64 pc, u32 *insn)
+{
+    u64 pa = guest_va_to_pa(vcpu, pc);
+    if(pa == ~0UL) {
+        return -1;
+    }
+    /* EL2 runs with the MMU off, guest memory is identity mapped */
+    *insn = *(volatile u32 *)pa;
+    return 0;
+}
+
+/* Load/store register: unsigned offset, imm9 (unscaled, pre/post-indexed, unprivileged) and register offset */
+static int decode_ldst_single(u32 insn, struct mmio_insn *d)
+{
+    int size = insn >> 30;
+    int opc  = (insn >> 22) & 0x3;
+
+    if((insn & 0x3F000000) == 0x39000000) {
+        /* unsigned offset, no writeback and the fault address is the access */
+    } else if((insn & 0x3F200000) == 0x38000000) {
+        switch((insn >> 10) & 0x3) {
+            case 1: d->wb = 1; d->post = 1; break;  /* post-indexed */
+            case 3: d->wb = 1; break;               /* pre-indexed */
+            default: break;                         /* ldur/stur, ldtr/sttr */
+        }
+        d->imm = sign_extend((insn >> 12) & 0x1FF, 9);
+    } else if((insn & 0x3F200C00) == 0x38200800) {
+        /* register offset, no writeback */
+    } else {
+        return -1;
+    }
+
+    switch(opc) {
+        case 0:                             /* str */
+            break;
+        case 1:                             /* ldr */
+            d->load = 1;
+            d->sf   = size == 3;
+            break;
+        case 2:                             /* ldrs to a 64-bit register, prfm for size 3 */
+            if(size == 3) {
+                return -1;
+            }
+            d->load = 1;
+            d->sign = 1;
+            d->sf   = 1;
+            break;
+        case 3:                             /* ldrs to a 32-bit register */
+            if(size >= 2) {
+                return -1;
+            }
+            d->load = 1;
+            d->sign = 1;
+            break;
+    }
+
+    d->size  = 1 << size;
+    d->nregs = 1;
+    return 0;
+}
+
+/* Load/store pair: no-allocate, post-indexed, signed offset and pre-indexed */
+static int decode_ldst_pair(u32 insn, struct mmio_insn *d)
+{
+    int opc = insn >> 30;
+
+    d->load = (insn >> 22) & 0x1;
+    switch(opc) {
+        case 0:                             /* 32-bit */
+            d->size = 4;
+            break;
+        case 1:                             /* ldpsw, stgp is not a device access */
+            if(!d->load) {
+                return -1;
+            }
+            d->size = 4;
+            d->sign = 1;
+            d->sf   = 1;
+            break;
+        case 2:                             /* 64-bit */
+            d->size = 8;
+            d->sf   = 1;
+            break;
+        default:
+            return -1;
+    }
+
+    switch((insn >> 23) & 0x3) {
+        case 1: d->wb = 1; d->post = 1; break;
+        case 3: d->wb = 1; break;
+        default: break;
+    }
+
+    d->imm   = sign_extend((insn >> 15) & 0x7F, 7) * d->size;
+    d->rt2   = (insn >> 10) & 0x1F;
+    d->nregs = 2;
+    return 0;
+}
+
+static int decode_insn(u32 insn, struct mmio_insn *d)
+{
+    *d = (struct mmio_insn){ 0 };
+    d->rt = insn & 0x1F;
+    d->rn = (insn >> 5) & 0x1F;
+
+    /* general-purpose registers only, V (bit 26) clear */
+    if((insn & 0x3C000000) == 0x38000000) {
+        return decode_ldst_single(insn, d);
+    }
+    if((insn & 0x3E000000) == 0x28000000) {
+        return decode_ldst_pair(insn, d);
+    }
+    return -1;
+}
+
+/* The syndrome already is the decoded instruction */
+static void decode_iss(u64 esr_iss, struct mmio_insn *d)
+{
+    *d = (struct mmio_insn){ 0 };
+    d->size  = 1 << DABT_SAS(esr_iss);
+    d->nregs = 1;
+    d->load  = !(esr_iss & DABT_WNR);
+    d->sign  = !!(esr_iss & DABT_SSE);
+    d->sf    = !!(esr_iss & DABT_SF);
+    d->rt    = DABT_SRT(esr_iss);
+}
+
+/* The table base translating pc, a different process or a guest with its MMU off decodes anew */
+static u64 insn_cache_ttbr(u64 pc)
+{
+    u64 sctlr, ttbr;
+
+    read_sysreg(sctlr, sctlr_el1);
+    if(!(sctlr & 0x1)) {
+        return 0;
+    }
+    if((pc >> 55) & 0x1) {
+        read_sysreg(ttbr, ttbr1_el1);
+    } else {
+        read_sysreg(ttbr, ttbr0_el1);
+    }
+    return ttbr;
+}
+
+static int decode_cached(struct vcpu *vcpu, u64 pc, struct mmio_insn *d)
+{
+    u64 ttbr = insn_cache_ttbr(pc);
+    struct mmio_insn_cache *e = &vcpu->mmio_cache[(pc >> 2) & (MMIO_INSN_CACHE_SIZE - 1)];
+    u32 insn;
+
+    if(e->insn.size != 0 && e->pc == pc && e->ttbr == ttbr) {
+        *d = e->insn;
+        return 0;
+    }
+
+    if(fetch_insn(vcpu, pc, &insn) < 0) {
+        LOG_WARN_RATELIMITED("Unable to fetch the instruction at %p of vcpu %d\n", pc, vcpu->cpuid);
+        return -1;
+    }
+    if(decode_insn(insn, d) < 0) {
+        LOG_WARN_RATELIMITED("Unable to emulate MMIO instruction %x at %p of vcpu %d\n", insn, pc, vcpu->cpuid);
+        return -1;
+    }
+
+    e->pc   = pc;
+    e->ttbr = ttbr;
+    e->insn = *d;
+    return 0;
+}
+
+static int emulate_insn(struct vcpu *vcpu, const struct mmio_insn *d, u64 far, u64 ipa)
+{
+    u64 base = 0;
+    u64 va   = far;
+    u64 mask = d->size == 8 ? ~0UL : (1UL << (d->size * 8)) - 1;
+
+    if(d->wb || d->nregs > 1) {
+        /* Rn 31 is the stack pointer */
+        base = d->rn == 31 ? guest_sp_read(vcpu) : vcpu->regs.x[d->rn];
+    }
+    if(d->nregs > 1) {
+        /* the fault may be on either element, locate the first one */
+        va = d->post ? base : base + d->imm;
+    }
+
+    for(int i = 0; i < d->nregs; i++) {
+        u64 eva = va + i * d->size;
+        int rt  = i == 0 ? d->rt : d->rt2;
+        struct vmmio_access acs;
+
+        /* both elements share the page of the fault, its ipa is known */
+        if((eva ^ far) & ~(u64)(PAGESIZE - 1)) {
+            LOG_WARN_RATELIMITED("MMIO access crossing a page at %p, vcpu %d\n", vcpu->regs.elr, vcpu->cpuid);
+            return -1;
+        }
+
+        acs.ipa     = ipa - far + eva;
+        acs.pc      = vcpu->regs.elr;
+        acs.wnr     = !d->load;
+        acs.accsize = d->size;
+
+        u64 val = d->load ? 0 : guest_reg_read(vcpu, rt) & mask;
+        if(vmmio_handler(vcpu, &val, &acs) < 0) {
+            LOG_WARN_RATELIMITED("VMMIO handler failed: ipa %p, va %p\n", acs.ipa, eva);
+        }
+
+        if(d->load) {
+            val &= mask;
+            if(d->sign) {
+                val = sign_extend(val, d->size * 8);
+            }
+            if(!d->sf) {
+                val &= 0xFFFFFFFF;
+            }
+            guest_reg_write(vcpu, rt, val);
+        }
+    }
+
+    if(d->wb) {
+        base += d->imm;
+        if(d->rn == 31) {
+            guest_sp_write(vcpu, base);
+        } else {
+            vcpu->regs.x[d->rn] = base;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Emulates the access of a data abort on ipa. Returns < 0 if the
+ * instruction cannot be emulated, the caller steps elr otherwise.
+ */
+int vmmio_emulate(struct vcpu *vcpu, u64 esr_iss, u64 far, u64 ipa)
+{
+    struct mmio_insn d;
+
+    if(esr_iss & DABT_ISV) {
+        decode_iss(esr_iss, &d);
+    } else {
+        if(guest_aarch32(vcpu)) {
+            return -1;
+        }
+        if(decode_cached(vcpu, vcpu->regs.elr, &d) < 0) {
+            return -1;
+        }
+    }
+
+    return emulate_insn(vcpu, &d, far, ipa);
+}
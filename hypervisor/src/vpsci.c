@@ -1,37 +1,148 @@
+#define XLOG_SUBSYS XLOG_VPSCI
+
 #include <vpsci.h>
 #include <types.h>
 #include <printf.h>
 #include <xlog.h>
 #include <vcpu.h>
-
-extern void _start();
+#include <sched.h>
+#include <pvtime.h>
 
 static u32 vpsci_version()
 {
-    return smc_call(PSCI_VERSION, 0, 0);
+    return smc_call(PSCI_VERSION, 0, 0, 0);
 }
 
 static s32 vpsci_migrate_info_type()
 {
-    return smc_call(PSCI_MIGRATE_INFO_TYPE, 0, 0);
+    return smc_call(PSCI_MIGRATE_INFO_TYPE, 0, 0, 0);
+}
+
+/* vcpu mpidr only uses Aff0 */
+static vcpu_t *vpsci_target(vcpu_t *vcpu, u64 target_cpu)
+{
+    u64 id = target_cpu & 0xff;
+    if((target_cpu & ~0xffUL) != 0 || id >= (u64)vcpu->vm->nvcpu) {
+        return NULL;
+    }
+    return vcpu->vm->vcpus[id];
 }
 
-static s32 vpsci_cpu_on(vcpu_t *vcpu, u64 funid, u64 target_cpu, u64 entry_addr)
+/* The state PSCI requires at a power on entry point: EL1h, DAIF masked, MMU and caches off */
+static void vpsci_reset_entry(vcpu_t *vcpu, u64 entry_addr, u64 context_id)
 {
-    LOG_INFO("Vpsci cpu on call for vcpu %d on entrypoint %p\n", target_cpu, entry_addr);
-    
-    if(target_cpu >= (u64)vcpu->vm->nvcpu) {
+    vcpu->regs.spsr          = SPSR_M(5) | SPSR_DAIF;
+    vcpu->regs.elr           = entry_addr;
+    vcpu->regs.x[0]          = context_id;
+    vcpu->sys_regs.sctlr_el1 = SCTLR_EL1_RESET;
+}
+
+static s32 vpsci_cpu_on(vcpu_t *vcpu, u64 funid, u64 target_cpu, u64 entry_addr, u64 context_id)
+{
+    LOG_DEBUG("Vpsci cpu on call for vcpu %d on entrypoint %p\n", target_cpu, entry_addr);
+
+    vcpu_t *target = vpsci_target(vcpu, target_cpu);
+    if(target == NULL) {
         LOG_WARN("Vpsci failed to wakeup vcpu\n");
+        return PSCI_RET_INVALID_PARAMS;
+    }
+
+    if(target->state != VCPU_ALLOCED) {
+        return PSCI_RET_ALREADY_ON;
+    }
+
+    /*
+     * CPU_OFF publishes ALLOCED before its pcpu has switched it out, its
+     * context is written back by vcpu_put() until on_cpu drops.
+     */
+    while(target->on_cpu)
+        ;
+    dsb(ish);
+
+    /* it may have been running before CPU_OFF, start over from a clean state */
+    vpsci_reset_entry(target, entry_addr, context_id);
+    /* vcpus are multiplexed on the running pcpus, just make it runnable */
+    sched_wakeup(target);
+    return PSCI_RET_SUCCESS;
+}
+
+/* Gives the pcpu back until another vcpu calls CPU_ON, doesn't return on success */
+static s32 vpsci_cpu_off(vcpu_t *vcpu)
+{
+    LOG_DEBUG("Vpsci cpu off call for vcpu %d\n", vcpu->cpuid);
+    sched_power_off(vcpu);
+    return PSCI_RET_SUCCESS;
+}
+
+/*
+ * Standby behaves like WFI. For a powerdown state the vcpu resumes at
+ * entry_addr on wakeup, as if it had gone through CPU_ON.
+ */
+static u64 vpsci_cpu_suspend(vcpu_t *vcpu, u64 power_state, u64 entry_addr, u64 context_id)
+{
+    if(power_state & PSCI_POWER_STATE_TYPE_POWERDOWN) {
+        vpsci_reset_entry(vcpu, entry_addr, context_id);
+        /* the hardware sctlr_el1 is what gets saved when the vcpu is switched out */
+        write_sysreg(sctlr_el1, SCTLR_EL1_RESET);
+        sched_block(vcpu);
+        return context_id;
+    }
+
+    sched_block(vcpu);
+    return PSCI_RET_SUCCESS;
+}
+
+static s32 vpsci_affinity_info(vcpu_t *vcpu, u64 target_affinity, u64 lowest_affinity_level)
+{
+    /* only Aff0 is populated */
+    if(lowest_affinity_level != 0) {
+        return PSCI_RET_INVALID_PARAMS;
+    }
+
+    vcpu_t *target = vpsci_target(vcpu, target_affinity);
+    if(target == NULL) {
+        return PSCI_RET_INVALID_PARAMS;
+    }
+
+    return target->state == VCPU_ALLOCED ? PSCI_AFFINITY_OFF : PSCI_AFFINITY_ON;
+}
+
+static s32 vpsci_features(u64 qfunid)
+{
+    switch(qfunid) {
+        case PSCI_VERSION:
+        case PSCI_CPU_SUSPEND:
+        case PSCI_CPU_SUSPEND_64:
+        case PSCI_CPU_OFF:
+        case PSCI_SYSTEM_CPUON_32:
+        case PSCI_SYSTEM_CPUON:
+        case PSCI_AFFINITY_INFO:
+        case PSCI_AFFINITY_INFO_64:
+        case PSCI_MIGRATE_INFO_TYPE:
+        case PSCI_SYSTEM_OFF:
+        case PSCI_SYSTEM_RESET:
+        case PSCI_FEATURE:
+        case SMCCC_VERSION:
+            /* CPU_SUSPEND: original power_state format, no OS-initiated mode */
+            return PSCI_RET_SUCCESS;
+        default:
+            return PSCI_RET_NOT_SUPPORTED;
     }
+}
+
+/* Power off every vcpu of the vm, the vm can't be restarted so RESET ends up here as well */
+static void vpsci_system_off(vcpu_t *vcpu)
+{
+    struct vm *vm = vcpu->vm;
 
-    vcpu_t *target = vcpu->vm->vcpus[target_cpu];
-    target->regs.elr = entry_addr;
-    target->state = VCPU_READY;
-    /* wakeup the physical cpu */
-    return smc_call(PSCI_SYSTEM_CPUON, target_cpu, (u64)_start);
+    for(int i = 0; i < vm->nvcpu; i++) {
+        if(vm->vcpus[i]->state != VCPU_ALLOCED) {
+            sched_power_off(vm->vcpus[i]);
+        }
+    }
 }
 
-u64 vpsci_trap_smc(vcpu_t *vcpu, u64 funid, u64 target_cpu, u64 entry_addr)
+u64 vpsci_trap_smc(vcpu_t *vcpu, u64 funid, u64 target_cpu, u64 entry_addr, u64 context_id)
 {
     if(vcpu == NULL) {
         abort("vpsci_trap_smc with NULL vcpu");
@@ -43,21 +154,35 @@ u64 vpsci_trap_smc(vcpu_t *vcpu, u64 funid, u64 target_cpu, u64 entry_addr)
         case PSCI_MIGRATE_INFO_TYPE:
             return (s64)vpsci_migrate_info_type();     
         case PSCI_SYSTEM_OFF:
-            LOG_WARN("Unsupported PSCI CPU OFF\n");
-            break;
+            LOG_INFO("Vpsci system off from vm %s\n", vcpu->vm->name);
+            vpsci_system_off(vcpu);
+            return PSCI_RET_SUCCESS;
         case PSCI_SYSTEM_RESET:
-            LOG_WARN("Unsupported PSCI CPU RESET\n");
-            break;
+            LOG_WARN("Vm %s asked for a reset, which is unsupported, powering it off\n", vcpu->vm->name);
+            vpsci_system_off(vcpu);
+            return PSCI_RET_SUCCESS;
+        case PSCI_SYSTEM_CPUON_32:
         case PSCI_SYSTEM_CPUON:
-            return (s64)vpsci_cpu_on(vcpu, funid, target_cpu, entry_addr);
+            return (s64)vpsci_cpu_on(vcpu, funid, target_cpu, entry_addr, context_id);
+        case PSCI_CPU_OFF:
+            return (s64)vpsci_cpu_off(vcpu);
+        case PSCI_CPU_SUSPEND:
+        case PSCI_CPU_SUSPEND_64:
+            /* x1 - power_state, x2 - entry addr, x3 - context id */
+            return vpsci_cpu_suspend(vcpu, target_cpu, entry_addr, context_id);
+        case PSCI_AFFINITY_INFO:
+        case PSCI_AFFINITY_INFO_64:
+            return (s64)vpsci_affinity_info(vcpu, target_cpu, entry_addr);
         case PSCI_FEATURE:    /* Linux will use this funid to get the PSCI FEATURE */
-            /* fake it */
-            return 0;
-        case 0x80000000:
-            return 0;
+            return (s64)vpsci_features(target_cpu);
+        /* SMCCC 1.1 lets the guest discover the pv time service */
+        case SMCCC_VERSION:
+            return SMCCC_VERSION_1_1;
+        case SMCCC_ARCH_FEATURES:
+            return target_cpu == PV_TIME_FEATURES ? PSCI_RET_SUCCESS : (u64)(s64)PSCI_RET_NOT_SUPPORTED;
         default:
-            abort("Unknown function id : %p from hvc/smc call", funid);
-            return -1;
+            LOG_WARN_RATELIMITED("Unknown function id : %p from hvc/smc call\n", funid);
+            return (s64)PSCI_RET_NOT_SUPPORTED;
     }
     return -1;
-}
\ No newline at end of file
+}
@@ -0,0 +1,110 @@
+#include <types.h>
+#include <arch.h>
+#include <gicv3.h>
+#include <hrtimer.h>
+#include <vtimer.h>
+#include <vcpu.h>
+#include <sched.h>
+#include <xlog.h>
+
+/* The guest would see the timer interrupt, enabled and not masked */
+static inline bool vtimer_armed(struct vtimer *vt)
+{
+    return (vt->ctl & (CNTV_CTL_ENABLE | CNTV_CTL_IMASK)) == CNTV_CTL_ENABLE;
+}
+
+/*
+ * Background timer of a switched out vcpu. The virtual timer output is level
+ * sensitive, so once the vcpu is restored the hardware raises PPI 27 again and
+ * el1_irq_proc() injects it into that vcpu; here we only need to get it running.
+ */
+static void vtimer_expire(struct hrtimer *timer)
+{
+    struct vcpu *vcpu = timer->data;
+    vcpu->vtimer.pending = true;
+    sched_kick(vcpu);
+}
+
+void vtimer_init(struct vcpu *vcpu, u64 cntvoff, bool exclude_desched)
+{
+    struct vtimer *vt = &vcpu->vtimer;
+
+    vt->ctl             = 0;
+    vt->cval            = 0;
+    vt->cntvoff         = cntvoff;
+    vt->desched_at      = 0;
+    vt->exclude_desched = exclude_desched;
+    vt->active          = false;
+    vt->pending         = false;
+    vt->preempted       = false;
+    hrtimer_init(&vt->bg_timer, vtimer_expire, vcpu);
+}
+
+/* Called on the pcpu the vcpu is leaving */
+void vtimer_save(struct vcpu *vcpu)
+{
+    struct vtimer *vt = &vcpu->vtimer;
+    int cpu = coreid();
+
+    read_sysreg(vt->ctl, cntv_ctl_el0);
+    read_sysreg(vt->cval, cntv_cval_el0);
+
+    /* Stop the timer so it can't fire on behalf of the next vcpu */
+    write_sysreg(cntv_ctl_el0, 0);
+    isb();
+
+    /* A forwarded PPI 27 the guest has not deactivated yet moves with the vcpu */
+    vt->active = (GICR_READ32(cpu, GICR_ISACTIVER0) >> VTIMER_IRQ) & 0x1;
+    if(vt->active) {
+        GICR_WRITE32(cpu, GICR_ICACTIVER0, 1U << VTIMER_IRQ);
+    }
+
+    vt->desched_at = hrtimer_now();
+    /* switched out while still runnable, as opposed to blocked in WFI */
+    vt->preempted  = vcpu->state == VCPU_READY;
+
+    /*
+     * Guest virtual time is frozen while a preempted vcpu is excluded, so the
+     * deadline can't pass. A blocked vcpu is waiting for exactly this deadline.
+     */
+    if(vtimer_armed(vt) && !(vt->exclude_desched && vt->preempted)) {
+        hrtimer_start(&vt->bg_timer, vt->cval + vt->cntvoff);
+    }
+}
+
+/* Called on the pcpu the vcpu is about to run on */
+void vtimer_restore(struct vcpu *vcpu)
+{
+    struct vtimer *vt = &vcpu->vtimer;
+
+    hrtimer_cancel(&vt->bg_timer);
+
+    if(vt->exclude_desched && vt->preempted && vt->desched_at != 0) {
+        vt->cntvoff += hrtimer_now() - vt->desched_at;
+    }
+    vt->desched_at = 0;
+    vt->pending    = false;
+
+    write_sysreg(cntvoff_el2, vt->cntvoff);
+    write_sysreg(cntv_cval_el0, vt->cval);
+    if(vt->active) {
+        GICR_WRITE32(coreid(), GICR_ISACTIVER0, 1U << VTIMER_IRQ);
+    }
+    write_sysreg(cntv_ctl_el0, vt->ctl);
+    isb();
+}
+
+void vtimer_percpu_init(void)
+{
+    u64 cnthctl;
+
+    /* Leave the physical counter/timer to the guest, virtual timer is context switched */
+    read_sysreg(cnthctl, cnthctl_el2);
+    write_sysreg(cnthctl_el2, cnthctl | CNTHCTL_EL1PCTEN | CNTHCTL_EL1PCEN);
+    write_sysreg(cntvoff_el2, 0);
+    write_sysreg(cntv_ctl_el0, 0);
+    isb();
+
+    /* Any vcpu may run here, PPI 27 always follows the loaded context */
+    gicv3_ops.unmask(VTIMER_IRQ);
+}
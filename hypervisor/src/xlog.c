@@ -0,0 +1,47 @@
+#include <types.h>
+#include <hrtimer.h>
+#include <xlog.h>
+
+u32 xlog_mask = (1U << XLOG_NR_SUBSYS) - 1;
+
+const char *xlog_subsys_name[XLOG_NR_SUBSYS] = {
+    [XLOG_CORE]  = "core",
+    [XLOG_MM]    = "mm",
+    [XLOG_VM]    = "vm",
+    [XLOG_VCPU]  = "vcpu",
+    [XLOG_SCHED] = "sched",
+    [XLOG_VGIC]  = "vgic",
+    [XLOG_VPSCI] = "vpsci",
+    [XLOG_MMIO]  = "mmio",
+    [XLOG_VIRTIO] = "virtio",
+};
+
+/*
+ * Whether a rate limited message may go out. The call site's state is shared
+ * by all pcpus without a lock, a race just lets a message more through.
+ */
+bool __xlog_ratelimit(struct xlog_ratelimit *rl)
+{
+    /* the counter frequency is only known once the timers are up */
+    if(hrtimer_freq == 0) {
+        return true;
+    }
+
+    u64 now = hrtimer_now();
+
+    if(rl->begin == 0 || now - rl->begin >= hrtimer_us_to_cnt((u64)rl->interval_ms * 1000)) {
+        if(rl->missed != 0) {
+            printf("[X-Hyper warn] %d messages suppressed\n", rl->missed);
+        }
+        rl->begin   = now;
+        rl->printed = 0;
+        rl->missed  = 0;
+    }
+
+    if(rl->printed < rl->burst) {
+        rl->printed++;
+        return true;
+    }
+    rl->missed++;
+    return false;
+}
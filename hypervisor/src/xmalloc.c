@@ -1,3 +1,5 @@
+#define XLOG_SUBSYS XLOG_MM
+
 #include "xmalloc.h"
 #include "utils.h"
 #include "printf.h"
@@ -7,6 +9,10 @@
 
 extern blk_pool_t blk_pool_start[];
 
+_Static_assert(CONFIG_BLK_SIZE % BLK_SLICE_SIZE == 0, "XHYPER_XMALLOC_SIZE must be a multiple of 1K");
+/* the pool header gets one page in front of the pool in the linker script */
+_Static_assert(ALIGN_UP(sizeof(blk_pool_t)) <= 4096, "xmalloc pool header outgrew its page");
+
 blk_pool_t  *sys_blk;
 
 // 内存池初始化
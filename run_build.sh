@@ -4,13 +4,15 @@ load_addr=0x40200000
 entry_point=0x40200000
 output_name=X-Hyper_Uimage
 image_name=X-Hyper
+# debug, release or trace, see Makefile
+profile=${PROFILE:-debug}
 
 cd guest 
 make clean
-make 
+make PROFILE=${profile}
 
 cd ..
-make 
+make PROFILE=${profile}
 cd build
 # mkimage
 mkimage -A arm64 -O linux -C none -a $load_addr -e $entry_point -d ${image_name} ${output_name}
@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+"""
+Decode X-Hyper trace rings (hypervisor/include/trace.h) into a timeline.
+
+Dump the rings from the qemu monitor with the address and size printed by the
+"trace" console command, e.g.
+
+    (qemu) pmemsave <addr> <size> trace.bin
+
+then run
+
+    tools/trace_decode.py trace.bin
+
+Any dump that contains the rings works, they are found by their magic.
+Event names and formats come from hypervisor/include/trace_events.h.
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+TRACE_MAGIC = 0x43525458
+RING_HEADER = struct.Struct("<IHHIIQQ32x")   # 64 bytes, struct trace_ring
+RECORD = struct.Struct("<QHHIQQ")             # 32 bytes, struct trace_record
+NO_VCPU = 0xffff
+
+EVENTS_H = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                        "..", "hypervisor", "include", "trace_events.h")
+
+
+def load_events(path):
+    events = []
+    with open(path) as f:
+        for m in re.finditer(r'^TRACE_EVENT\((\w+),\s*"([^"]*)"\)', f.read(), re.M):
+            events.append((m.group(1), m.group(2)))
+    return events
+
+
+def format_args(fmt, arg0, arg1):
+    args = []
+    for conv, arg in zip(re.findall(r"%([dx])", fmt), (arg0, arg1)):
+        if conv == "d" and arg >= 1 << 63:
+            arg -= 1 << 64
+        args.append(arg)
+    return re.sub(r"%x", "%#x", fmt) % tuple(args)
+
+
+def find_rings(data):
+    magic = struct.pack("<I", TRACE_MAGIC)
+    off = data.find(magic)
+    while off >= 0:
+        if off + RING_HEADER.size <= len(data):
+            _, cpu, rec_size, nr, _, head, freq = RING_HEADER.unpack_from(data, off)
+            body = off + RING_HEADER.size
+            if rec_size == RECORD.size and nr > 0 and body + nr * rec_size <= len(data):
+                yield cpu, nr, head, freq, body
+                off = data.find(magic, body + nr * rec_size)
+                continue
+        off = data.find(magic, off + 1)
+
+
+def read_records(data):
+    records = []
+    freq = None
+    for cpu, nr, head, ring_freq, body in find_rings(data):
+        freq = freq or ring_freq
+        # the ring holds the last nr records, oldest at head % nr once wrapped
+        first = head - nr if head > nr else 0
+        for seq in range(first, head):
+            ts, event, vcpu, _, arg0, arg1 = RECORD.unpack_from(data, body + (seq % nr) * RECORD.size)
+            records.append((ts, cpu, event, vcpu, arg0, arg1))
+    records.sort()
+    return records, freq
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("dump", help="memory dump containing the trace rings")
+    parser.add_argument("--events", default=EVENTS_H, help="path to trace_events.h")
+    parser.add_argument("--cpu", type=int, action="append", help="only these pcpus")
+    args = parser.parse_args()
+
+    events = load_events(args.events)
+    with open(args.dump, "rb") as f:
+        data = f.read()
+
+    records, freq = read_records(data)
+    if not records:
+        sys.exit("no trace rings found in %s" % args.dump)
+
+    start = records[0][0]
+    prev = {}
+    for ts, cpu, event, vcpu, arg0, arg1 in records:
+        if args.cpu and cpu not in args.cpu:
+            continue
+        name, fmt = events[event] if event < len(events) else ("EVENT_%d" % event, "%x %x")
+        delta = ts - prev.get(cpu, ts)
+        prev[cpu] = ts
+        who = "-" if vcpu == NO_VCPU else "v%d" % vcpu
+        print("%14.3f us  (+%10.3f)  pcpu%d %-4s %-13s %s" % (
+            (ts - start) * 1e6 / freq, delta * 1e6 / freq, cpu, who, name,
+            format_args(fmt, arg0, arg1)))
+
+
+if __name__ == "__main__":
+    main()